@@ -71,6 +71,13 @@ namespace Abstract
          */
         virtual bool parse_vcpus_basic() = 0;
 
+        /**
+         * Load the domain's pfn to mfn translations, where it has any.
+         *
+         * @return boolean indicating success or failure.
+         */
+        virtual bool parse_p2m() = 0;
+
         /**
          * Print the information about this domain.
          * Information includes (where relevant).
@@ -30,6 +30,8 @@
 
 #include <elf.h>
 
+struct KdumpLayout;
+
 /// Elf Program Header useful subset.
 struct ElfProgHdr
 {
@@ -87,6 +89,13 @@ namespace Abstract
          */
         virtual bool parse() = 0;
 
+        /**
+         * Layout of the page data, for kdump-compressed cores.
+         * @returns Layout, or NULL if the page data is described by the
+         * program headers.
+         */
+        virtual const KdumpLayout * kdump_layout() const { return NULL; }
+
         /// Elf architecture.
         enum ElfType {
             /// Unknown.
@@ -27,10 +27,24 @@
  */
 
 #include <cstring>
+#include <vector>
 #include "types.hpp"
 
 namespace Abstract
 {
+    /**
+     * A range of virtual memory which is contiguous in machine memory.
+     */
+    struct PhysExtent
+    {
+        /// Virtual address of the start of the extent.
+        vaddr_t vaddr;
+        /// Machine address of the start of the extent.
+        maddr_t maddr;
+        /// Length of the extent, in bytes.
+        size_t len;
+    };
+
     /**
      * Abstract base class for all pagetable walking operations.
      *
@@ -58,6 +72,34 @@ namespace Abstract
          */
         virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
                           vaddr_t * page_end = NULL) const = 0;
+
+        /**
+         * Perform a pagetable walk, without throwing.  For probing
+         * addresses which may well not be mapped.  The default
+         * implementation catches the exceptions from walk(), so
+         * implementations should override it where they can fail cheaply.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @returns boolean indicating whether vaddr is mapped.
+         */
+        virtual bool try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end = NULL) const;
+
+        /**
+         * Translate a range of virtual memory into the fewest extents
+         * which are contiguous in machine memory.  Adjacent pages (of any
+         * size) which are also adjacent in machine memory are merged.
+         * @param vaddr Virtual address of the start of the range.
+         * @param n Length of the range, in bytes.
+         * @param extents Vector, cleared and then filled with the extents
+         * in ascending virtual address order.  If part of the range is not
+         * mapped, the walk's exception is thrown and extents holds the
+         * translation of everything before the fault.
+         */
+        void translate(const vaddr_t & vaddr, size_t n,
+                       std::vector<PhysExtent> & extents) const;
     };
 }
 
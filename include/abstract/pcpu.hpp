@@ -111,6 +111,11 @@ namespace Abstract
          */
         virtual int dump_stack(FILE * stream) const = 0;
 
+        /**
+         * Hint that the stack is about to be read, so it can be read ahead.
+         */
+        virtual void prefetch_stack() const = 0;
+
         /// Parsing flags.  Will be made up of PCPU::PCPUFlags
         uint32_t flags;
         /// Processor ID.
@@ -0,0 +1,82 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __X86_64_DISKDUMP_HPP__
+#define __X86_64_DISKDUMP_HPP__
+
+/**
+ * @file include/arch/x86_64/diskdump.hpp
+ * @author Andrew Cooper
+ */
+
+#include "arch/x86_64/elf.hpp"
+#include "kdump.hpp"
+
+namespace x86_64
+{
+
+/**
+ * Parser for 64bit kdump-compressed crash files, as written by
+ * makedumpfile -c/-l/-p/-z.  The notes are the same as in an elf crash
+ * file; the page data is described by a KdumpLayout rather than by
+ * program headers.
+ */
+    class DiskDump : public Elf
+    {
+    public:
+        /**
+         * Constructor.
+         * @param fd File descriptor to read from.
+         */
+        DiskDump(int fd);
+
+        /// Destructor.
+        virtual ~DiskDump();
+
+        /**
+         * Parse the file headers.
+         * @returns boolean indicating success or failure.
+         */
+        virtual bool parse();
+
+        /**
+         * Layout of the page data.
+         * @returns Layout.
+         */
+        virtual const KdumpLayout * kdump_layout() const { return &this->layout; }
+
+    protected:
+        /// Layout of the page data.
+        KdumpLayout layout;
+    };
+
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
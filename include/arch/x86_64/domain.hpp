@@ -27,6 +27,7 @@
  */
 
 #include "abstract/domain.hpp"
+#include "arch/x86_64/frame-map.hpp"
 
 namespace x86_64
 {
@@ -60,6 +61,13 @@ namespace x86_64
          */
         virtual bool parse_vcpus_basic();
 
+        /**
+         * Load the P2M of a 64bit PV domain.
+         *
+         * @return boolean indicating success or failure.
+         */
+        virtual bool parse_p2m();
+
         /**
          * Print the information about this domain.
          * Information includes (where relevant).
@@ -121,6 +129,9 @@ namespace x86_64
          */
         virtual const Abstract::PageTable & get_dompt() const;
 
+        /// PV P2M, if loaded.
+        FrameMap p2m;
+
     private:
 
         /**
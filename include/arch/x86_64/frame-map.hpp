@@ -0,0 +1,158 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __X86_64_FRAME_MAP_HPP__
+#define __X86_64_FRAME_MAP_HPP__
+
+/**
+ * @file include/arch/x86_64/frame-map.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+#include "abstract/pagetable.hpp"
+
+#include <cstddef>
+
+namespace x86_64
+{
+
+/**
+ * Frame number translation table, loaded in bulk from the core.
+ *
+ * Used both for Xen's machine to phys (M2P) table, translating mfns to
+ * the pfns of whichever domain owns them, and for the phys to machine
+ * (P2M) table of a PV domain.  Entries are held as 32bit frame numbers
+ * (16TB), half the size of Xen's own tables; entries which are invalid,
+ * unreadable or too large are all held as invalid.  Lookups are a single
+ * array index.
+ */
+    class FrameMap
+    {
+    public:
+        /// Constructor.  The map starts empty.
+        FrameMap();
+        /// Destructor.
+        ~FrameMap();
+
+        /**
+         * Load Xen's M2P table, from its read/write mapping in Xen's
+         * virtual address space.
+         * @param xenpt Xen PageTables.
+         * @returns boolean indicating success or failure.
+         */
+        bool load_m2p(const Abstract::PageTable & xenpt);
+
+        /**
+         * Load the P2M of a 64bit PV domain, via the frame list list in
+         * its shared info.
+         * @param xenpt Xen PageTables.
+         * @param domain_ptr Xen struct domain pointer.
+         * @returns boolean indicating success or failure.
+         */
+        bool load_p2m(const Abstract::PageTable & xenpt, const vaddr_t & domain_ptr);
+
+        /**
+         * Translate a frame number.
+         * @param frame Frame number to translate.
+         * @param result Translated frame number.
+         * @returns boolean indicating whether the frame has a valid
+         * translation.
+         */
+        bool lookup(const uint64_t & frame, uint64_t & result) const
+        {
+            if ( frame >= this->nr_frames || this->table[frame] == INVALID )
+                return false;
+            result = this->table[frame];
+            return true;
+        }
+
+        /// Number of frames covered by the map.
+        uint64_t size() const { return this->nr_frames; }
+
+        /// Number of frames with a valid translation.
+        uint64_t nr_valid() const { return this->valid; }
+
+        /// Memory used by the map, in bytes.
+        size_t memory_cost() const { return this->nr_frames * sizeof *this->table; }
+
+        /**
+         * Log the memory used by frame maps.
+         */
+        static void log_statistics();
+
+        /// Whether to load frame maps at all.  Off unless asked for.
+        static bool enabled;
+
+    protected:
+        /// Table entry for a frame without a valid translation.
+        static const uint32_t INVALID = ~0U;
+
+        /**
+         * Allocate an empty table.  Refused, with a warning, if the table
+         * would take more than half of the available memory.
+         * @param nr_frames Number of frames to cover.
+         * @returns boolean indicating success or failure.
+         */
+        bool allocate(uint64_t nr_frames);
+
+        /**
+         * Narrow a run of Xen's 64bit table entries into the table.
+         * @param first Index of the first entry.
+         * @param src Xen's entries.
+         * @param n Number of entries.
+         */
+        void store(uint64_t first, const uint64_t * src, size_t n);
+
+        /// Release the table.
+        void release();
+
+        /// Table of frame numbers.
+        uint32_t * table;
+        /// Number of entries in the table.
+        uint64_t nr_frames;
+        /// Number of valid entries in the table.
+        uint64_t valid;
+
+        /// Memory used by all frame maps currently loaded, in bytes.
+        static size_t total_cost;
+        /// Peak of total_cost.
+        static size_t peak_cost;
+
+    private:
+        // @cond EXCLUDE
+        FrameMap(const FrameMap &);
+        FrameMap & operator= (const FrameMap &);
+        // @endcond
+    };
+
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
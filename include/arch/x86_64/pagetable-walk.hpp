@@ -38,12 +38,190 @@
  * @param maddr Machine address result of the pagetable walk.
  * @param page_end If non-null, variable to be filled with the last virtual address
  * within the page which contains vaddr.
+ * @param page_shift If non-null, variable to be filled with log2 of the size
+ * of the page which contains vaddr.
  * @throws memseek
  * @throws memread
  * @throws pagefault
  */
 void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
-                       maddr_t & maddr, vaddr_t * page_end = NULL);
+                       maddr_t & maddr, vaddr_t * page_end = NULL,
+                       unsigned * page_shift = NULL);
+
+/**
+ * Details of a failed 64bit pagetable walk.
+ */
+struct WalkFault64
+{
+    /// Pagetable level of the fault, or 0 if a pagetable entry couldn't be read.
+    int level;
+    /// Reason for the fault, if level is non-zero.
+    pagefault::pagefault_reason reason;
+    /// Machine address of the unreadable entry, if level is zero.
+    maddr_t entry;
+    /// Why the entry couldn't be read, if level is zero.
+    ReadFault read;
+};
+
+/**
+ * Source of pagetable entries, for walking pagetables which don't live
+ * directly in machine memory (e.g. a guest's pagetables, addressed by guest
+ * physical address).
+ */
+class PTEReader
+{
+public:
+    /// Destructor.
+    virtual ~PTEReader() {}
+
+    /**
+     * Read a pagetable entry.
+     * @param entry Address of the entry.
+     * @param value Entry value result.
+     * @param fault Filled with the details of a failure.
+     * @returns boolean indicating success or failure.
+     */
+    virtual bool read(const maddr_t & entry, uint64_t & value, ReadFault & fault) const = 0;
+};
+
+/**
+ * Pagetable walk for 64bit mode, without throwing.
+ * @param cr3 Value of the cr3 register.
+ * @param vaddr Virtual address to look up.
+ * @param maddr Machine address result of the pagetable walk.
+ * @param page_end If non-null, variable to be filled with the last virtual address
+ * within the page which contains vaddr.
+ * @param page_shift If non-null, variable to be filled with log2 of the size
+ * of the page which contains vaddr.
+ * @param fault Variable to be filled with the details of a failure.
+ * @param reader Source of pagetable entries, or NULL to read them from
+ * machine memory.
+ * @returns boolean indicating whether vaddr is mapped.
+ */
+bool try_pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
+                           maddr_t & maddr, vaddr_t * page_end,
+                           unsigned * page_shift, WalkFault64 & fault,
+                           const PTEReader * reader = NULL);
+
+/**
+ * Intel EPT walk, translating a guest physical address to a machine
+ * address, without throwing.  AMD NPT uses the same format as 64bit
+ * pagetables, so is walked with try_pagetable_walk_64().
+ * @param root Machine address of the EPT PML4.
+ * @param gpaddr Guest physical address to look up.
+ * @param maddr Machine address result of the walk.
+ * @param page_end If non-null, variable to be filled with the last guest
+ * physical address within the page which contains gpaddr.
+ * @param page_shift If non-null, variable to be filled with log2 of the size
+ * of the page which contains gpaddr.
+ * @param fault Variable to be filled with the details of a failure.
+ * @returns boolean indicating whether gpaddr is mapped.
+ */
+bool try_ept_walk(const maddr_t & root, const maddr_t & gpaddr,
+                  maddr_t & maddr, vaddr_t * page_end,
+                  unsigned * page_shift, WalkFault64 & fault);
+
+/**
+ * Throw the exception corresponding to a failed walk.
+ * @param cr3 Value of the cr3 register.
+ * @param vaddr Virtual address which failed to walk.
+ * @param fault Details of the failure.
+ * @throws memseek
+ * @throws memread
+ * @throws pagefault
+ */
+void throw_walk_fault(const maddr_t & cr3, const vaddr_t & vaddr,
+                      const WalkFault64 & fault) __attribute__((noreturn));
+
+/**
+ * A present leaf mapping in 64bit pagetables.  The mapping covers virtual
+ * addresses vaddr to vaddr + (1 << page_shift) - 1.
+ */
+struct Mapping64
+{
+    /// First virtual address of the page.
+    vaddr_t vaddr;
+    /// Machine address of the page.
+    maddr_t maddr;
+    /// log2 of the page size.  12, 21, 30 or 39.
+    unsigned page_shift;
+    /// Writable at every level.
+    bool writable;
+    /// User accessible at every level.
+    bool user;
+    /// No-execute at any level.
+    bool nx;
+};
+
+/**
+ * Enumerator of every present mapping in a set of 64bit pagetables.
+ *
+ * Each pagetable is read as a single block, rather than one entry at a
+ * time as pagetable_walk_64() does, making it practical to inventory an
+ * entire address space.  Pagetables which can't be read are skipped and
+ * counted.
+ */
+class AddressSpace64
+{
+public:
+    /**
+     * Constructor.
+     * @param cr3 Value of the cr3 register.
+     * @param start Lowest virtual address of interest.
+     * @param end Highest virtual address of interest.
+     */
+    AddressSpace64(const maddr_t & cr3, const vaddr_t & start = 0,
+                   const vaddr_t & end = ~0ULL);
+
+    /**
+     * Get the next mapping which overlaps start to end, in ascending
+     * virtual address order.
+     * @param mapping Mapping result.
+     * @returns boolean indicating whether there was another mapping.
+     */
+    bool next(Mapping64 & mapping);
+
+    /**
+     * Number of pagetables skipped because they couldn't be read.
+     * @returns count.
+     */
+    size_t nr_bad_tables() const { return this->bad_tables; }
+
+protected:
+    /// Number of pagetable levels.
+    static const unsigned LEVELS = 4;
+    /// Number of entries per pagetable.
+    static const unsigned ENTRIES = 512;
+
+    /**
+     * Read a pagetable into tables[level].
+     * @param level Level, 0 for L1 to 3 for L4.
+     * @param table Machine address of the pagetable.
+     * @returns boolean indicating success or failure.
+     */
+    bool load(unsigned level, const maddr_t & table);
+
+    /// Lowest virtual address of interest.
+    vaddr_t start;
+    /// Highest virtual address of interest.
+    vaddr_t end;
+    /// Level currently being enumerated, or LEVELS when complete.
+    unsigned level;
+    /// Current pagetable at each level.
+    uint64_t tables[LEVELS][ENTRIES];
+    /// Index of the next entry to consider at each level.
+    unsigned index[LEVELS];
+    /// Virtual address mapped by entry 0 of the current table at each level.
+    vaddr_t base[LEVELS];
+    /// Whether the entries leading to each level are all writable.
+    bool writable[LEVELS];
+    /// Whether the entries leading to each level are all user accessible.
+    bool user[LEVELS];
+    /// Whether any of the entries leading to each level are no-execute.
+    bool nx[LEVELS];
+    /// Number of pagetables which couldn't be read.
+    size_t bad_tables;
+};
 
 #endif
 
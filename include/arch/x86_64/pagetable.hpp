@@ -27,6 +27,8 @@
  */
 
 #include "abstract/pagetable.hpp"
+#include "arch/x86_64/pagetable-walk.hpp"
+#include "tlb.hpp"
 
 namespace x86_64
 {
@@ -54,9 +56,109 @@ namespace x86_64
         virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
                           vaddr_t * page_end = NULL) const;
 
+        /**
+         * Perform a pagetable walk, without throwing.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @returns boolean indicating whether vaddr is mapped.
+         */
+        virtual bool try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end = NULL) const;
+
     private:
         /// Control Register 3
         uint64_t cr3;
+        /// Cache of translations.
+        mutable TLB tlb;
+    };
+
+    /**
+     * Xen's own 64bit pagetables.
+     *
+     * Once setup_direct_map() has succeeded, addresses in Xen's 1:1 direct
+     * map of machine memory below max_page are translated arithmetically,
+     * as Xen's __virt_to_maddr() does, without a pagetable walk.
+     * Everything else is walked as for PT64.
+     */
+    class XenPT: public PT64
+    {
+    public:
+        /**
+         * Constructor.
+         * @param cr3 Control Register 3
+         */
+        XenPT(const uint64_t & cr3);
+        /// Destructor.
+        virtual ~XenPT();
+
+        /**
+         * Perform a pagetable walk.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         */
+        virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
+                          vaddr_t * page_end = NULL) const;
+
+        /**
+         * Perform a pagetable walk, without throwing.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @returns boolean indicating whether vaddr is mapped.
+         */
+        virtual bool try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end = NULL) const;
+
+        /**
+         * Read Xen's PDX compression parameters and max_page, enabling
+         * arithmetic direct map translation.  Xen versions without PDX
+         * compression are treated as having no hole.
+         * @param pt Pagetable to read Xen's variables with.
+         * @returns boolean indicating whether direct map translation is enabled.
+         */
+        static bool setup_direct_map(const Abstract::PageTable & pt);
+
+        /// Whether to check direct map translations against a real walk.
+        static bool verify_directmap;
+
+    protected:
+        /// Whether setup_direct_map() has succeeded.
+        static bool dm_enabled;
+        /// Xen's pfn_pdx_hole_shift.
+        static unsigned dm_hole_shift;
+        /// Xen's ma_va_bottom_mask.
+        static uint64_t dm_bottom_mask;
+        /// Xen's ma_top_mask.
+        static uint64_t dm_top_mask;
+        /// Machine address of the end of frame max_page.
+        static maddr_t dm_limit;
+
+        /**
+         * Translate an address in the direct map.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @returns boolean indicating whether vaddr was translated, which
+         * it isn't outside the direct map or beyond max_page.
+         */
+        bool direct_map(const vaddr_t & vaddr, maddr_t & maddr,
+                        vaddr_t * page_end) const;
+
+        /**
+         * Check a direct map translation against a pagetable walk, warning
+         * and using the walked result if they differ.
+         * @param vaddr Virtual address.
+         * @param maddr Direct map translation, corrected if necessary.
+         * @param walked Translation from the pagetable walk.
+         */
+        void check_direct_map(const vaddr_t & vaddr, maddr_t & maddr,
+                              const maddr_t & walked) const;
     };
 
     /**
@@ -87,9 +189,151 @@ namespace x86_64
         virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
                           vaddr_t * page_end = NULL) const;
 
+        /**
+         * Perform a pagetable walk, without throwing.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @returns boolean indicating whether vaddr is mapped.
+         */
+        virtual bool try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end = NULL) const;
+
     private:
         /// Control Register 3
         uint64_t cr3;
+        /// Cache of translations.
+        mutable TLB tlb;
+    };
+
+    /**
+     * Hardware assisted paging p2m, translating guest physical addresses
+     * to machine addresses.  Intel EPT or AMD NPT, depending on the cpu
+     * vendor.
+     */
+    class P2M: public Abstract::PageTable
+    {
+    public:
+        /**
+         * Constructor.
+         * @param root Machine address of the top level p2m table.
+         * @param ept Whether the p2m is in EPT format, rather than NPT.
+         */
+        P2M(const maddr_t & root, bool ept);
+        /// Destructor.
+        virtual ~P2M();
+
+        /**
+         * Translate a guest physical address.
+         * @param gpaddr Guest physical address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last guest physical address of the page.
+         */
+        virtual void walk(const vaddr_t & gpaddr, maddr_t & maddr,
+                          vaddr_t * page_end = NULL) const;
+
+        /**
+         * Translate a guest physical address, without throwing.
+         * @param gpaddr Guest physical address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last guest physical address of the page.
+         * @returns boolean indicating whether gpaddr is mapped.
+         */
+        virtual bool try_walk(const vaddr_t & gpaddr, maddr_t & maddr,
+                              vaddr_t * page_end = NULL) const;
+
+        /**
+         * Translate a guest physical address, through the TLB.
+         * @param gpaddr Guest physical address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_shift Variable to be filled with log2 of the size of
+         * the page.
+         * @param fault Variable to be filled with the details of a failure.
+         * @returns boolean indicating whether gpaddr is mapped.
+         */
+        bool translate(const maddr_t & gpaddr, maddr_t & maddr,
+                       unsigned & page_shift, WalkFault64 & fault) const;
+
+    private:
+        /// Machine address of the top level p2m table.
+        maddr_t root;
+        /// Whether the p2m is in EPT format.
+        bool ept;
+        /// Cache of translations.
+        mutable TLB tlb;
+    };
+
+    /**
+     * 64bit pagetables of an HVM guest using hardware assisted paging.
+     *
+     * A two stage translation: the guest's own pagetables (whose entries
+     * are guest physical addresses) to a guest physical address, then the
+     * p2m to a machine address.  Both stages have a TLB, and the combined
+     * translation is cached too.
+     */
+    class HAP64: public Abstract::PageTable
+    {
+    public:
+        /**
+         * Constructor.
+         * @param p2m_root Machine address of the top level p2m table.
+         * @param ept Whether the p2m is in EPT format, rather than NPT.
+         * @param cr3 Guest cr3.
+         * @param paging Whether the guest has paging enabled.  If not,
+         * virtual addresses are guest physical addresses.
+         */
+        HAP64(const maddr_t & p2m_root, bool ept, const uint64_t & cr3,
+              bool paging);
+        /// Destructor.
+        virtual ~HAP64();
+
+        /**
+         * Perform a pagetable walk.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         */
+        virtual void walk(const vaddr_t & vaddr, maddr_t & maddr,
+                          vaddr_t * page_end = NULL) const;
+
+        /**
+         * Perform a pagetable walk, without throwing.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @returns boolean indicating whether vaddr is mapped.
+         */
+        virtual bool try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end = NULL) const;
+
+    protected:
+        /**
+         * Translate a virtual address through both stages.
+         * @param vaddr Virtual address to look up.
+         * @param maddr Machine address variable for the result.
+         * @param page_end If non-null, variable to be filled with the
+         * last virtual address of the page.
+         * @param fault Variable to be filled with the details of a failure.
+         * Level 0 means a guest physical address wasn't mapped by the p2m.
+         * @returns boolean indicating whether vaddr is mapped.
+         */
+        bool translate(const vaddr_t & vaddr, maddr_t & maddr,
+                       vaddr_t * page_end, WalkFault64 & fault) const;
+
+    private:
+        /// Second stage translation.
+        P2M p2m;
+        /// Guest cr3.
+        uint64_t cr3;
+        /// Whether the guest has paging enabled.
+        bool paging;
+        /// Cache of combined translations.
+        mutable TLB tlb;
     };
 }
 
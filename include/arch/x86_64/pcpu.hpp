@@ -102,6 +102,11 @@ namespace x86_64
          */
         virtual int dump_stack(FILE * stream) const;
 
+        /**
+         * Hint that the stack is about to be read, so it can be read ahead.
+         */
+        virtual void prefetch_stack() const;
+
     protected:
         /// PCPU Registers
         x86_64regs regs;
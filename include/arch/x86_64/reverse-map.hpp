@@ -0,0 +1,124 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __X86_64_REVERSE_MAP_HPP__
+#define __X86_64_REVERSE_MAP_HPP__
+
+/**
+ * @file include/arch/x86_64/reverse-map.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+#include "abstract/pagetable.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace x86_64
+{
+
+/**
+ * Index from machine addresses to the Xen virtual addresses mapping them.
+ *
+ * Built in a single pass over Xen's idle pagetables, covering only Xen's
+ * own slots, and not the PV guest kernel range above them.  The direct
+ * map is left out, as its translation is simple arithmetic and it would otherwise
+ * dominate the index; so are the linear pagetable slots, which only
+ * alias the pagetables themselves.  Each page size has its own array of
+ * mappings sorted by machine address, so a lookup is a binary search per
+ * page size.
+ */
+    class ReverseMap
+    {
+    public:
+        /// Constructor.  The map starts empty.
+        ReverseMap();
+
+        /**
+         * Build the index from idle_pg_table.
+         * @param xenpt Xen's pagetables, to locate idle_pg_table with.
+         * @returns boolean indicating success or failure.
+         */
+        bool build(const Abstract::PageTable & xenpt);
+
+        /// Whether build() has been called.
+        bool is_built() const { return this->built; }
+
+        /**
+         * Find the virtual addresses mapping a machine address, outside of
+         * the direct map.
+         * @param maddr Machine address.
+         * @param vaddrs Array for the results.
+         * @param max Size of vaddrs.
+         * @returns Number of mappings found, which may exceed max.
+         */
+        size_t lookup(const maddr_t & maddr, vaddr_t * vaddrs, size_t max) const;
+
+        /// Number of mappings in the index.
+        size_t size() const;
+
+    protected:
+        /// Number of page sizes: 4K, 2M and 1G.
+        static const unsigned NR_SIZES = 3;
+
+        /// Indexed mapping.
+        struct Entry
+        {
+            /// Machine address of the page.
+            maddr_t maddr;
+            /// Virtual address of the page.
+            vaddr_t vaddr;
+
+            /// Order by machine address, then virtual address.
+            bool operator< (const Entry & other) const
+            {
+                return this->maddr < other.maddr ||
+                    ( this->maddr == other.maddr && this->vaddr < other.vaddr );
+            }
+        };
+
+        /**
+         * Add the mappings of part of the address space.
+         * @param cr3 Value of the cr3 register.
+         * @param start Lowest virtual address.
+         * @param end Highest virtual address.
+         */
+        void add_range(const maddr_t & cr3, const vaddr_t & start, const vaddr_t & end);
+
+        /// Mappings of each page size, sorted by machine address.
+        std::vector<Entry> entries[NR_SIZES];
+        /// Whether build() has been called.
+        bool built;
+    };
+
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -30,6 +30,8 @@
 
 #include "arch/x86_64/structures.hpp"
 
+class ReadBatch;
+
 namespace x86_64
 {
 
@@ -61,6 +63,29 @@ namespace x86_64
          */
         virtual bool parse_basic(const vaddr_t & addr, const Abstract::PageTable & xenpt);
 
+        /**
+         * Batched parse_basic(), first stage.
+         * Queues the reads from Xen's struct vcpu into batch, so many vcpus
+         * can be parsed with the same batch.
+         * @param addr Xen pointer to a struct vcpu.
+         * @param batch Batch to add reads to.
+         */
+        void queue_basic(const vaddr_t & addr, ReadBatch & batch);
+
+        /**
+         * Batched parse_basic(), second stage.
+         * Once the first stage batch has been read, validates the domain
+         * pointer and queues the reads from the associated struct domain.
+         * @param batch Batch to add reads to.
+         */
+        void queue_basic_domain(ReadBatch & batch);
+
+        /**
+         * Batched parse_basic(), final stage.
+         * Once the second stage batch has been read, interprets the results.
+         */
+        void finish_basic();
+
         /**
          * Parse extended VCPU information, including registers.
          *
@@ -154,8 +179,32 @@ namespace x86_64
          */
         virtual bool parse_seg_regs(const vaddr_t & addr, const Abstract::PageTable & xenpt);
 
+        /**
+         * Parse the state needed to translate the guest addresses of a vcpu
+         * using hardware assisted paging, and replace dompt with a two
+         * stage (guest pagetables then p2m) translation.
+         *
+         * @param xenpt PageTable with which translations can be performed.
+         * @return boolean indicating success or failure.
+         */
+        bool parse_hap(const Abstract::PageTable & xenpt);
+
         /// Register values
         x86_64regs regs;
+
+        /// Domain is_32bit_pv, between batched parse_basic() stages.
+        uint8_t basic_is_32bit;
+        /// Domain paging_mode, between batched parse_basic() stages.
+        uint32_t basic_paging_mode;
+
+        /// Machine address of the HAP p2m root, if CPU_HAP_PT.
+        maddr_t p2m_root;
+        /// Whether the p2m is in EPT format, if CPU_HAP_PT.
+        bool p2m_ept;
+        /// Guest cr3, if CPU_HAP_PT.
+        uint64_t guest_cr3;
+        /// Whether the guest has paging enabled, if CPU_HAP_PT.
+        bool guest_paging;
     };
 
 }
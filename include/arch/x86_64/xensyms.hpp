@@ -56,6 +56,35 @@ namespace xensyms
     /// Offset of is_32bit_pv in Xen's struct arch_domain.
     extern vaddr_t DOMAIN_is_32bit_pv;
 
+    /// Offset of arch.hvm_vcpu.guest_cr[2] in Xen's struct vcpu.
+    extern vaddr_t VCPU_hvm_guest_cr2;
+    /// Offset of arch.hvm_vcpu.guest_efer in Xen's struct vcpu.
+    extern vaddr_t VCPU_hvm_guest_efer;
+    /// Offset of arch.p2m in Xen's struct domain.
+    extern vaddr_t DOMAIN_p2m;
+    /// Offset of phys_table in Xen's struct p2m_domain.
+    extern vaddr_t P2M_phys_table;
+
+    /// Xen's max_page symbol.
+    extern vaddr_t max_page;
+
+    /// Xen's pfn_pdx_hole_shift symbol.
+    extern vaddr_t pfn_pdx_hole_shift;
+    /// Xen's ma_va_bottom_mask symbol.
+    extern vaddr_t ma_va_bottom_mask;
+    /// Xen's ma_top_mask symbol.
+    extern vaddr_t ma_top_mask;
+
+    /// Xen's idle_pg_table symbol.
+    extern vaddr_t idle_pg_table;
+
+    /// Offset of shared_info in Xen's struct domain.
+    extern vaddr_t DOMAIN_shared_info;
+    /// Offset of arch.max_pfn in Xen's struct shared_info.
+    extern vaddr_t SHARED_max_pfn;
+    /// Offset of arch.pfn_to_mfn_frame_list_list in Xen's struct shared_info.
+    extern vaddr_t SHARED_frame_list_list;
+
     /// Xen's per_cpu__curr_vcpu symbol.
     extern vaddr_t per_cpu__curr_vcpu;
     /// Xen's __per_cpu_offset symbol
@@ -67,6 +96,11 @@ namespace xensyms
     DECLARE_XENSYM_GROUP(x86_64_vcpu);
     DECLARE_XENSYM_GROUP(x86_64_domain);
     DECLARE_XENSYM_GROUP(x86_64_per_cpu);
+    DECLARE_XENSYM_GROUP(x86_64_hap);
+    DECLARE_XENSYM_GROUP(x86_64_m2p);
+    DECLARE_XENSYM_GROUP(x86_64_pdx);
+    DECLARE_XENSYM_GROUP(x86_64_idle_pt);
+    DECLARE_XENSYM_GROUP(x86_64_pv_p2m);
     /// @endcond
 
     /**
@@ -0,0 +1,126 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __CORE_COPY_HPP__
+#define __CORE_COPY_HPP__
+
+/**
+ * @file include/core-copy.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <pthread.h>
+
+/**
+ * Background copy of the CORE file to an output file.
+ *
+ * A thread reads the source once, sequentially, and writes it to the
+ * output file, optionally leaving holes for pages of zeros.  Everything
+ * below the high-water mark has been written, so reads of that part of the
+ * source can be served from the copy instead, which avoids reading the
+ * (slow) source twice.
+ */
+class CoreCopy
+{
+public:
+    /// Constructor.
+    CoreCopy();
+    /// Destructor.  Waits for the copy to complete.
+    ~CoreCopy();
+
+    /**
+     * Start copying.
+     * @param src File descriptor of the source.  Not owned.
+     * @param path Path of the output file, which is truncated.
+     * @param sparse Whether to leave holes for pages of zeros.
+     * @returns boolean indicating success or failure.
+     */
+    bool start(int src, const char * path, bool sparse);
+
+    /**
+     * Wait for the copy to complete.
+     * @returns boolean indicating whether the whole source was copied.
+     */
+    bool finish();
+
+    /**
+     * Get a file descriptor from which n bytes at offset of the source can
+     * be read.
+     * @param offset File offset.
+     * @param n Number of bytes.
+     * @returns The copy, if the range has been written, otherwise -1.
+     */
+    int fd_for(uint64_t offset, size_t n) const
+    {
+        if ( this->dst < 0 ||
+             offset + n > __atomic_load_n(&this->copied, __ATOMIC_ACQUIRE) )
+            return -1;
+        return this->dst;
+    }
+
+protected:
+    /**
+     * Thread entry point.
+     * @param self CoreCopy instance.
+     * @returns NULL.
+     */
+    static void * thread_main(void * self);
+
+    /// Copy the source.  Runs on the copy thread.
+    void run();
+
+    /// Source file descriptor.
+    int src;
+    /// Output file descriptor, or -1.
+    int dst;
+    /// Whether to leave holes for pages of zeros.
+    bool sparse;
+    /// Whether the copy thread is running.
+    bool running;
+    /// Whether the copy thread reached the end of the source.
+    bool complete;
+    /// Copy thread.
+    pthread_t thread;
+    /// Number of bytes of the source written to the copy.
+    uint64_t copied;
+    /// Number of bytes of zeros left as holes.
+    uint64_t skipped;
+
+private:
+    // @cond EXCLUDE
+    CoreCopy(const CoreCopy &);
+    CoreCopy & operator= (const CoreCopy &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -145,6 +145,20 @@ public:
     int error;
 };
 
+/**
+ * Details of a failed read which didn't throw, so the matching memseek or
+ * memread can be thrown later.
+ */
+struct ReadFault
+{
+    /// Whether the read failed to seek, rather than coming up short.
+    bool seek;
+    /// Number of bytes read, if not a seek failure.
+    ssize_t count;
+    /// Error (valid if count is -1)
+    int error;
+};
+
 /**
  * Pagefault exception
  *
@@ -0,0 +1,181 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __FRAME_CACHE_HPP__
+#define __FRAME_CACHE_HPP__
+
+/**
+ * @file include/frame-cache.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+
+#include <cstddef>
+
+/**
+ * Bounded cache of 4K machine frames.
+ *
+ * Eviction is segmented LRU.  Newly inserted frames go onto a probationary
+ * list, and are promoted to a protected list the second time they are hit.
+ * Pagetable frames (which are hit on every pagetable walk) quickly end up
+ * protected, while streaming reads of data pages cycle through the
+ * probationary list without evicting them.
+ *
+ * The cache is not internally locked.  Pointers returned by lookup() are
+ * only valid until the next insert().
+ */
+class FrameCache
+{
+public:
+    /// Size of a cached frame.
+    static const size_t FRAME_SIZE = 4096;
+
+    /// Constructor.  The cache starts disabled.
+    FrameCache();
+    /// Destructor.
+    ~FrameCache();
+
+    /**
+     * Resize the cache, discarding all cached frames.
+     * @param nr_frames Number of frames to cache.  0 disables the cache.
+     * @returns boolean indicating success or failure.
+     */
+    bool resize(size_t nr_frames);
+
+    /**
+     * Is the cache enabled?
+     * @returns boolean.
+     */
+    bool enabled() const { return this->nr_frames != 0; }
+
+    /**
+     * Look up a frame.
+     * @param frame Machine address of the frame.  Must be 4K aligned.
+     * @returns Frame contents, or NULL if the frame is not cached.
+     */
+    const char * lookup(const maddr_t & frame);
+
+    /**
+     * Insert a frame, evicting the least valuable frame if full.  If the
+     * frame is already cached, its contents are left unchanged.
+     * @param frame Machine address of the frame.  Must be 4K aligned.
+     * @param contents FRAME_SIZE bytes of frame contents.
+     */
+    void insert(const maddr_t & frame, const char * contents);
+
+    /// Number of lookups which hit.
+    uint64_t hits;
+    /// Number of lookups which missed.
+    uint64_t misses;
+    /// Number of frames evicted.
+    uint64_t evictions;
+
+protected:
+
+    /// Cache slot.
+    struct Slot
+    {
+        /// Machine address of the frame, or -1 if unused.
+        maddr_t frame;
+        /// Next slot in the hash chain, or -1.
+        long hash_next;
+        /// Previous slot in the LRU list, or -1.
+        long prev;
+        /// Next slot in the LRU list, or -1.
+        long next;
+        /// Which LRU list the slot is on.
+        int list;
+    };
+
+    /// LRU list identifiers.
+    enum { LIST_FREE = 0, LIST_PROBATION, LIST_PROTECTED, NR_LISTS };
+
+    /**
+     * Hash a frame address into a bucket index.
+     * @param frame Machine address of the frame.
+     * @returns Bucket index.
+     */
+    size_t hash(const maddr_t & frame) const;
+
+    /**
+     * Find the slot caching a frame.
+     * @param frame Machine address of the frame.
+     * @returns Slot index, or -1.
+     */
+    long find(const maddr_t & frame) const;
+
+    /**
+     * Unlink a slot from its LRU list.
+     * @param slot Slot index.
+     */
+    void unlink(long slot);
+
+    /**
+     * Push a slot onto the most recently used end of an LRU list.
+     * @param slot Slot index.
+     * @param list LRU list identifier.
+     */
+    void push(long slot, int list);
+
+    /**
+     * Unlink a slot from its hash chain.
+     * @param slot Slot index.
+     */
+    void unhash(long slot);
+
+    /// Number of frames in the cache.
+    size_t nr_frames;
+    /// Number of hash buckets.  Always a power of 2.
+    size_t nr_buckets;
+    /// Maximum number of frames on the protected list.
+    size_t max_protected;
+    /// Number of frames on each LRU list.
+    size_t list_len[NR_LISTS];
+    /// Most recently used slot of each LRU list.
+    long list_head[NR_LISTS];
+    /// Least recently used slot of each LRU list.
+    long list_tail[NR_LISTS];
+
+    /// Slots.
+    Slot * slots;
+    /// Hash buckets, containing the first slot of each hash chain.
+    long * buckets;
+    /// Frame data.  FRAME_SIZE bytes per slot.
+    char * data;
+
+private:
+    // @cond EXCLUDE
+    FrameCache(const FrameCache &);
+    FrameCache & operator= (const FrameCache &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
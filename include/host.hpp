@@ -33,6 +33,8 @@
 #include "abstract/pcpu.hpp"
 #include "abstract/elf.hpp"
 #include "arch/x86_64/structures.hpp"
+#include "arch/x86_64/frame-map.hpp"
+#include "arch/x86_64/reverse-map.hpp"
 
 /**
  * Host information.
@@ -100,6 +102,13 @@ public:
      */
     const Abstract::PageTable & get_xenpt() const;
 
+    /**
+     * Issue readahead hints for the parts of the core which decoding and
+     * printing Xen will need: Xen's own text and data, each PCPU stack
+     * and the console ring.  Failures are ignored.
+     */
+    void plan_readahead() const;
+
     /**
      * Parse a VMCOREINFO ELF note.
      * @param note The ELF note to parse.
@@ -154,6 +163,12 @@ public:
     /// dom0 vmcoreinfo
     CoreInfo dom0_vmcoreinfo;
 
+    /// Xen's M2P table, if loaded.
+    x86_64::FrameMap m2p;
+
+    /// Index from machine to Xen virtual addresses, built on first use.
+    x86_64::ReverseMap xen_rmap;
+
 private:
     // @cond EXCLUDE
     Host(const Host &);
@@ -0,0 +1,161 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __IO_URING_HPP__
+#define __IO_URING_HPP__
+
+/**
+ * @file include/io-uring.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <sys/types.h>
+
+/**
+ * Minimal io_uring read engine.
+ *
+ * Keeps many positional reads of a single file in flight at once, which
+ * helps when reading from /proc/vmcore where each read is latency bound.
+ * Uses the raw system calls, so has no library dependency.  Only built if
+ * HAVE_IO_URING is defined; otherwise setup() always fails and callers
+ * fall back to pread().
+ *
+ * Not internally locked.
+ */
+class IoUring
+{
+public:
+    /// A single read.
+    struct Read
+    {
+        /// File offset.
+        uint64_t offset;
+        /// Destination buffer.
+        char * dst;
+        /// Number of bytes.
+        size_t len;
+        /// Number of bytes read, or -errno.  Filled by read_many().
+        ssize_t result;
+        /// Address the read is for, for error reporting.  Not used by the ring.
+        uint64_t addr;
+    };
+
+    /// Constructor.
+    IoUring();
+    /// Destructor.
+    ~IoUring();
+
+    /**
+     * Set up the ring.
+     * @param fd File descriptor to read from.
+     * @param entries Submission queue depth.
+     * @returns boolean indicating success or failure.
+     */
+    bool setup(int fd, unsigned entries);
+
+    /**
+     * Is the ring usable?
+     * @returns boolean.
+     */
+    bool enabled() const { return this->ring_fd >= 0; }
+
+    /**
+     * Perform a set of reads, keeping up to the queue depth in flight.
+     * Individual reads may fail or be short, which is reported in their
+     * result.  io_uring_enter() failing with EAGAIN or EBUSY is retried a
+     * bounded number of times, with backoff.  If the ring itself fails, the
+     * reads already submitted are waited for, the ring is torn down and
+     * false is returned, in which case the results are unspecified.
+     * @param reads Array of reads.
+     * @param nr Number of reads.
+     * @returns boolean indicating whether the ring was usable.
+     */
+    bool read_many(Read * reads, size_t nr);
+
+protected:
+    /// Tear down the ring.
+    void teardown();
+
+    /**
+     * Consume the completions currently in the completion queue, storing
+     * their results.
+     * @param reads Array of reads the completions are for.
+     * @returns Number of completions consumed.
+     */
+    unsigned reap(Read * reads);
+
+    /// Ring file descriptor, or -1.
+    int ring_fd;
+    /// File descriptor being read.
+    int fd;
+    /// Submission queue depth.
+    unsigned sq_entries;
+
+    /// Submission/completion ring mapping.
+    void * ring;
+    /// Size of the ring mapping.
+    size_t ring_size;
+    /// Completion ring mapping, if separate from the submission ring.
+    void * cq_ring;
+    /// Size of the completion ring mapping.
+    size_t cq_ring_size;
+    /// Submission queue entries mapping.
+    void * sqes;
+    /// Size of the submission queue entries mapping.
+    size_t sqes_size;
+
+    /// Submission queue head.
+    unsigned * sq_head;
+    /// Submission queue tail.
+    unsigned * sq_tail;
+    /// Submission queue mask.
+    unsigned sq_mask;
+    /// Submission queue index array.
+    unsigned * sq_array;
+    /// Completion queue head.
+    unsigned * cq_head;
+    /// Completion queue tail.
+    unsigned * cq_tail;
+    /// Completion queue mask.
+    unsigned cq_mask;
+    /// Completion queue entries.
+    void * cqes;
+
+private:
+    // @cond EXCLUDE
+    IoUring(const IoUring &);
+    IoUring & operator= (const IoUring &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,218 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __KDUMP_HPP__
+#define __KDUMP_HPP__
+
+/**
+ * @file include/kdump.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+#include "frame-cache.hpp"
+#include "util/mutex.hpp"
+
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * Location of the page data in a kdump-compressed core.
+ * Filled in by the parser of the core file headers.
+ */
+struct KdumpLayout
+{
+    /// Block (and page) size.
+    uint64_t block_size;
+    /// File offset of the bitmap of dumped pages (the 2nd bitmap).
+    uint64_t bitmap_offset;
+    /// Size of the bitmap of dumped pages, in bytes.
+    uint64_t bitmap_size;
+    /// File offset of the page descriptor table.
+    uint64_t pd_offset;
+    /// Number of page frames covered by the bitmap.
+    uint64_t max_mapnr;
+};
+
+/**
+ * Reader for page data in kdump-compressed (makedumpfile) cores.
+ *
+ * The bitmap of dumped pages is held in memory with a rank index, so the
+ * page descriptor of any frame can be located in constant time.  Page
+ * descriptors are read on demand and cached by block, and decompressed
+ * pages are kept in a small frame cache.
+ *
+ * Safe to use from multiple threads once set up.
+ */
+class Kdump
+{
+public:
+    /// Constructor.
+    Kdump();
+    /// Destructor.
+    ~Kdump();
+
+    /**
+     * Set up the reader.  Loads the bitmap and builds the rank index.
+     * @param fd File descriptor of the core file.  Not owned.
+     * @param layout Layout of the core file.
+     * @returns boolean indicating success or failure.
+     */
+    bool setup(int fd, const KdumpLayout & layout);
+
+    /**
+     * Resize the cache of decompressed pages.
+     * @param nr_pages Number of pages to cache.  0 disables the cache.
+     * @returns boolean indicating success or failure.
+     */
+    bool resize_cache(size_t nr_pages);
+
+    /**
+     * Read n bytes from machine address addr into dst.
+     * @param addr Machine address.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     * @throws memseek if a page is not present in the core.
+     * @throws memread if a page can't be read or decompressed.
+     */
+    void read(const maddr_t & addr, char * dst, size_t n) const;
+
+    /**
+     * Are all of the frames covering n bytes from addr present in the
+     * core?  Frames may still fail to read if excluded or corrupt.
+     * @param addr Machine address.
+     * @param n Number of bytes.
+     * @returns boolean.
+     */
+    bool contains(const maddr_t & addr, size_t n) const;
+
+    /**
+     * Log statistics about the reader.
+     */
+    void log_statistics() const;
+
+    /// Page descriptor flags.
+    enum
+    {
+        /// Page compressed with zlib.
+        DUMP_DH_COMPRESSED_ZLIB = 0x1,
+        /// Page compressed with lzo.
+        DUMP_DH_COMPRESSED_LZO = 0x2,
+        /// Page compressed with snappy.
+        DUMP_DH_COMPRESSED_SNAPPY = 0x4,
+        /// Page excluded from the dump.
+        DUMP_DH_EXCLUDED = 0x10,
+        /// Page compressed with zstd.
+        DUMP_DH_COMPRESSED_ZSTD = 0x20,
+    };
+
+protected:
+
+    /// Page descriptor, as stored in the core file.
+    struct PageDesc
+    {
+        /// File offset of the page data.
+        int64_t offset;
+        /// Size of the page data.
+        uint32_t size;
+        /// Compression flags.
+        uint32_t flags;
+        /// Kernel page flags.
+        uint64_t page_flags;
+    };
+
+    /**
+     * Is a frame present in the dump?
+     * @param pfn Frame number.
+     * @returns boolean.
+     */
+    bool present(uint64_t pfn) const;
+
+    /**
+     * Get the index of a present frame in the page descriptor table.
+     * @param pfn Frame number.  Must be present.
+     * @returns Index.
+     */
+    uint64_t rank(uint64_t pfn) const;
+
+    /**
+     * Read the page descriptor for a present frame.
+     * @param pfn Frame number.
+     * @param desc Page descriptor to fill.
+     * @throws memread
+     */
+    void read_desc(uint64_t pfn, PageDesc & desc) const;
+
+    /**
+     * Read and decompress a frame.
+     * @param pfn Frame number.
+     * @param dst Destination buffer of block_size bytes.
+     * @throws memseek
+     * @throws memread
+     */
+    void read_page(uint64_t pfn, char * dst) const;
+
+    /**
+     * Read n bytes at foffset of the core file.
+     * @param foffset File offset.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     * @param addr Machine address, for error reporting.
+     * @throws memread
+     */
+    void read_file(uint64_t foffset, char * dst, size_t n, const maddr_t & addr) const;
+
+    /// Core file descriptor.
+    int fd;
+    /// Layout of the core file.
+    KdumpLayout layout;
+    /// Bitmap of dumped pages.
+    std::vector<uint64_t> bitmap;
+    /// Number of dumped pages preceding each group of 512 frames.
+    std::vector<uint64_t> ranks;
+
+    /// Cache of decompressed pages, keyed by machine address.
+    mutable FrameCache pages;
+    /// Cache of page descriptor blocks, keyed by file offset.
+    mutable FrameCache descs;
+    /// Lock protecting the caches.
+    mutable Mutex lock;
+
+    /// Number of pages decompressed.
+    mutable uint64_t nr_decompressed;
+
+private:
+    // @cond EXCLUDE
+    Kdump(const Kdump &);
+    Kdump & operator= (const Kdump &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -32,10 +32,17 @@
 #include "exceptions.hpp"
 #include "abstract/pagetable.hpp"
 #include "abstract/elf.hpp"
+#include "frame-cache.hpp"
+#include "io-uring.hpp"
+#include "core-copy.hpp"
+#include "util/mutex.hpp"
 
 #include <cstdio>
 
 using Abstract::PageTable;
+using Abstract::PhysExtent;
+
+class Kdump;
 
 /**
  * Memory region.
@@ -58,6 +65,8 @@ public:
     uint64_t length;
     /// Offset of memory region into core file.
     uint64_t offset;
+    /// Region contents in the mmap()'d core file, or NULL if not mapped.
+    const char * map;
 
     /**
      * Operator < for sorting purposes.
@@ -67,10 +76,58 @@ public:
     bool operator < (const MemRegion & rhs) const;
 };
 
+/**
+ * Batch of reads.
+ * Describes a set of reads up front, so Memory can sort and coalesce them
+ * into as few reads of the CORE file as possible.
+ */
+class ReadBatch
+{
+public:
+    /// A single read.
+    struct Request
+    {
+        /// Machine or virtual address, depending on how the batch is used.
+        uint64_t addr;
+        /// Destination buffer.
+        char * dst;
+        /// Number of bytes.
+        size_t len;
+    };
+
+    /// Constructor.
+    ReadBatch(): requests() {}
+
+    /**
+     * Add a read to the batch.
+     * @param addr Machine or virtual address.
+     * @param dst Destination buffer.
+     * @param len Number of bytes.
+     */
+    void add(const uint64_t & addr, void * dst, size_t len);
+
+    /**
+     * Add a read of an object to the batch.
+     * @param addr Machine or virtual address.
+     * @param dst Destination object.  sizeof dst bytes are read.
+     */
+    template <typename T> void add(const uint64_t & addr, T & dst)
+    {
+        this->add(addr, &dst, sizeof dst);
+    }
+
+    /// Requests in the batch.
+    std::vector<Request> requests;
+};
+
 /**
  * Memory
  * Provide a contiguous view of memory using the ELF CORE PT_LOAD
  * regions as a reference.
+ *
+ * Once setup() has completed, all read methods are safe to call
+ * concurrently from multiple threads.  The CORE file is only accessed with
+ * positional reads, so there is no shared file offset.
  */
 class Memory
 {
@@ -84,9 +141,76 @@ public:
      * Set up the memory regions
      * @param path Path of the ELF CORE file.
      * @param elf Elf parser.
+     * @param use_mmap Whether to try and mmap() the memory regions.  Regions
+     * which can't be mapped fall back to read().
      * @return boolean indicating success or failure.
      */
-    bool setup(const char * path, const Abstract::Elf * elf);
+    bool setup(const char * path, const Abstract::Elf * elf, bool use_mmap = true);
+
+    /**
+     * Set the size of the frame cache, used for reads from the core file
+     * which can't be satisfied from a mapping.
+     * @param nr_frames Number of 4K frames to cache.  0 disables the cache.
+     * @returns boolean indicating success or failure.
+     */
+    bool set_frame_cache(size_t nr_frames);
+
+    /**
+     * Try to use io_uring to keep multiple reads of the core file in flight
+     * when performing batched reads.  Falls back to pread() if unavailable.
+     * @param depth Submission queue depth.
+     * @returns boolean indicating whether io_uring is in use.
+     */
+    bool enable_io_uring(unsigned depth);
+
+    /**
+     * Start saving the core file to path in the background, with a single
+     * sequential read of the core file.  Subsequent reads of parts of the
+     * core file already saved are served from the copy.
+     * @param path Path of the output file.
+     * @param sparse Whether to leave holes for pages of zeros.
+     * @returns boolean indicating success or failure.
+     */
+    bool save_core(const char * path, bool sparse);
+
+    /**
+     * Wait for the core file to be saved.
+     * @returns boolean indicating whether the whole core file was saved.
+     */
+    bool finish_save_core();
+
+    /**
+     * Log statistics about memory accesses.
+     */
+    void log_statistics() const;
+
+    /**
+     * Hint that n bytes of machine memory starting at addr will be read
+     * soon, so the kernel can start reading them in the background.
+     * Parts of the range outside the core file are ignored.
+     * @param addr Machine address.
+     * @param n Number of bytes.
+     */
+    void prefetch(const maddr_t & addr, size_t n) const;
+
+    /**
+     * Hint that n bytes of virtual memory starting at vaddr will be read
+     * soon.  Unmapped parts of the range are skipped.  Never throws.
+     * @param pt PageTable to perform pagetable walks with.
+     * @param vaddr Virtual address.
+     * @param n Number of bytes.
+     */
+    void prefetch_vaddr(const PageTable & pt, const vaddr_t & vaddr, size_t n) const;
+
+    /**
+     * Get a view of n bytes of machine memory starting at addr.
+     * Only available for memory regions which were successfully mapped.
+     * @param addr Machine address.
+     * @param n Number of bytes.
+     * @returns Pointer into the mapped core file, or NULL if the entire
+     * range is not mapped.
+     */
+    const char * map_view(const maddr_t & addr, size_t n) const;
 
     /**
      * Read a string from machine address addr.
@@ -129,6 +253,26 @@ public:
     void read_block_vaddr(const PageTable & pt, const vaddr_t & addr, char * dst, ssize_t n) const;
 
 
+    /**
+     * Perform a batch of reads from machine addresses.
+     * Reads are sorted by position in the CORE file, and nearby reads from
+     * the same memory region are coalesced into a single read.
+     * @param batch Batch of reads.
+     * @throws memseek
+     * @throws memread
+     */
+    void read_batch(const ReadBatch & batch) const;
+
+    /**
+     * Perform a batch of reads from virtual addresses.
+     * @param pt PageTable to perform pagetable walks with.
+     * @param batch Batch of reads.
+     * @throws pagefault
+     * @throws memseek
+     * @throws memread
+     */
+    void read_batch_vaddr(const PageTable & pt, const ReadBatch & batch) const;
+
     /**
      * Read a 8 bit integer from addr.
      * Reads 1 bytes from addr into dst.
@@ -197,6 +341,75 @@ public:
      */
     void read64_vaddr(const PageTable & pt, const vaddr_t & addr, uint64_t & dst) const;
 
+    /**
+     * Read n bytes from machine address addr, without throwing.  For
+     * probing memory which may well not be present, where exceptions would
+     * be far more expensive than the read.
+     * @param addr Machine address.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     * @param fault If non-null, filled with the details of a failure.
+     * @returns boolean indicating success or failure.
+     */
+    bool try_read_block(const maddr_t & addr, char * dst, ssize_t n,
+                        ReadFault * fault = NULL) const;
+
+    /**
+     * Read a 64bit value from machine address addr, without throwing.
+     * @param addr Machine address.
+     * @param dst Destination.
+     * @param fault If non-null, filled with the details of a failure.
+     * @returns boolean indicating success or failure.
+     */
+    bool try_read64(const maddr_t & addr, uint64_t & dst, ReadFault * fault = NULL) const;
+
+    /**
+     * Read n bytes from virtual address vaddr, without throwing.
+     * @param pt PageTable to perform pagetable walks with.
+     * @param vaddr Virtual address.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     * @returns boolean indicating success or failure.  dst may have been
+     * partially filled on failure.
+     */
+    bool try_read_block_vaddr(const PageTable & pt, const vaddr_t & vaddr, char * dst, ssize_t n) const;
+
+    /**
+     * Read an 8bit value from virtual address vaddr, without throwing.
+     * @param pt PageTable to perform a pagetable walk with.
+     * @param vaddr Virtual address.
+     * @param dst Destination.
+     * @returns boolean indicating success or failure.
+     */
+    bool try_read8_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint8_t & dst) const;
+
+    /**
+     * Read a 16bit value from virtual address vaddr, without throwing.
+     * @param pt PageTable to perform a pagetable walk with.
+     * @param vaddr Virtual address.
+     * @param dst Destination.
+     * @returns boolean indicating success or failure.
+     */
+    bool try_read16_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint16_t & dst) const;
+
+    /**
+     * Read a 32bit value from virtual address vaddr, without throwing.
+     * @param pt PageTable to perform a pagetable walk with.
+     * @param vaddr Virtual address.
+     * @param dst Destination.
+     * @returns boolean indicating success or failure.
+     */
+    bool try_read32_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint32_t & dst) const;
+
+    /**
+     * Read a 64bit value from virtual address vaddr, without throwing.
+     * @param pt PageTable to perform a pagetable walk with.
+     * @param vaddr Virtual address.
+     * @param dst Destination.
+     * @returns boolean indicating success or failure.
+     */
+    bool try_read64_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint64_t & dst) const;
+
     /**
      * Writes a block of from addr into the specified file.
      * Reads n bytes starting at addr into file.
@@ -214,25 +427,190 @@ public:
      * @param addr Virtual address.
      * @param file Destination file reference.
      * @param n Length of buffer.
-     * @returns number of bytes read.
+     * @returns number of bytes read.  If the range is only partly mapped,
+     * everything before the fault is written before the fault is thrown.
      */
     ssize_t write_block_vaddr_to_file(const PageTable & pt, const vaddr_t & addr, FILE * file, ssize_t n) const;
 
 protected:
 
     /**
-     * Seek the CORE file to the byte representing the machine address addr.
-     * @param addr Machine address to seek to.
+     * Look up the memory region containing the machine address addr.
+     * @param addr Machine address.
+     * @returns Memory region, or NULL if addr is not in any region.
+     */
+    const MemRegion * lookup_region(const maddr_t & addr) const;
+
+    /**
+     * How many of the n bytes starting at addr lie in the same region as
+     * addr, and so can be read from the CORE file in one piece?
+     * @param addr Machine address.
+     * @param n Number of bytes.
+     * @returns Number of bytes, at most n.  n if addr is not in any
+     * region, so the subsequent read reports the error.
+     */
+    size_t region_span(const maddr_t & addr, size_t n) const;
+
+    /**
+     * Is addr within a hole in the region map?  Hole n is the gap between
+     * the end of region n-1 and the start of region n, where hole 0 is
+     * everything below the first region, and hole regions.size() is
+     * everything above the last.
+     * @param hole Hole index.
+     * @param addr Machine address.
+     * @returns boolean.
+     */
+    bool in_hole(size_t hole, const maddr_t & addr) const;
+
+    /**
+     * Comparator for searching the sorted region vector by address.
+     * @param addr Machine address.
+     * @param region Memory region.
+     * @returns boolean indicating whether addr is below the start of region.
+     */
+    static bool region_start_cmp(const maddr_t & addr, const MemRegion & region);
+
+    /**
+     * Merge regions which are contiguous in both machine memory and the
+     * CORE file, trim overlapping regions so they are disjoint, and drop
+     * empty regions.  The regions must be sorted.
+     */
+    void coalesce_regions();
+
+    /**
+     * Find the memory region containing the machine address addr.
+     * @param addr Machine address.
+     * @throws memseek
+     * @returns Memory region.
+     */
+    const MemRegion & find_region(const maddr_t & addr) const;
+
+    /**
+     * Translate the machine address addr to an offset in the CORE file.
+     * @param addr Machine address.
+     * @throws memseek
+     * @returns File offset.
+     */
+    off64_t file_offset(const maddr_t & addr) const;
+
+    /**
+     * Read n bytes at offset foffset of the CORE file, using positional
+     * reads so the shared file offset is never used.  Short reads are
+     * retried until EOF or error.
+     * @param foffset File offset.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     * @returns Number of bytes read, or -1 with errno set if nothing could
+     * be read.
+     */
+    ssize_t read_at(off64_t foffset, char * dst, ssize_t n) const;
+
+    /**
+     * Read n bytes from machine address addr into dst.  Uses the mapped
+     * core file where possible, falling back to read_at().
+     * @param addr Machine address.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     * @throws memseek
+     * @throws memread
+     */
+    void read_raw(const maddr_t & addr, char * dst, ssize_t n) const;
+
+    /**
+     * Try to read n bytes from machine address addr into dst using the
+     * frame cache.  Reads larger than a frame, or touching frames which are
+     * not wholly inside region, are not cached.
+     * @param region Memory region containing addr.
+     * @param addr Machine address.
+     * @param dst Destination buffer.
+     * @param n Number of bytes.
+     * @throws memseek
+     * @throws memread
+     * @returns boolean indicating whether the read was performed.
+     */
+    bool read_cached(const MemRegion & region, const maddr_t & addr,
+                     char * dst, ssize_t n) const;
+
+    /**
+     * Perform a set of reads of the CORE file, using io_uring if available.
+     * Short or failed reads are completed with read_at().
+     * @param reads Array of reads, whose addr is the machine address read,
+     * which is reported if the read fails.
+     * @param nr Number of reads.
+     * @throws memread
+     */
+    void read_many(IoUring::Read * reads, size_t nr) const;
+
+    /**
+     * Copy n bytes from machine address addr into file, using a kernel-side
+     * copy (copy_file_range() or sendfile()) so the data never passes
+     * through userspace.  The stream is flushed beforehand and its position
+     * resynchronised afterwards.
+     * @param addr Machine address.
+     * @param file Destination file.
+     * @param n Number of bytes.
+     * @throws memseek
+     * @returns Number of bytes copied, which may be short (including 0) if
+     * kernel-side copying is unavailable or fails.  The caller is
+     * responsible for the remainder.
+     */
+    ssize_t copy_to_file(const maddr_t & addr, FILE * file, ssize_t n) const;
+
+    /**
+     * Write translated extents of virtual memory into file, in order.
+     * @param extents Extents, from PageTable::translate().
+     * @param file Destination file.
+     * @returns Number of bytes written, short if a write fails.
+     */
+    ssize_t write_extents_to_file(const std::vector<PhysExtent> & extents, FILE * file) const;
+
+    /// Kernel-side copy methods, in order of preference.
+    enum { COPY_FILE_RANGE = 0, COPY_SENDFILE, COPY_NONE };
+
+    /**
+     * Try to mmap() a memory region of the core file.
+     * @param region Memory region to map.
+     * @param file_size Size of the core file.
      * @returns boolean indicating success or failure.
      */
-    void seek(const maddr_t & addr) const;
+    bool map_region(MemRegion & region, uint64_t file_size);
 
-    /// Vector of memory regions.
+    /// Vector of memory regions, sorted and coalesced.
     std::vector<MemRegion> regions;
     /// Whether the vector is finalised or not.
     bool finalised;
     /// Core File reference
     int fd;
+    /// Cache of frames read from the core file.
+    mutable FrameCache cache;
+    /// Lock protecting the frame cache.
+    mutable Mutex cache_lock;
+    /// Index of the region which satisfied the most recent lookup.
+    mutable size_t last_hit;
+    /// Index of the hole which the most recent failed lookup fell in.
+    mutable size_t last_hole;
+    /// io_uring engine for batched reads.
+    mutable IoUring ring;
+    /// Lock protecting the io_uring engine.
+    mutable Mutex ring_lock;
+    /// Number of reads issued for batches.
+    mutable uint64_t nr_batched_reads;
+    /// Number of reads issued for batches through io_uring.
+    mutable uint64_t nr_ring_reads;
+    /// Number of bytes hinted by prefetch().
+    mutable uint64_t nr_prefetched;
+    /// Preferred kernel-side copy method, downgraded when found unusable.
+    mutable int copy_method;
+    /// Reader for kdump-compressed cores, or NULL for elf cores.
+    Kdump * kdump;
+    /// Background copy of the core file, if saving it.
+    CoreCopy copy;
+
+private:
+    // @cond EXCLUDE
+    Memory(const Memory &);
+    Memory & operator= (const Memory &);
+    // @endcond
 };
 
 /// Memory
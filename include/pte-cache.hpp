@@ -0,0 +1,109 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __PTE_CACHE_HPP__
+#define __PTE_CACHE_HPP__
+
+/**
+ * @file include/pte-cache.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+#include "exceptions.hpp"
+#include "util/mutex.hpp"
+
+#include <cstddef>
+
+/**
+ * Cache of pagetable entries, keyed by the machine address of the entry.
+ *
+ * Upper level pagetables are shared between many address spaces (all of
+ * Xen's, and the Xen slots of every PV guest), so caching their entries
+ * independently of cr3 lets walks in one address space benefit from walks
+ * in another.  Direct mapped, with the buckets split between several locks
+ * so concurrent walks rarely contend.
+ */
+class PTECache
+{
+public:
+    /// Constructor.
+    PTECache();
+
+    /**
+     * Read a pagetable entry, from the cache if possible.
+     * @param entry Machine address of the entry.
+     * @param value Entry value result.
+     * @param fault If non-null, filled with the details of a failure.
+     * @returns boolean indicating whether the entry could be read.
+     */
+    bool read(const maddr_t & entry, uint64_t & value, ReadFault * fault = NULL);
+
+    /**
+     * Log statistics about the cache.
+     */
+    void log_statistics() const;
+
+protected:
+    /// Number of cached entries.  Must be a power of 2.
+    static const size_t NR_ENTRIES = 4096;
+    /// Number of locks.  Must be a power of 2.
+    static const size_t NR_LOCKS = 16;
+
+    /// Cached entry.
+    struct Entry
+    {
+        /// Machine address of the entry, or ~0 if empty.
+        maddr_t addr;
+        /// Entry value.
+        uint64_t value;
+    };
+
+    /// Entries.
+    Entry entries[NR_ENTRIES];
+    /// Locks, each protecting every NR_LOCKS'th entry.
+    Mutex locks[NR_LOCKS];
+
+    /// Number of hits.
+    uint64_t hits;
+    /// Number of misses.
+    uint64_t misses;
+
+private:
+    // @cond EXCLUDE
+    PTECache(const PTECache &);
+    PTECache & operator= (const PTECache &);
+    // @endcond
+};
+
+/// Global pagetable entry cache.
+extern PTECache pte_cache;
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
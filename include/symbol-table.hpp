@@ -27,9 +27,9 @@
  */
 
 #include "util/symbol.hpp"
-#include <map>
-#include <list>
+#include <vector>
 
+#include <cstddef>
 #include <cstdio>
 
 /**
@@ -38,6 +38,32 @@
  * and by address (to generate a stack trace).  Therefore, maintain two
  * mappings to the same symbol objects; one a mapping of virtual address
  * to symbol, and one a mapping of name to symbol.
+ *
+ * The symbols themselves are fixed size records in a single array, with
+ * every name in a single string arena, so a table of hundreds of
+ * thousands of symbols is a handful of allocations.
+ *
+ * The name mapping is an open addressing hash table.  Symbols sharing a
+ * name share a slot, which records that the name is ambiguous, so a lookup
+ * is a single probe sequence.  Slots are 8 bytes, far smaller than a tree
+ * node per symbol.
+ *
+ * The address mapping is a sorted array of code symbols, with a parallel
+ * array of just their addresses.  Symbolising a stack searches the
+ * addresses for every word, so they are kept contiguous and searched
+ * without data dependent branches.
+ *
+ * Symbol files are mapped and tokenised directly rather than through
+ * stdio.  Large files are split at line boundaries and the pieces parsed
+ * on several threads, then merged in file order.
+ *
+ * As all of the tables are flat arrays referring to each other by index,
+ * they can be saved as a single position independent image.  With a cache
+ * directory set, parsed tables are saved there keyed by a hash of the
+ * symbol file's contents, and later runs against the same file map the
+ * image instead of parsing.  Lookups always go through pointers to the
+ * tables, which point either into the vectors they were built in or into
+ * the mapped image.
  */
 class SymbolTable
 {
@@ -110,40 +136,110 @@ public:
     /// Whether this symbol table can decode hypercall pages.
     bool has_hypercall;
 
+    /// Directory to cache parsed symbol tables in, or NULL for no caching.
+    static const char * cache_dir;
+
 protected:
 
     /**
      * Insert a new Symbol into the tables.
-     * @param sym Symbol to insert.
+     * @param sym Symbol, whose name is already in the string arena.
      */
-    void insert(Symbol * sym);
+    void insert(const Symbol & sym);
 
     /**
-     * Private wrapper around std::strcmp.
-     * Suitable as a comparison function for std::multimap
-     * @param lhs Left hand side string.
-     * @param rhs Right hand side string.
-     * @returns boolean.
+     * Get the name of a symbol.
+     * @param sym Symbol from this table.
+     * @returns Name.
      */
-    static bool strcmp(const char * lhs, const char * rhs);
+    const char * name_of(const Symbol & sym) const { return &this->arena[sym.name]; }
 
     /**
-     * Private helper for sorting list.  Sorts by symbol address.
-     *
-     * @param lhs Left hand side Symbol.
-     * @param rhs Right hand side Symbol.
-     * @returns boolean.
+     * Log the memory used by the table, and how long it took to build.
+     * @param seconds Time taken to build the table.
+     */
+    void log_statistics(double seconds) const;
+
+    /**
+     * Build the tables from the contents of a symbol file.
+     * @param file Path to the symbol file, for logging.
+     * @param data Contents of the symbol file.
+     * @param size Size of the symbol file.
+     * @param offsets Whether to check for offset symbols.
+     * @returns boolean indicating success.
+     */
+    bool build(const char * file, const char * data, size_t size, bool offsets);
+
+    /**
+     * Tokenise the contents of a symbol file into the records and the
+     * string arena, applying xensyms, without building any index.
+     * @param file Path to the symbol file, for logging.
+     * @param data Contents of the symbol file.
+     * @param size Size of the symbol file.
+     * @param offsets Whether to check for offset symbols.
+     * @returns boolean indicating success.
+     */
+    bool tokenise(const char * file, const char * data, size_t size, bool offsets);
+
+    /**
+     * Point the tables at the vectors they were built in.
+     */
+    void use_vectors();
+
+    /**
+     * Map a cached image of the tables, and apply its xensyms.
+     * @param path Path to the cache file.
+     * @param key Content hash of the symbol file.
+     * @param size Size of the symbol file.
+     * @param offsets Whether to check for offset symbols.
+     * @returns boolean indicating whether the cache was valid and is in use.
+     */
+    bool load_cache(const char * path, uint64_t key, size_t size, bool offsets);
+
+    /**
+     * Save an image of the tables built from a symbol file.
+     * @param path Path to the cache file.
+     * @param key Content hash of the symbol file.
+     * @param size Size of the symbol file.
+     * @param offsets Whether offset symbols were checked for.
      */
-    static bool addrcmp(const Symbol * lhs, const Symbol * rhs);
+    void save_cache(const char * path, uint64_t key, size_t size, bool offsets) const;
 
     /**
-     * Private helper for searching lot.
+     * Hash the contents of a symbol file.  FNV-1a over 64bit words, with
+     * the high bits folded down each step, plus the size.
+     * @param data Contents of the file.
+     * @param size Size of the file.
+     * @returns hash.
+     */
+    static uint64_t content_hash(const char * data, size_t size);
+
+    /**
+     * Hash a symbol name.  FNV-1a.
+     * @param name Symbol name.
+     * @returns hash.
+     */
+    static uint32_t hash(const char * name);
+
+    /**
+     * Build the name index from all symbols.
+     */
+    void index_names();
+
+    /**
+     * Build the address index from the code symbols.
+     */
+    void index_addresses();
+
+    /**
+     * Find the code symbols either side of an address.
      *
-     * @param addr Address to compare.
-     * @param sym Symbol to compare to.
-     * @returns boolean.
+     * @param addr Address to look up.
+     * @param before Symbol containing addr.
+     * @param after Next symbol after before.
+     * @returns boolean indicating whether addr is between two symbols.
      */
-    static bool symcmp(const vaddr_t & addr, const Symbol * sym);
+    bool lookup(const vaddr_t & addr, const Symbol *& before, const Symbol *& after) const;
 
     /// value of '_stext' symbol.
     vaddr_t text_start,
@@ -156,21 +252,78 @@ protected:
     /// value of 'hypercall_page' symbol.
         hypercall_page;
 
-    /// Multimap of Symbol name -> Symbol
-    std::multimap<const char *, Symbol *, bool(*)(const char*, const char*)> names;
-    /// List of code symbols, for stack traces.
-    std::list<Symbol*> symbols;
+    /// Name index slot.
+    struct NameSlot
+    {
+        /**
+         * Index in all of the first symbol with this name, with NAME_DUP
+         * set if there are more, or NAME_EMPTY.
+         */
+        uint32_t idx;
+        /// Hash of the name.
+        uint32_t hash;
+    };
+
+    /// NameSlot index for an empty slot.
+    static const uint32_t NAME_EMPTY = ~0U;
+    /// NameSlot flag for a name shared by several symbols.
+    static const uint32_t NAME_DUP = 1U << 31;
+
+    /// Xensym found while parsing, saved so a cache can replay it.
+    struct XensymRecord
+    {
+        /// Value of the symbol or offset.
+        vaddr_t value;
+        /// Offset of the name in xensym_names.
+        uint64_t name;
+    };
+
+    /// Symbol records, in file order.
+    const Symbol * records;
+    /// Number of symbol records.
+    size_t nr_records;
+    /// String arena.
+    const char * arena;
+    /// Size of the string arena.
+    size_t arena_size;
+    /// Name index.
+    const NameSlot * name_index;
+    /// Number of name index slots.  Zero, or a power of two.
+    size_t name_index_size;
+    /// Indices of the code symbols, sorted by address.
+    const uint32_t * code_symbols;
+    /// Addresses of the code symbols, in the same order.
+    const vaddr_t * code_addresses;
+    /// Number of code symbols.
+    size_t nr_code;
 
-    /// List iterator
-    typedef std::list<Symbol*>::iterator list_iter;
-    /// Constant list iterator
-    typedef std::list<Symbol*>::const_iterator const_list_iter;
+    /// Mapped cache image holding the tables, or NULL.
+    void * image;
+    /// Size of the mapped cache image.
+    size_t image_size;
 
-    /// Multimap pair
-    typedef std::pair<const char *, Symbol*> name_pair;
+    /// All symbols, in file order.
+    std::vector<Symbol> all;
+    /// String arena holding the NUL terminated names of all symbols.
+    std::vector<char> strings;
+    /// Hash of the name of each symbol in all, until the name index is built.
+    std::vector<uint32_t> hashes;
+    /// Name index.  The size is a power of two, at least twice the symbols.
+    std::vector<NameSlot> names;
+    /// Indices in all of the code symbols, sorted by address.
+    std::vector<uint32_t> symbols;
+    /// Addresses of the code symbols, in the same order.
+    std::vector<vaddr_t> addresses;
+    /// Xensyms found while parsing, in file order.  Only kept for caching.
+    std::vector<XensymRecord> xensyms;
+    /// NUL terminated names of the xensyms.
+    std::vector<char> xensym_names;
 
-    /// Multimap const iterator
-    typedef std::multimap<const char *, Symbol *, bool(*)(const char*, const char*)>::const_iterator name_iter;
+private:
+    // @cond EXCLUDE
+    SymbolTable(const SymbolTable &);
+    SymbolTable & operator= (const SymbolTable &);
+    // @endcond
 };
 
 #endif
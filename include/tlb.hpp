@@ -0,0 +1,147 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __TLB_HPP__
+#define __TLB_HPP__
+
+/**
+ * @file include/tlb.hpp
+ * @author Andrew Cooper
+ */
+
+#include "types.hpp"
+#include "util/mutex.hpp"
+
+#include <cstddef>
+
+/**
+ * Software TLB.
+ *
+ * Caches successful translations of a single set of pagetables, so
+ * repeated accesses to the same page don't repeat the pagetable walk.
+ * There is a small direct-mapped array per page size (4K, 2M, 1G and
+ * 512G), indexed by virtual page number.  The core file is immutable, so
+ * entries never need invalidating.
+ *
+ * Not-present faults are cached in the same way, keyed by the level at
+ * which the walk failed, so repeatedly probing an unmapped region doesn't
+ * repeat the walk either.
+ *
+ * Hit and miss counts are totalled across all TLBs.
+ */
+class TLB
+{
+public:
+    /// Constructor.  The TLB starts empty.
+    TLB();
+
+    /**
+     * Look up a translation.
+     * @param vaddr Virtual address.
+     * @param maddr Machine address result.
+     * @param page_end If non-null, variable to be filled with the last
+     * virtual address of the page.
+     * @param page_shift If non-null, variable to be filled with log2 of the
+     * size of the page.
+     * @returns boolean indicating whether the translation was cached.
+     */
+    bool lookup(const vaddr_t & vaddr, maddr_t & maddr, vaddr_t * page_end,
+                unsigned * page_shift = NULL) const;
+
+    /**
+     * Insert a translation.
+     * @param vaddr Virtual address.
+     * @param maddr Machine address vaddr translates to.
+     * @param page_shift log2 of the size of the page containing vaddr.
+     * Must be 12, 21, 30 or 39.
+     */
+    void insert(const vaddr_t & vaddr, const maddr_t & maddr, unsigned page_shift);
+
+    /**
+     * Look up a cached not-present fault.
+     * @param vaddr Virtual address.
+     * @param level Variable to be filled with the pagetable level at which
+     * the walk failed.
+     * @returns boolean indicating whether vaddr is known not to be present.
+     */
+    bool lookup_fault(const vaddr_t & vaddr, int & level) const;
+
+    /**
+     * Insert a not-present fault.
+     * @param vaddr Virtual address which faulted.
+     * @param level Pagetable level at which the walk failed, 1 to 4.
+     */
+    void insert_fault(const vaddr_t & vaddr, int level);
+
+    /**
+     * Log hit and miss counts totalled across all TLBs.
+     */
+    static void log_statistics();
+
+protected:
+    /// Number of page sizes.
+    static const unsigned NR_SIZES = 4;
+    /// Number of entries: 128 for 4K pages, 32 for 2M, 8 for 1G and 2 for 512G.
+    static const size_t NR_ENTRIES = 128 + 32 + 8 + 2;
+
+    /// Cached translation.
+    struct Entry
+    {
+        /// Virtual page number, or ~0 if empty.
+        vaddr_t vpn;
+        /// Machine address of the page.
+        maddr_t base;
+    };
+
+    /// Entries, for each page size in turn.
+    Entry entries[NR_ENTRIES];
+    /**
+     * Virtual page numbers known not to be present, or ~0 if empty.  A
+     * fault at level n covers the page size of index n-1.
+     */
+    vaddr_t faults[NR_ENTRIES];
+    /// Lock protecting the entries.
+    mutable Mutex lock;
+
+    /// Total hits across all TLBs.
+    static uint64_t hits[NR_SIZES];
+    /// Total misses across all TLBs.
+    static uint64_t misses;
+    /// Total not-present faults served from the TLBs.
+    static uint64_t fault_hits;
+
+private:
+    // @cond EXCLUDE
+    TLB(const TLB &);
+    TLB & operator= (const TLB &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,95 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __MUTEX_HPP__
+#define __MUTEX_HPP__
+
+/**
+ * @file include/util/mutex.hpp
+ * @author Andrew Cooper
+ */
+
+#include <pthread.h>
+
+/**
+ * Mutex.
+ * Thin wrapper around a pthread mutex.
+ */
+class Mutex
+{
+public:
+    /// Constructor.
+    Mutex(): mutex() { pthread_mutex_init(&this->mutex, NULL); }
+    /// Destructor.
+    ~Mutex() { pthread_mutex_destroy(&this->mutex); }
+
+    /// Lock the mutex.
+    void lock() { pthread_mutex_lock(&this->mutex); }
+    /// Unlock the mutex.
+    void unlock() { pthread_mutex_unlock(&this->mutex); }
+
+protected:
+    /// Underlying pthread mutex.
+    pthread_mutex_t mutex;
+
+private:
+    // @cond EXCLUDE
+    Mutex(const Mutex &);
+    Mutex & operator= (const Mutex &);
+    // @endcond
+};
+
+/**
+ * Scoped lock.
+ * Holds a Mutex for the lifetime of the object.
+ */
+class ScopedLock
+{
+public:
+    /**
+     * Constructor.  Locks the mutex.
+     * @param mutex Mutex to hold.
+     */
+    ScopedLock(Mutex & mutex): mutex(mutex) { this->mutex.lock(); }
+    /// Destructor.  Unlocks the mutex.
+    ~ScopedLock() { this->mutex.unlock(); }
+
+protected:
+    /// Mutex being held.
+    Mutex & mutex;
+
+private:
+    // @cond EXCLUDE
+    ScopedLock(const ScopedLock &);
+    ScopedLock & operator= (const ScopedLock &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -30,8 +30,9 @@
 
 /**
  * Symbol structure.
- * Used to store a single symbol read from the static symbol map files
- * in /boot, or pulled from the kernel module symbol table in memory.
+ * A single symbol read from the static symbol map files in /boot.  Fixed
+ * size, so a whole table can be held in one array; the name is an offset
+ * into the owning SymbolTable's string arena.
  */
 class Symbol
 {
@@ -41,23 +42,9 @@ public:
      * Regular Constructor.
      * @param address Virtual address.
      * @param type What sort of symbol this is.
-     * @param name Symbol name.  For multiple symbols pointing to the
-     * same address, this may become a comma separated string of
-     * different symbol names
+     * @param name Offset of the symbol name in the string arena.
      */
-    Symbol(const vaddr_t address, const char type,  const char * name);
-
-    /**
-     * Copy Constructor.
-     * Implements deep copy.
-     * @param rhs Object to be copied from.
-     */
-    Symbol(const Symbol & rhs);
-
-    /**
-     * Destructor.
-     */
-    ~Symbol();
+    Symbol(const vaddr_t address, const char type, const uint32_t name);
 
     /**
      * Overloaded less-than operator.
@@ -70,20 +57,11 @@ public:
     /// Virtual address.
     vaddr_t address;
 
+    /// Offset of the name in the string arena.
+    uint32_t name;
+
     /// Type of symbol.
     char type;
-
-    /**
-     * Name(s) of symbol.
-     * May be a comma separated list of symbol names if they alias the
-     * same virtual address in a symbol table.
-     */
-    char * name;
-
-private:
-    // @cond EXCLUDE
-    Symbol & operator=(const Symbol &);
-    // @endcond
 };
 
 #endif
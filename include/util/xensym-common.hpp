@@ -93,8 +93,9 @@ typedef struct xensym
  * @param xensyms Null terminated list of xensym containers.
  * @param name Symbol or offset name.
  * @param value Value or address of symbol or offset.
+ * @returns boolean indicating whether name is in the list.
  */
-void insert_xensym(const xensym_t * xensyms, const char * name, vaddr_t & value);
+bool insert_xensym(const xensym_t * xensyms, const char * name, vaddr_t & value);
 
 /**
  * Check whether all group xensyms are present.
@@ -25,6 +25,7 @@
 
 #include "abstract/elf.hpp"
 #include "arch/x86_64/elf.hpp"
+#include "arch/x86_64/diskdump.hpp"
 
 #include "util/log.hpp"
 #include "util/macros.hpp"
@@ -34,6 +35,14 @@
 #include <errno.h>
 #include <elf.h>
 
+/// @cond EXCLUDE
+/// Signatures of the kdump-compressed and flattened makedumpfile formats.
+static const char KDUMP_SIGNATURE[] = "KDUMP   ";
+static const char DISKDUMP_SIGNATURE[] = "DISKDUMP";
+static const char MAKEDUMPFILE_SIGNATURE[] = "makedumpfile";
+static const size_t SIG_LEN = 8;
+/// @endcond
+
 namespace Abstract
 {
 
@@ -83,6 +92,21 @@ namespace Abstract
             goto error_close;
         }
 
+        if ( 0 == std::memcmp(KDUMP_SIGNATURE, ident, SIG_LEN) ||
+             0 == std::memcmp(DISKDUMP_SIGNATURE, ident, SIG_LEN) )
+        {
+            LOG_DEBUG("Found kdump-compressed crash file\n");
+            return new x86_64::DiskDump(fd);
+        }
+
+        if ( 0 == std::memcmp(MAKEDUMPFILE_SIGNATURE, ident,
+                               sizeof MAKEDUMPFILE_SIGNATURE - 1) )
+        {
+            LOG_ERROR("File is in flattened makedumpfile format.  "
+                      "Convert it with 'makedumpfile -R' first\n");
+            goto error_close;
+        }
+
         if ( 0 != std::strncmp(ELFMAG, ident, SELFMAG) )
         {
             LOG_ERROR("File is not an elf file\n");
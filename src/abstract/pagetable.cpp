@@ -0,0 +1,83 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/abstract/pagetable.cpp
+ * @author Andrew Cooper
+ */
+
+#include "abstract/pagetable.hpp"
+#include "exceptions.hpp"
+
+namespace Abstract
+{
+    bool PageTable::try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                             vaddr_t * page_end) const
+    {
+        try
+        {
+            this->walk(vaddr, maddr, page_end);
+            return true;
+        }
+        catch ( const CommonError & )
+        {
+            return false;
+        }
+    }
+
+    void PageTable::translate(const vaddr_t & vaddr, size_t n,
+                              std::vector<PhysExtent> & extents) const
+    {
+        vaddr_t addr = vaddr, end;
+        maddr_t maddr;
+
+        extents.clear();
+
+        while ( n )
+        {
+            this->walk(addr, maddr, &end);
+
+            // Careful of end - addr + 1 overflowing for the top page
+            size_t nr = (end - addr) < n ? (size_t)(end - addr + 1) : n;
+
+            if ( ! extents.empty() &&
+                 extents.back().maddr + extents.back().len == maddr )
+                extents.back().len += nr;
+            else
+            {
+                PhysExtent e = { addr, maddr, nr };
+                extents.push_back(e);
+            }
+
+            addr += nr;
+            n -= nr;
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
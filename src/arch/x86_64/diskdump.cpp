@@ -0,0 +1,186 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/arch/x86_64/diskdump.cpp
+ * @author Andrew Cooper
+ */
+
+#include "arch/x86_64/diskdump.hpp"
+
+#include "util/log.hpp"
+#include "types.hpp"
+
+#include <unistd.h>
+#include <errno.h>
+#include <new>
+
+/// @cond EXCLUDE
+/// Header at the start of a kdump-compressed file.  See makedumpfile.
+struct DiskDumpHeader
+{
+    char signature[8];
+    int32_t header_version;
+    char utsname[6][65];
+    int64_t timestamp_sec;
+    int64_t timestamp_usec;
+    uint32_t status;
+    int32_t block_size;
+    int32_t sub_hdr_size;
+    uint32_t bitmap_blocks;
+    uint32_t max_mapnr;
+    uint32_t total_ram_blocks;
+    uint32_t device_blocks;
+    uint32_t written_blocks;
+    uint32_t current_cpu;
+    int32_t nr_cpus;
+};
+
+/// Sub header, in the block following the header.
+struct KdumpSubHeader
+{
+    uint64_t phys_base;
+    int32_t dump_level;
+    int32_t split;
+    uint64_t start_pfn;
+    uint64_t end_pfn;
+    uint64_t offset_vmcoreinfo;
+    uint64_t size_vmcoreinfo;
+    uint64_t offset_note;
+    uint64_t size_note;
+    uint64_t offset_eraseinfo;
+    uint64_t size_eraseinfo;
+    uint64_t start_pfn_64;
+    uint64_t end_pfn_64;
+    uint64_t max_mapnr_64;
+};
+/// @endcond
+
+/// Dump is incomplete; some pages are missing from the end.
+#define DUMP_DH_COMPRESSED_INCOMPLETE 0x8
+
+namespace x86_64
+{
+
+    DiskDump::DiskDump(int fd):Elf(fd), layout()
+    {
+        std::memset(&this->layout, 0, sizeof this->layout);
+    }
+
+    DiskDump::~DiskDump(){}
+
+    bool DiskDump::parse()
+    {
+        DiskDumpHeader hdr;
+        KdumpSubHeader sub;
+        ssize_t r;
+
+        if ( (r = pread64(this->fd, &hdr, sizeof hdr, 0)) != sizeof hdr )
+        {
+            LOG_ERROR("  Failed to read kdump header: %s\n",
+                      r == -1 ? strerror(errno) : "Short read");
+            return false;
+        }
+
+        LOG_DEBUG("  kdump header version %"PRId32", block size %"PRId32", %"PRIu32
+                  " bitmap blocks, crashing cpu %"PRIu32"\n", hdr.header_version,
+                  hdr.block_size, hdr.bitmap_blocks, hdr.current_cpu);
+
+        if ( hdr.header_version < 4 )
+        {
+            LOG_ERROR("  kdump header version %"PRId32" has no notes.  Need version 4 or later\n",
+                      hdr.header_version);
+            return false;
+        }
+
+        if ( hdr.block_size <= 0 || hdr.sub_hdr_size <= 0 )
+        {
+            LOG_ERROR("  Bad kdump block size %"PRId32" or sub header size %"PRId32"\n",
+                      hdr.block_size, hdr.sub_hdr_size);
+            return false;
+        }
+
+        const uint64_t bs = hdr.block_size;
+
+        if ( (r = pread64(this->fd, &sub, sizeof sub, bs)) != sizeof sub )
+        {
+            LOG_ERROR("  Failed to read kdump sub header: %s\n",
+                      r == -1 ? strerror(errno) : "Short read");
+            return false;
+        }
+
+        if ( sub.split )
+        {
+            LOG_ERROR("  Split kdump files are not supported\n");
+            return false;
+        }
+
+        if ( hdr.status & DUMP_DH_COMPRESSED_INCOMPLETE )
+            LOG_WARN("  kdump file is incomplete.  Some frames will be missing\n");
+
+        this->layout.block_size = bs;
+        this->layout.max_mapnr = hdr.header_version >= 6 ?
+            sub.max_mapnr_64 : hdr.max_mapnr;
+        this->layout.bitmap_size = (uint64_t)(hdr.bitmap_blocks / 2) * bs;
+        this->layout.bitmap_offset = (1 + hdr.sub_hdr_size) * bs +
+            this->layout.bitmap_size;
+        this->layout.pd_offset = (1 + hdr.sub_hdr_size + (uint64_t)hdr.bitmap_blocks) * bs;
+
+        LOG_DEBUG("  kdump max_mapnr %#"PRIx64", bitmap at %#"PRIx64", descriptors at %#"
+                  PRIx64"\n", this->layout.max_mapnr, this->layout.bitmap_offset,
+                  this->layout.pd_offset);
+
+        if ( ! sub.size_note )
+        {
+            LOG_ERROR("  kdump file has no notes\n");
+            return false;
+        }
+
+        // Describe the notes with a program header, to reuse the elf note parsing
+        this->nr_phdrs = 1;
+        try
+        {
+            this->phdrs = new ElfProgHdr[this->nr_phdrs];
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad Alloc exception.  Out of memory\n");
+            return false;
+        }
+
+        this->phdrs[0].type = PT_NOTE;
+        this->phdrs[0].offset = sub.offset_note;
+        this->phdrs[0].phys = 0;
+        this->phdrs[0].size = sub.size_note;
+
+        return this->parse_nhdrs(this->phdrs[0]);
+    }
+
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -22,6 +22,7 @@
 #include "arch/x86_64/vcpu.hpp"
 #include "arch/x86_64/xensyms.hpp"
 #include "abstract/xensyms.hpp"
+#include "Xen.h"
 #include "memory.hpp"
 #include "host.hpp"
 #include "util/print-structures.hpp"
@@ -31,6 +32,8 @@
 #include "util/symbol.hpp"
 #include "util/stdio-wrapper.hpp"
 
+#include <vector>
+
 /**
  * @file src/arch/x86_64/domain.cpp
  * @author Andrew Cooper
@@ -43,7 +46,7 @@ namespace x86_64
 {
 
     Domain::Domain(const Abstract::PageTable & xenpt)
-        : Abstract::Domain(xenpt)
+        : Abstract::Domain(xenpt), p2m()
     {
         memset(this->handle, 0, sizeof this->handle);
     }
@@ -71,26 +74,29 @@ namespace x86_64
             host.validate_xen_vaddr(domain_ptr);
             this->domain_ptr = domain_ptr;
 
-            memory.read16_vaddr(this->xenpt, this->domain_ptr + DOMAIN_id, this->domain_id);
+            ReadBatch batch;
+
+            batch.add(this->domain_ptr + DOMAIN_id, this->domain_id);
+
+            batch.add(this->domain_ptr + DOMAIN_is_32bit_pv, this->is_32bit_pv);
+            batch.add(this->domain_ptr + DOMAIN_is_hvm, this->is_hvm);
+            batch.add(this->domain_ptr + DOMAIN_is_privileged, this->is_privileged);
 
-            memory.read8_vaddr (this->xenpt, this->domain_ptr + DOMAIN_is_32bit_pv, this->is_32bit_pv);
-            memory.read8_vaddr (this->xenpt, this->domain_ptr + DOMAIN_is_hvm, this->is_hvm);
-            memory.read8_vaddr (this->xenpt, this->domain_ptr + DOMAIN_is_privileged, this->is_privileged);
+            batch.add(this->domain_ptr + DOMAIN_max_vcpus, this->max_cpus);
+            batch.add(this->domain_ptr + DOMAIN_vcpus, this->vcpus_ptr);
 
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_max_vcpus, this->max_cpus);
-            memory.read64_vaddr(this->xenpt, this->domain_ptr + DOMAIN_vcpus, this->vcpus_ptr);
+            batch.add(this->domain_ptr + DOMAIN_paging_mode, this->paging_mode);
+            batch.add(this->domain_ptr + DOMAIN_tot_pages, this->tot_pages);
+            batch.add(this->domain_ptr + DOMAIN_max_pages, this->max_pages);
+            batch.add(this->domain_ptr + DOMAIN_shr_pages, this->shr_pages);
 
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_paging_mode, this->paging_mode);
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_tot_pages, this->tot_pages);
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_max_pages, this->max_pages);
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_shr_pages, (uint32_t&)this->shr_pages);
+            batch.add(this->domain_ptr + DOMAIN_pause_count, this->pause_count);
 
-            memory.read32_vaddr(this->xenpt, this->domain_ptr + DOMAIN_pause_count, this->pause_count);
+            batch.add(this->domain_ptr + DOMAIN_handle, this->handle);
 
-            memory.read_block_vaddr(this->xenpt, this->domain_ptr + DOMAIN_handle,
-                                    (char*)this->handle, sizeof this->handle);
+            batch.add(this->domain_ptr + DOMAIN_next, this->next_domain_ptr);
 
-            memory.read64_vaddr(this->xenpt, this->domain_ptr + DOMAIN_next, this->next_domain_ptr);
+            memory.read_batch_vaddr(this->xenpt, batch);
 
             return true;
         }
@@ -120,17 +126,57 @@ namespace x86_64
             LOG_INFO("    %"PRIu32" VCPUs\n", this->max_cpus);
             bool vcpus_online = false;
 
+            std::vector<vaddr_t> vcpu_addrs(this->max_cpus);
+            std::vector<VCPU*> vcpus(this->max_cpus);
+
+            memory.read_block_vaddr(this->xenpt, this->vcpus_ptr, (char*)&vcpu_addrs[0],
+                                    this->max_cpus * sizeof (vaddr_t));
+
             for ( uint32_t x = 0; x < this->max_cpus; ++x )
             {
-                vaddr_t vcpu_addr;
-                this->vcpus[x] = new VCPU(Abstract::VCPU::RST_UNKNOWN);
-                memory.read64_vaddr(this->xenpt, this->vcpus_ptr + x * 8, vcpu_addr);
-                host.validate_xen_vaddr(vcpu_addr);
-                LOG_DEBUG("    Vcpu%"PRIu32" pointer = 0x%016"PRIx64"\n", x, vcpu_addr);
-                if ( this->vcpus[x]->parse_basic(vcpu_addr, this->xenpt) )
-                    vcpus_online = true;
+                this->vcpus[x] = vcpus[x] = new VCPU(Abstract::VCPU::RST_UNKNOWN);
+                host.validate_xen_vaddr(vcpu_addrs[x]);
+                LOG_DEBUG("    Vcpu%"PRIu32" pointer = 0x%016"PRIx64"\n", x, vcpu_addrs[x]);
+
+                // The full vcpu structures are needed later to print state
+                memory.prefetch_vaddr(this->xenpt, vcpu_addrs[x],
+                                      VCPU_sizeof ? VCPU_sizeof : PAGE_SIZE);
+            }
+
+            /* Parse all vcpus with shared batches, so their reads can be in
+             * flight together.  If anything goes wrong, fall back to parsing
+             * them individually so one bad vcpu doesn't lose the others. */
+            if ( HAVE_CORE_XENSYMS(domain) && HAVE_CORE_XENSYMS(vcpu) &&
+                 HAVE_x86_64_XENSYMS(x86_64_domain) && HAVE_x86_64_XENSYMS(x86_64_vcpu) )
+            {
+                try
+                {
+                    ReadBatch batch;
+
+                    for ( uint32_t x = 0; x < this->max_cpus; ++x )
+                        vcpus[x]->queue_basic(vcpu_addrs[x], batch);
+                    memory.read_batch_vaddr(this->xenpt, batch);
+
+                    batch.requests.clear();
+                    for ( uint32_t x = 0; x < this->max_cpus; ++x )
+                        vcpus[x]->queue_basic_domain(batch);
+                    memory.read_batch_vaddr(this->xenpt, batch);
+
+                    for ( uint32_t x = 0; x < this->max_cpus; ++x )
+                        vcpus[x]->finish_basic();
+
+                    return true;
+                }
+                catch ( const CommonError & )
+                {
+                    LOG_DEBUG("    Batched vcpu parsing failed.  Parsing individually\n");
+                }
             }
 
+            for ( uint32_t x = 0; x < this->max_cpus; ++x )
+                if ( vcpus[x]->parse_basic(vcpu_addrs[x], this->xenpt) )
+                    vcpus_online = true;
+
             // If at least 1 vcpu is online, consider this successful
             return vcpus_online;
         }
@@ -146,6 +192,20 @@ namespace x86_64
         return false;
     }
 
+    bool Domain::parse_p2m()
+    {
+        if ( this->is_hvm )
+            return false;
+
+        if ( this->is_32bit_pv )
+        {
+            LOG_DEBUG("    Not loading the P2M of a 32bit PV domain\n");
+            return false;
+        }
+
+        return this->p2m.load_p2m(this->xenpt, this->domain_ptr);
+    }
+
     bool Domain::read_vmcoreinfo(CoreInfo & dest) const
     {
         if ( this->domain_id != 0 )
@@ -247,6 +307,24 @@ namespace x86_64
         len += FPRINTF(o, "  Current Pages: %"PRIu32"\n", this->tot_pages);
         len += FPRINTF(o, "  Shared Pages: %"PRId32"\n", this->shr_pages);
 
+        if ( this->p2m.size() )
+        {
+            uint64_t mfn, pfn, mismatched = 0;
+
+            // Cross check the P2M against Xen's M2P
+            if ( host.m2p.size() )
+                for ( uint64_t x = 0; x < this->p2m.size(); ++x )
+                    if ( this->p2m.lookup(x, mfn) &&
+                         ( ! host.m2p.lookup(mfn, pfn) || pfn != x ) )
+                        ++mismatched;
+
+            len += FPRINTF(o, "  P2M: %"PRIu64" pfns, %"PRIu64" populated", this->p2m.size(),
+                           this->p2m.nr_valid());
+            if ( host.m2p.size() )
+                len += FPRINTF(o, ", %"PRIu64" inconsistent with the M2P", mismatched);
+            len += FPUTS("\n", o);
+        }
+
         len += FPRINTF(o, "  Handle: %02"PRIx8"%02"PRIx8"%02"PRIx8"%02"PRIx8"-%02"PRIx8
                        "%02"PRIx8"-%02"PRIx8"%02"PRIx8"-""%02"PRIx8"%02"PRIx8"-%02"PRIx8
                        "%02"PRIx8"%02"PRIx8"%02"PRIx8"%02"PRIx8"%02"PRIx8"\n",
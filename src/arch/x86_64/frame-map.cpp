@@ -0,0 +1,330 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/arch/x86_64/frame-map.cpp
+ * @author Andrew Cooper
+ */
+
+#include "arch/x86_64/frame-map.hpp"
+#include "arch/x86_64/xensyms.hpp"
+
+#include "Xen.h"
+#include "memory.hpp"
+#include "host.hpp"
+#include "util/log.hpp"
+#include "util/macros.hpp"
+
+#include <new>
+#include <algorithm>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace x86_64::xensyms;
+
+/// Xen's read/write mapping of the M2P, fixed in its x86_64 memory layout.
+static const vaddr_t RDWR_MPT_VIRT_START = 0xffff828000000000ULL;
+/// Maximum size of the read/write M2P mapping.
+static const uint64_t RDWR_MPT_VIRT_SIZE = 256ULL << 30;
+
+/// Number of 64bit entries in a frame.
+static const size_t ENTRIES_PER_FRAME = PAGE_SIZE / sizeof (uint64_t);
+/// Number of frames read in one go while loading.
+static const size_t LOAD_FRAMES = 512;
+
+namespace x86_64
+{
+
+    bool FrameMap::enabled = false;
+    size_t FrameMap::total_cost = 0;
+    size_t FrameMap::peak_cost = 0;
+
+    FrameMap::FrameMap(): table(NULL), nr_frames(0), valid(0) {}
+
+    FrameMap::~FrameMap()
+    {
+        this->release();
+    }
+
+    void FrameMap::release()
+    {
+        FrameMap::total_cost -= this->memory_cost();
+        SAFE_DELETE_ARRAY(this->table);
+        this->nr_frames = this->valid = 0;
+    }
+
+    bool FrameMap::allocate(uint64_t nr_frames)
+    {
+        this->release();
+
+        /* The kdump kernel usually has little memory, and allocating too much
+         * gets the whole analysis OOM killed, so leave plenty spare. */
+        long avail_pages = sysconf(_SC_AVPHYS_PAGES), page_size = sysconf(_SC_PAGESIZE);
+        uint64_t cost = nr_frames * sizeof *this->table;
+
+        if ( avail_pages > 0 && page_size > 0 &&
+             cost > ((uint64_t)avail_pages * page_size) / 2 )
+        {
+            LOG_WARN("    Skipping %"PRIu64" kB frame map.  Only %"PRIu64" kB of memory available\n",
+                     cost >> 10, ((uint64_t)avail_pages * page_size) >> 10);
+            return false;
+        }
+
+        try
+        {
+            this->table = new uint32_t[nr_frames];
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("    Bad Alloc exception.  Out of memory for %"PRIu64" kB frame map\n",
+                      (nr_frames * sizeof *this->table) >> 10);
+            return false;
+        }
+
+        std::fill(this->table, this->table + nr_frames, INVALID);
+        this->nr_frames = nr_frames;
+        FrameMap::total_cost += this->memory_cost();
+        FrameMap::peak_cost = std::max(FrameMap::peak_cost, FrameMap::total_cost);
+        return true;
+    }
+
+    void FrameMap::log_statistics()
+    {
+        if ( FrameMap::enabled )
+            LOG_INFO("Frame maps: peak memory use %zu kB\n", FrameMap::peak_cost >> 10);
+    }
+
+    void FrameMap::store(uint64_t first, const uint64_t * src, size_t n)
+    {
+        for ( size_t x = 0; x < n; ++x )
+            if ( src[x] < INVALID )
+            {
+                this->table[first + x] = (uint32_t)src[x];
+                ++this->valid;
+            }
+    }
+
+    bool FrameMap::load_m2p(const Abstract::PageTable & xenpt)
+    {
+        if ( ! REQ_x86_64_XENSYMS(x86_64_m2p) )
+            return false;
+
+        uint64_t * buf = NULL;
+
+        try
+        {
+            uint64_t max_frame;
+
+            host.validate_xen_vaddr(max_page);
+            memory.read64_vaddr(xenpt, max_page, max_frame);
+
+            if ( max_frame > RDWR_MPT_VIRT_SIZE / sizeof (uint64_t) )
+            {
+                LOG_ERROR("  max_page 0x%"PRIx64" is too large for the M2P\n", max_frame);
+                return false;
+            }
+
+            if ( ! this->allocate(max_frame) )
+                return false;
+
+            buf = new uint64_t[LOAD_FRAMES * ENTRIES_PER_FRAME];
+
+            const size_t chunk = LOAD_FRAMES * ENTRIES_PER_FRAME;
+            uint64_t holes = 0;
+
+            /* The M2P is virtually contiguous but sparse, with holes for holes
+             * in the machine address space.  Read it in large chunks, falling
+             * back to individual frames around the holes. */
+            for ( uint64_t x = 0; x < max_frame; x += chunk )
+            {
+                const size_t n = std::min((uint64_t)chunk, max_frame - x);
+                const vaddr_t vaddr = RDWR_MPT_VIRT_START + x * sizeof *buf;
+
+                if ( memory.try_read_block_vaddr(xenpt, vaddr, (char*)buf, n * sizeof *buf) )
+                {
+                    this->store(x, buf, n);
+                    continue;
+                }
+
+                for ( size_t y = 0; y < n; y += ENTRIES_PER_FRAME )
+                {
+                    const size_t m = std::min(ENTRIES_PER_FRAME, n - y);
+
+                    if ( memory.try_read_block_vaddr(xenpt, vaddr + y * sizeof *buf,
+                                                     (char*)buf, m * sizeof *buf) )
+                        this->store(x + y, buf, m);
+                    else
+                        ++holes;
+                }
+            }
+
+            SAFE_DELETE_ARRAY(buf);
+
+            LOG_INFO("  Loaded M2P: %"PRIu64" frames, %"PRIu64" in use, %zu kB\n",
+                     this->nr_frames, this->valid, this->memory_cost() >> 10);
+            if ( holes )
+                LOG_DEBUG("  %"PRIu64" frames of the M2P are not mapped\n", holes);
+            return true;
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("  Bad Alloc exception.  Out of memory loading the M2P\n");
+        }
+        catch ( const CommonError & e )
+        {
+            e.log();
+        }
+
+        SAFE_DELETE_ARRAY(buf);
+        this->release();
+        return false;
+    }
+
+    bool FrameMap::load_p2m(const Abstract::PageTable & xenpt, const vaddr_t & domain_ptr)
+    {
+        if ( ! HAVE_x86_64_XENSYMS(x86_64_pv_p2m) )
+        {
+            LOG_DEBUG("    Missing xensyms for the PV P2M.  Not loading it\n");
+            return false;
+        }
+
+        uint64_t * buf = NULL;
+
+        try
+        {
+            vaddr_t shared_info;
+            uint64_t max_pfn, fll_mfn;
+            ReadBatch batch;
+
+            memory.read64_vaddr(xenpt, domain_ptr + DOMAIN_shared_info, shared_info);
+            host.validate_xen_vaddr(shared_info);
+
+            batch.add(shared_info + SHARED_max_pfn, max_pfn);
+            batch.add(shared_info + SHARED_frame_list_list, fll_mfn);
+            memory.read_batch_vaddr(xenpt, batch);
+
+            if ( ! max_pfn )
+            {
+                LOG_DEBUG("    Domain has not published its P2M\n");
+                return false;
+            }
+
+            // Frame list list -> frame lists -> P2M frames, 512 entries each
+            const uint64_t nr_p2m = (max_pfn + ENTRIES_PER_FRAME - 1) / ENTRIES_PER_FRAME;
+            const uint64_t nr_fl = (nr_p2m + ENTRIES_PER_FRAME - 1) / ENTRIES_PER_FRAME;
+
+            if ( nr_fl > ENTRIES_PER_FRAME || max_pfn > INVALID )
+            {
+                LOG_ERROR("    Bad P2M max_pfn 0x%"PRIx64"\n", max_pfn);
+                return false;
+            }
+
+            if ( ! this->allocate(max_pfn) )
+                return false;
+
+            buf = new uint64_t[LOAD_FRAMES * ENTRIES_PER_FRAME];
+
+            uint64_t fll[ENTRIES_PER_FRAME];
+            memory.read_block(fll_mfn << 12, (char*)fll, sizeof fll);
+
+            // Gather the mfns of every P2M frame
+            std::vector<uint64_t> p2m_mfns(nr_fl * ENTRIES_PER_FRAME);
+
+            batch.requests.clear();
+            for ( uint64_t x = 0; x < nr_fl; ++x )
+                batch.add(fll[x] << 12, &p2m_mfns[x * ENTRIES_PER_FRAME], PAGE_SIZE);
+            memory.read_batch(batch);
+
+            uint64_t missing = 0;
+
+            /* Read the P2M frames in batches, straight into the staging
+             * buffer.  Frames written by a domain are rarely contiguous in
+             * machine memory, but the batch sorts and coalesces those which
+             * are.  If a batch fails, retry its frames individually so one
+             * missing frame doesn't lose its neighbours. */
+            for ( uint64_t x = 0; x < nr_p2m; x += LOAD_FRAMES )
+            {
+                const size_t n = std::min((uint64_t)LOAD_FRAMES, nr_p2m - x);
+                const uint64_t first = x * ENTRIES_PER_FRAME;
+                const size_t entries = std::min((uint64_t)n * ENTRIES_PER_FRAME,
+                                                max_pfn - first);
+
+                batch.requests.clear();
+                for ( size_t y = 0; y < n; ++y )
+                    batch.add(p2m_mfns[x + y] << 12,
+                              &buf[y * ENTRIES_PER_FRAME], PAGE_SIZE);
+
+                try
+                {
+                    memory.read_batch(batch);
+                    this->store(first, buf, entries);
+                    continue;
+                }
+                catch ( const CommonError & )
+                {}
+
+                for ( size_t y = 0; y < n; ++y )
+                {
+                    const size_t m = std::min((uint64_t)ENTRIES_PER_FRAME,
+                                              max_pfn - first - y * ENTRIES_PER_FRAME);
+
+                    if ( memory.try_read_block(p2m_mfns[x + y] << 12,
+                                               (char*)buf, PAGE_SIZE) )
+                        this->store(first + y * ENTRIES_PER_FRAME, buf, m);
+                    else
+                        ++missing;
+                }
+            }
+
+            SAFE_DELETE_ARRAY(buf);
+
+            LOG_INFO("    Loaded P2M: %"PRIu64" pfns, %"PRIu64" populated, %zu kB\n",
+                     this->nr_frames, this->valid, this->memory_cost() >> 10);
+            if ( missing )
+                LOG_WARN("    %"PRIu64" frames of the P2M are missing from the core\n",
+                         missing);
+            return true;
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("    Bad Alloc exception.  Out of memory loading the P2M\n");
+        }
+        catch ( const CommonError & e )
+        {
+            e.log();
+        }
+
+        SAFE_DELETE_ARRAY(buf);
+        this->release();
+        return false;
+    }
+
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
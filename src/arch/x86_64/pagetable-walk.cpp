@@ -27,11 +27,18 @@
 
 #include "util/log.hpp"
 #include "memory.hpp"
+#include "pte-cache.hpp"
 
 /// Is the present bit set for a pagetable entry
 #define present(v)     ((v) & 1)
 /// Is the page size bit set for a pagetable entry
 #define page_size(v)   ((v) & (1<<7))
+/// Is the writable bit set for a pagetable entry
+#define read_write(v)  ((v) & (1<<1))
+/// Is the user bit set for a pagetable entry
+#define user_super(v)  ((v) & (1<<2))
+/// Is the no-execute bit set for a pagetable entry
+#define no_exec(v)     ((v) & (1ULL<<63))
 
 /// Calculate entry offset into the PM4L based on a virtual address
 #define pm4l_offset(v) (((v >> 39) & ((1<<9)-1)) * 8)
@@ -60,12 +67,78 @@
 /// Round an address up to the last byte in a 512G superpage
 #define roundup_512G(v) ((v) | ((1ULL<<39)-1))
 
-void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
-                       maddr_t & maddr, vaddr_t * page_end)
+/// Bits of cr3 and of pagetable entries holding the next physical address
+static const uint64_t addr_mask = 0x000FFFFFFFFFF000ULL;
+
+/**
+ * Record a failed walk.
+ * @param fault Fault to fill.
+ * @param level Pagetable level of the fault, or 0 if an entry was unreadable.
+ * @param reason Reason for the fault.
+ * @param entry Machine address of the unreadable entry.
+ * @returns false, for the walk to return.
+ */
+static bool walk_fault(WalkFault64 & fault, int level,
+                       pagefault::pagefault_reason reason, maddr_t entry = 0)
+{
+    fault.level = level;
+    fault.reason = reason;
+    fault.entry = entry;
+    return false;
+}
+
+/**
+ * Record a pagetable entry which couldn't be read.  The reason has already
+ * been filled in to fault.read by read_entry().
+ * @param fault Fault to fill.
+ * @param entry Machine address of the unreadable entry.
+ * @returns false, for the walk to return.
+ */
+static bool entry_fault(WalkFault64 & fault, maddr_t entry)
+{
+    return walk_fault(fault, 0, pagefault::FAULT_INVALID, entry);
+}
+
+/**
+ * Read a pagetable entry.
+ * @param reader Source of entries, or NULL for machine memory.
+ * @param entry Address of the entry.
+ * @param value Entry value result.
+ * @param cache Whether to read machine memory through the PTE cache.
+ * @param fault Filled with the details of a failure.
+ * @returns boolean indicating success or failure.
+ */
+static inline bool read_entry(const PTEReader * reader, const maddr_t & entry,
+                              uint64_t & value, bool cache, ReadFault & fault)
 {
-    // cr3 has the pml4 physical address between bits 51 and 12
-    // each page entry contain the next physical address between the same bits
-    static const uint64_t addr_mask = 0x000FFFFFFFFFF000ULL;
+    if ( reader )
+        return reader->read(entry, value, fault);
+    if ( cache )
+        return pte_cache.read(entry, value, &fault);
+    return memory.try_read64(entry, value, &fault);
+}
+
+/**
+ * Four level pagetable walk, common to 64bit pagetables and EPT.
+ * @param cr3 Address of the top level pagetable.
+ * @param vaddr Address to look up.
+ * @param maddr Result of the walk.
+ * @param page_end If non-null, last address of the page.
+ * @param page_shift If non-null, log2 of the page size.
+ * @param fault Details of a failure.
+ * @param reader Source of entries, or NULL for machine memory.
+ * @param ept Whether the pagetables are in EPT format.
+ * @returns boolean indicating whether vaddr is mapped.
+ */
+static bool walk_4level(const maddr_t & cr3, const vaddr_t & vaddr,
+                        maddr_t & maddr, vaddr_t * page_end,
+                        unsigned * page_shift, WalkFault64 & fault,
+                        const PTEReader * reader, bool ept)
+{
+    // EPT entries are present if any of read, write or execute are allowed
+    const uint64_t present_mask = ept ? 7 : 1;
+
+    maddr_t entry;
 
     maddr_t pml4_entry;
 
@@ -85,32 +158,37 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
      * parse a {P,V}CPU correctly.
      */
     if ( ! cr3 )
-        throw pagefault(vaddr, cr3, 5, pagefault::FAULT_INVALID);
+        return walk_fault(fault, 5, pagefault::FAULT_INVALID);
 
-    memory.read64((cr3 & addr_mask) + pm4l_offset(vaddr),
-                  pml4_entry);
+    // Upper levels are shared between address spaces, so are worth caching
+    entry = (cr3 & addr_mask) + pm4l_offset(vaddr);
+    if ( ! read_entry(reader, entry, pml4_entry, true, fault.read) )
+        return entry_fault(fault, entry);
 
     // PDPT present?
-    if ( ! present(pml4_entry) )
-        throw pagefault(vaddr, cr3, 4, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pml4_entry & present_mask) )
+        return walk_fault(fault, 4, pagefault::FAULT_NOTPRESENT);
 
     pdpt_base = pml4_entry & addr_mask;
 
-    // Page Size bit set? (512G superpage)
-    if ( page_size(pml4_entry) )
+    // Page Size bit set? (512G superpage.  Ignored by EPT)
+    if ( ! ept && page_size(pml4_entry) )
     {
         maddr = offset_512G(pdpt_base, vaddr);
         if ( page_end )
             *page_end = roundup_512G(vaddr);
-        return;
+        if ( page_shift )
+            *page_shift = 39;
+        return true;
     }
 
-    memory.read64(pdpt_base + pdpt_offset(vaddr),
-                  pdpt_entry);
+    entry = pdpt_base + pdpt_offset(vaddr);
+    if ( ! read_entry(reader, entry, pdpt_entry, true, fault.read) )
+        return entry_fault(fault, entry);
 
     // PD present?
-    if ( ! present(pdpt_entry) )
-        throw pagefault(vaddr, cr3, 3, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pdpt_entry & present_mask) )
+        return walk_fault(fault, 3, pagefault::FAULT_NOTPRESENT);
 
     pd_base = pdpt_entry & addr_mask;
 
@@ -120,15 +198,18 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
         maddr = offset_1G(pd_base, vaddr);
         if ( page_end )
             *page_end = roundup_1G(vaddr);
-        return;
+        if ( page_shift )
+            *page_shift = 30;
+        return true;
     }
 
-    memory.read64(pd_base + pd_offset(vaddr),
-                  pd_entry);
+    entry = pd_base + pd_offset(vaddr);
+    if ( ! read_entry(reader, entry, pd_entry, true, fault.read) )
+        return entry_fault(fault, entry);
 
     // PT present?
-    if ( ! present(pd_entry) )
-        throw pagefault(vaddr, cr3, 2, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pd_entry & present_mask) )
+        return walk_fault(fault, 2, pagefault::FAULT_NOTPRESENT);
 
     pt_base = pd_entry & addr_mask;
 
@@ -138,20 +219,162 @@ void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
         maddr = offset_2M(pt_base, vaddr);
         if ( page_end )
             *page_end = roundup_2M(vaddr);
-        return;
+        if ( page_shift )
+            *page_shift = 21;
+        return true;
     }
 
-    memory.read64(pt_base + pt_offset(vaddr),
-                  pt_entry);
+    entry = pt_base + pt_offset(vaddr);
+    if ( ! read_entry(reader, entry, pt_entry, false, fault.read) )
+        return entry_fault(fault, entry);
 
     // Page present?
-    if ( ! present(pt_entry) )
-        throw pagefault(vaddr, cr3, 1, pagefault::FAULT_NOTPRESENT);
+    if ( ! (pt_entry & present_mask) )
+        return walk_fault(fault, 1, pagefault::FAULT_NOTPRESENT);
 
     page = pt_entry & addr_mask;
     maddr = offset_4K(page, vaddr);
     if ( page_end )
         *page_end = roundup_4K(vaddr);
+    if ( page_shift )
+        *page_shift = 12;
+    return true;
+}
+
+bool try_pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
+                           maddr_t & maddr, vaddr_t * page_end,
+                           unsigned * page_shift, WalkFault64 & fault,
+                           const PTEReader * reader)
+{
+    return walk_4level(cr3, vaddr, maddr, page_end, page_shift, fault,
+                       reader, false);
+}
+
+bool try_ept_walk(const maddr_t & root, const maddr_t & gpaddr,
+                  maddr_t & maddr, vaddr_t * page_end,
+                  unsigned * page_shift, WalkFault64 & fault)
+{
+    return walk_4level(root, gpaddr, maddr, page_end, page_shift, fault,
+                       NULL, true);
+}
+
+void throw_walk_fault(const maddr_t & cr3, const vaddr_t & vaddr,
+                      const WalkFault64 & fault)
+{
+    if ( fault.level )
+        throw pagefault(vaddr, cr3, fault.level, fault.reason);
+
+    if ( fault.read.seek )
+        throw memseek(fault.entry, 0);
+    throw memread(fault.entry, fault.read.count, sizeof (uint64_t), fault.read.error);
+}
+
+void pagetable_walk_64(const maddr_t & cr3, const vaddr_t & vaddr,
+                       maddr_t & maddr, vaddr_t * page_end, unsigned * page_shift)
+{
+    WalkFault64 fault;
+
+    if ( ! try_pagetable_walk_64(cr3, vaddr, maddr, page_end, page_shift, fault) )
+        throw_walk_fault(cr3, vaddr, fault);
+}
+
+AddressSpace64::AddressSpace64(const maddr_t & cr3, const vaddr_t & start,
+                               const vaddr_t & end):
+    start(start), end(end), level(LEVELS), tables(), index(), base(),
+    writable(), user(), nx(), bad_tables(0)
+{
+    if ( cr3 && start <= end && this->load(LEVELS - 1, cr3 & addr_mask) )
+    {
+        this->level = LEVELS - 1;
+        this->index[this->level] = 0;
+        this->base[this->level] = 0;
+        this->writable[this->level] = true;
+        this->user[this->level] = true;
+        this->nx[this->level] = false;
+    }
+}
+
+bool AddressSpace64::load(unsigned level, const maddr_t & table)
+{
+    if ( memory.try_read_block(table, (char*)this->tables[level],
+                               sizeof this->tables[level]) )
+        return true;
+
+    LOG_DEBUG("Skipping unreadable L%u pagetable at 0x%016"PRIx64"\n",
+              level + 1, table);
+    ++this->bad_tables;
+    return false;
+}
+
+bool AddressSpace64::next(Mapping64 & mapping)
+{
+    while ( this->level < LEVELS )
+    {
+        const unsigned lvl = this->level;
+
+        // Finished this table?  Move on to the next entry of its parent.
+        if ( this->index[lvl] == ENTRIES )
+        {
+            if ( ++this->level < LEVELS )
+                ++this->index[this->level];
+            continue;
+        }
+
+        const unsigned shift = 12 + 9 * lvl;
+        vaddr_t vaddr = this->base[lvl] | ((vaddr_t)this->index[lvl] << shift);
+
+        // Sign extend to a canonical address
+        if ( vaddr & (1ULL << 47) )
+            vaddr |= 0xffff000000000000ULL;
+
+        if ( vaddr > this->end )
+        {
+            this->level = LEVELS;
+            break;
+        }
+
+        const uint64_t entry = this->tables[lvl][this->index[lvl]];
+        const vaddr_t last = vaddr + ((1ULL << shift) - 1);
+
+        if ( ! present(entry) || last < this->start )
+        {
+            ++this->index[lvl];
+            continue;
+        }
+
+        const bool w = this->writable[lvl] && read_write(entry);
+        const bool u = this->user[lvl] && user_super(entry);
+        const bool x = this->nx[lvl] || no_exec(entry);
+
+        if ( lvl == 0 || page_size(entry) )
+        {
+            mapping.vaddr = vaddr;
+            // Superpages have the PAT bit in the low address bits
+            mapping.maddr = entry & addr_mask & ~((1ULL << shift) - 1);
+            mapping.page_shift = shift;
+            mapping.writable = w;
+            mapping.user = u;
+            mapping.nx = x;
+
+            ++this->index[lvl];
+            return true;
+        }
+
+        if ( ! this->load(lvl - 1, entry & addr_mask) )
+        {
+            ++this->index[lvl];
+            continue;
+        }
+
+        this->level = lvl - 1;
+        this->index[lvl - 1] = 0;
+        this->base[lvl - 1] = vaddr;
+        this->writable[lvl - 1] = w;
+        this->user[lvl - 1] = u;
+        this->nx[lvl - 1] = x;
+    }
+
+    return false;
 }
 
 /*
@@ -26,11 +26,111 @@
 #include "arch/x86_64/pagetable.hpp"
 #include "arch/x86_64/pagetable-walk.hpp"
 
+#include "arch/x86_64/xensyms.hpp"
+#include "abstract/xensyms.hpp"
 #include "exceptions.hpp"
+#include "memory.hpp"
+#include "pte-cache.hpp"
+#include "util/log.hpp"
+
+#include <algorithm>
+
+/**
+ * Is a virtual address canonical?
+ * @param vaddr Virtual address.
+ * @returns boolean.
+ */
+static inline bool is_canonical(const vaddr_t & vaddr)
+{
+    return vaddr <= 0x00007fffffffffffULL || vaddr >= 0xffff800000000000ULL;
+}
+
+/**
+ * Walk pagetables through a TLB, without throwing.
+ * @param tlb TLB of the pagetables.
+ * @param cr3 Control Register 3.
+ * @param vaddr Virtual address to look up.
+ * @param maddr Machine address variable for the result.
+ * @param page_end If non-null, variable to be filled with the last virtual
+ * address of the page.
+ * @param fault Variable to be filled with the details of a failure.
+ * @returns boolean indicating whether vaddr is mapped.
+ */
+static bool cached_walk(TLB & tlb, const uint64_t & cr3, const vaddr_t & vaddr,
+                        maddr_t & maddr, vaddr_t * page_end, WalkFault64 & fault)
+{
+    if ( tlb.lookup(vaddr, maddr, page_end) )
+        return true;
+
+    int level;
+    if ( tlb.lookup_fault(vaddr, level) )
+    {
+        fault.level = level;
+        fault.reason = pagefault::FAULT_NOTPRESENT;
+        return false;
+    }
+
+    unsigned page_shift;
+    if ( ! try_pagetable_walk_64(cr3, vaddr, maddr, page_end, &page_shift, fault) )
+    {
+        if ( fault.level && fault.reason == pagefault::FAULT_NOTPRESENT )
+            tlb.insert_fault(vaddr, fault.level);
+        return false;
+    }
+
+    tlb.insert(vaddr, maddr, page_shift);
+    return true;
+}
 
 namespace x86_64
 {
-    PT64::PT64(const uint64_t & cr3):cr3(cr3) {};
+    /**
+     * Reads guest pagetable entries, which are addressed by guest physical
+     * address, through a p2m.
+     */
+    class P2MReader: public PTEReader
+    {
+    public:
+        /**
+         * Constructor.
+         * @param p2m P2M to translate entry addresses with.
+         */
+        P2MReader(const P2M & p2m):p2m(p2m) {}
+
+        /**
+         * Read a pagetable entry.
+         * @param entry Guest physical address of the entry.
+         * @param value Entry value result.
+         * @param fault Filled with the details of a failure.
+         * @returns boolean indicating success or failure.
+         */
+        virtual bool read(const maddr_t & entry, uint64_t & value, ReadFault & fault) const
+        {
+            maddr_t maddr;
+            unsigned page_shift;
+            WalkFault64 p2m_fault;
+
+            // An entry the p2m can't translate is as good as beyond the core
+            if ( ! this->p2m.translate(entry, maddr, page_shift, p2m_fault) )
+            {
+                fault.seek = true;
+                fault.count = 0;
+                fault.error = 0;
+                return false;
+            }
+            return pte_cache.read(maddr, value, &fault);
+        }
+
+    private:
+        /// P2M to translate entry addresses with.
+        const P2M & p2m;
+
+        // @cond EXCLUDE
+        P2MReader & operator= (const P2MReader &);
+        // @endcond
+    };
+
+    PT64::PT64(const uint64_t & cr3):cr3(cr3), tlb() {};
     PT64::~PT64() {};
 
     void PT64::walk(const vaddr_t & vaddr, maddr_t & maddr,
@@ -38,15 +138,161 @@ namespace x86_64
     {
         /* Verify the pointer is canonical.  If not, the vaddr is
          * certainly junk. */
-        if ( vaddr > 0x00007fffffffffffULL &&
-             vaddr < 0xffff800000000000ULL )
+        if ( ! is_canonical(vaddr) )
             throw validate(vaddr, "Address is non-canonical.");
 
-        pagetable_walk_64(this->cr3, vaddr, maddr, page_end);
+        WalkFault64 fault;
+        if ( ! cached_walk(this->tlb, this->cr3, vaddr, maddr, page_end, fault) )
+            throw_walk_fault(this->cr3, vaddr, fault);
+    }
+
+    bool PT64::try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                        vaddr_t * page_end) const
+    {
+        WalkFault64 fault;
+
+        return is_canonical(vaddr) &&
+            cached_walk(this->tlb, this->cr3, vaddr, maddr, page_end, fault);
+    }
+
+
+    bool XenPT::verify_directmap = false;
+    bool XenPT::dm_enabled = false;
+    unsigned XenPT::dm_hole_shift = 0;
+    uint64_t XenPT::dm_bottom_mask = ~0ULL;
+    uint64_t XenPT::dm_top_mask = 0;
+    maddr_t XenPT::dm_limit = 0;
+
+    XenPT::XenPT(const uint64_t & cr3):PT64(cr3) {};
+    XenPT::~XenPT() {};
+
+    void XenPT::walk(const vaddr_t & vaddr, maddr_t & maddr,
+                     vaddr_t * page_end) const
+    {
+        if ( ! this->direct_map(vaddr, maddr, page_end) )
+            return PT64::walk(vaddr, maddr, page_end);
+
+        if ( XenPT::verify_directmap )
+        {
+            maddr_t walked;
+            PT64::walk(vaddr, walked, NULL);
+            this->check_direct_map(vaddr, maddr, walked);
+        }
+    }
+
+    bool XenPT::try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                         vaddr_t * page_end) const
+    {
+        if ( ! this->direct_map(vaddr, maddr, page_end) )
+            return PT64::try_walk(vaddr, maddr, page_end);
+
+        maddr_t walked;
+        if ( XenPT::verify_directmap && PT64::try_walk(vaddr, walked, NULL) )
+            this->check_direct_map(vaddr, maddr, walked);
+        return true;
+    }
+
+    bool XenPT::setup_direct_map(const Abstract::PageTable & pt)
+    {
+        using namespace Abstract::xensyms;
+        using namespace x86_64::xensyms;
+
+        XenPT::dm_enabled = false;
+
+        if ( ! HAVE_CORE_XENSYMS(virt) || ! HAVE_x86_64_XENSYMS(x86_64_m2p) )
+        {
+            LOG_DEBUG("  Missing symbols for direct map translation.  Walking instead\n");
+            return false;
+        }
+
+        uint64_t max_frame;
+        uint32_t hole_shift = 0;
+        uint64_t bottom_mask = ~0ULL, top_mask = 0;
+
+        if ( ! memory.try_read64_vaddr(pt, max_page, max_frame) )
+        {
+            LOG_DEBUG("  Unable to read max_page.  Walking the direct map instead\n");
+            return false;
+        }
+
+        if ( HAVE_x86_64_XENSYMS(x86_64_pdx) )
+        {
+            if ( ! memory.try_read32_vaddr(pt, pfn_pdx_hole_shift, hole_shift) ||
+                 ! memory.try_read64_vaddr(pt, ma_va_bottom_mask, bottom_mask) ||
+                 ! memory.try_read64_vaddr(pt, ma_top_mask, top_mask) )
+            {
+                LOG_DEBUG("  Unable to read PDX parameters.  Walking the direct map instead\n");
+                return false;
+            }
+        }
+        else
+            LOG_DEBUG("  No PDX compression symbols.  Assuming no compression\n");
+
+        if ( hole_shift >= 64 || max_frame > (1ULL << (64 - 12)) )
+        {
+            LOG_WARN("  Implausible pfn_pdx_hole_shift %"PRIu32" or max_page 0x%"PRIx64
+                     ".  Walking the direct map instead\n", hole_shift, max_frame);
+            return false;
+        }
+
+        XenPT::dm_hole_shift = hole_shift;
+        XenPT::dm_bottom_mask = bottom_mask;
+        XenPT::dm_top_mask = top_mask;
+        XenPT::dm_limit = max_frame << 12;
+        XenPT::dm_enabled = true;
+
+        LOG_DEBUG("  Direct map: max_page 0x%"PRIx64", pdx hole shift %"PRIu32
+                  ", bottom mask 0x%016"PRIx64", top mask 0x%016"PRIx64"\n",
+                  max_frame, hole_shift, bottom_mask, top_mask);
+        return true;
+    }
+
+    bool XenPT::direct_map(const vaddr_t & vaddr, maddr_t & maddr,
+                           vaddr_t * page_end) const
+    {
+        using namespace Abstract::xensyms;
+
+        if ( ! XenPT::dm_enabled ||
+             vaddr < VIRT_DIRECTMAP_START || vaddr >= VIRT_DIRECTMAP_END )
+            return false;
+
+        // As Xen's __virt_to_maddr(), undoing PDX compression
+        const uint64_t va = vaddr - VIRT_DIRECTMAP_START;
+        const maddr_t ma = ( va & XenPT::dm_bottom_mask ) |
+            ( ( va << XenPT::dm_hole_shift ) & XenPT::dm_top_mask );
+
+        // Beyond max_page, the direct map is not populated
+        if ( ma >= XenPT::dm_limit )
+            return false;
+
+        maddr = ma;
+        if ( page_end )
+        {
+            /* Machine addresses follow virtual ones up to the end of the
+             * uncompressed bottom bits, max_page, or the direct map. */
+            vaddr_t end = vaddr + ( XenPT::dm_limit - 1 - ma );
+
+            if ( XenPT::dm_hole_shift )
+                end = std::min(end, VIRT_DIRECTMAP_START + ( va | XenPT::dm_bottom_mask ));
+            *page_end = std::min(end, VIRT_DIRECTMAP_END - 1);
+        }
+        return true;
+    }
+
+    void XenPT::check_direct_map(const vaddr_t & vaddr, maddr_t & maddr,
+                                 const maddr_t & walked) const
+    {
+        if ( walked != maddr )
+        {
+            LOG_WARN("Direct map translation of 0x%016"PRIx64" gave 0x%016"PRIx64
+                     ", but the pagetables give 0x%016"PRIx64"\n",
+                     vaddr, maddr, walked);
+            maddr = walked;
+        }
     }
 
 
-    PT64Compat::PT64Compat(const uint64_t & cr3):cr3(cr3) {};
+    PT64Compat::PT64Compat(const uint64_t & cr3):cr3(cr3), tlb() {};
     PT64Compat::~PT64Compat() {};
 
     void PT64Compat::walk(const vaddr_t & vaddr, maddr_t & maddr,
@@ -57,7 +303,165 @@ namespace x86_64
         if ( vaddr & 0xffffffff00000000ULL )
             throw validate(vaddr, "Pointer out of range for 64bit Compat pagetables.");
 
-        pagetable_walk_64(this->cr3, vaddr, maddr, page_end);
+        WalkFault64 fault;
+        if ( ! cached_walk(this->tlb, this->cr3, vaddr, maddr, page_end, fault) )
+            throw_walk_fault(this->cr3, vaddr, fault);
+    }
+
+    bool PT64Compat::try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                              vaddr_t * page_end) const
+    {
+        WalkFault64 fault;
+
+        return ! (vaddr & 0xffffffff00000000ULL) &&
+            cached_walk(this->tlb, this->cr3, vaddr, maddr, page_end, fault);
+    }
+
+
+    P2M::P2M(const maddr_t & root, bool ept):root(root), ept(ept), tlb() {};
+    P2M::~P2M() {};
+
+    bool P2M::translate(const maddr_t & gpaddr, maddr_t & maddr,
+                        unsigned & page_shift, WalkFault64 & fault) const
+    {
+        if ( this->tlb.lookup(gpaddr, maddr, NULL, &page_shift) )
+            return true;
+
+        int level;
+        if ( this->tlb.lookup_fault(gpaddr, level) )
+        {
+            fault.level = level;
+            fault.reason = pagefault::FAULT_NOTPRESENT;
+            return false;
+        }
+
+        bool ok = this->ept ?
+            try_ept_walk(this->root, gpaddr, maddr, NULL, &page_shift, fault) :
+            try_pagetable_walk_64(this->root, gpaddr, maddr, NULL, &page_shift, fault);
+
+        if ( ! ok )
+        {
+            if ( fault.level && fault.reason == pagefault::FAULT_NOTPRESENT )
+                this->tlb.insert_fault(gpaddr, fault.level);
+            return false;
+        }
+
+        this->tlb.insert(gpaddr, maddr, page_shift);
+        return true;
+    }
+
+    void P2M::walk(const vaddr_t & gpaddr, maddr_t & maddr,
+                   vaddr_t * page_end) const
+    {
+        unsigned page_shift;
+        WalkFault64 fault;
+
+        if ( ! this->translate(gpaddr, maddr, page_shift, fault) )
+            throw_walk_fault(this->root, gpaddr, fault);
+
+        if ( page_end )
+            *page_end = gpaddr | ((1ULL << page_shift) - 1);
+    }
+
+    bool P2M::try_walk(const vaddr_t & gpaddr, maddr_t & maddr,
+                       vaddr_t * page_end) const
+    {
+        unsigned page_shift;
+        WalkFault64 fault;
+
+        if ( ! this->translate(gpaddr, maddr, page_shift, fault) )
+            return false;
+
+        if ( page_end )
+            *page_end = gpaddr | ((1ULL << page_shift) - 1);
+        return true;
+    }
+
+
+    HAP64::HAP64(const maddr_t & p2m_root, bool ept, const uint64_t & cr3,
+                 bool paging):
+        p2m(p2m_root, ept), cr3(cr3), paging(paging), tlb()
+    {};
+
+    HAP64::~HAP64() {};
+
+    bool HAP64::translate(const vaddr_t & vaddr, maddr_t & maddr,
+                          vaddr_t * page_end, WalkFault64 & fault) const
+    {
+        if ( this->tlb.lookup(vaddr, maddr, page_end) )
+            return true;
+
+        int level;
+        if ( this->tlb.lookup_fault(vaddr, level) )
+        {
+            fault.level = level;
+            fault.reason = pagefault::FAULT_NOTPRESENT;
+            return false;
+        }
+
+        maddr_t gpaddr;
+        unsigned guest_shift, p2m_shift;
+
+        if ( this->paging )
+        {
+            P2MReader reader(this->p2m);
+
+            if ( ! try_pagetable_walk_64(this->cr3, vaddr, gpaddr, NULL,
+                                         &guest_shift, fault, &reader) )
+            {
+                if ( fault.level && fault.reason == pagefault::FAULT_NOTPRESENT )
+                    this->tlb.insert_fault(vaddr, fault.level);
+                return false;
+            }
+        }
+        else
+        {
+            // Unpaged: virtual addresses are guest physical addresses
+            gpaddr = vaddr;
+            guest_shift = 39;
+        }
+
+        WalkFault64 p2m_fault;
+        if ( ! this->p2m.translate(gpaddr, maddr, p2m_shift, p2m_fault) )
+        {
+            fault.level = 0;
+            fault.reason = pagefault::FAULT_NOTPRESENT;
+            fault.entry = gpaddr;
+            fault.read.seek = true;
+            return false;
+        }
+
+        // The combined page is the smaller of the two stages
+        unsigned page_shift = std::min(guest_shift, p2m_shift);
+
+        this->tlb.insert(vaddr, maddr, page_shift);
+        if ( page_end )
+            *page_end = vaddr | ((1ULL << page_shift) - 1);
+        return true;
+    }
+
+    void HAP64::walk(const vaddr_t & vaddr, maddr_t & maddr,
+                     vaddr_t * page_end) const
+    {
+        if ( this->paging && ! is_canonical(vaddr) )
+            throw validate(vaddr, "Address is non-canonical.");
+
+        WalkFault64 fault;
+        if ( this->translate(vaddr, maddr, page_end, fault) )
+            return;
+
+        if ( fault.level )
+            throw pagefault(vaddr, this->cr3, fault.level, fault.reason);
+        throw validate(vaddr, "Guest physical address not mapped by the p2m.");
+    }
+
+    bool HAP64::try_walk(const vaddr_t & vaddr, maddr_t & maddr,
+                         vaddr_t * page_end) const
+    {
+        WalkFault64 fault;
+
+        return ( ! this->paging || is_canonical(vaddr) ) &&
+            this->translate(vaddr, maddr, page_end, fault);
     }
 }
 
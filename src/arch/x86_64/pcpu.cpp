@@ -47,6 +47,12 @@
 using namespace Abstract::xensyms;
 using namespace x86_64::xensyms;
 
+/**
+ * Smallest stack value considered as a machine address to annotate.  Below
+ * this, small integers would be mistaken for addresses of low memory.
+ */
+static const maddr_t MIN_ANNOTATED_MADDR = 1ULL << 20;
+
 
 namespace x86_64
 {
@@ -146,7 +152,7 @@ namespace x86_64
 
         try
         {
-            this->xenpt = new PT64(this->regs.cr3);
+            this->xenpt = new XenPT(this->regs.cr3);
         }
         catch ( const std::bad_alloc & )
         {
@@ -439,6 +445,17 @@ namespace x86_64
         return len;
     }
 
+    void PCPU::prefetch_stack() const
+    {
+        if ( ! this->is_online() || ! this->xenpt )
+            return;
+
+        vaddr_t stack_min = this->regs.rsp & ~(STACK_SIZE-1);
+
+        if ( host.validate_xen_vaddr(stack_min, false) )
+            memory.prefetch_vaddr(*this->xenpt, stack_min, STACK_SIZE);
+    }
+
     int PCPU::dump_stack(FILE * o) const
     {
         static const char * stack_name[] = { "Double Fault", "NMI", "MCE", "Normal" };
@@ -450,6 +467,9 @@ namespace x86_64
 
         try
         {
+            if ( ! host.xen_rmap.is_built() )
+                host.xen_rmap.build(host.get_xenpt());
+
             len += FPRINTF(o, "PCPU %d\n", this->processor_id);
             len += FPRINTF(o, "  rsp 0x%016"PRIx64", min 0x%016"PRIx64", max 0x%016"PRIx64"\n\n",
                            this->regs.rsp, stack_min, stack_max);
@@ -487,6 +507,7 @@ namespace x86_64
                 len += FPUTS("\n", o);
 
                 uint64_t val;
+                vaddr_t alias;
                 uint8_t zero_mask = 0x3f, zeroes = zero_mask;
                 bool printed_something = false;
 
@@ -513,6 +534,18 @@ namespace x86_64
                         len += host.symtab.print_text_symbol(o, val);
                         len += FPUTS("\n", o);
                     }
+                    else if ( val >= MIN_ANNOTATED_MADDR &&
+                              host.xen_rmap.lookup(val, &alias, 1) )
+                    {
+                        // Probably a machine address Xen also maps elsewhere
+                        len += FPRINTF(o, " maddr, mapped at 0x%016"PRIx64, alias);
+                        if ( host.symtab.is_text_symbol(alias) )
+                        {
+                            len += FPUTS(" ", o);
+                            len += host.symtab.print_text_symbol(o, alias);
+                        }
+                        len += FPUTS("\n", o);
+                    }
                     else
                         len += FPUTS("\n", o);
 
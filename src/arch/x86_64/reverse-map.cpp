@@ -0,0 +1,170 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/arch/x86_64/reverse-map.cpp
+ * @author Andrew Cooper
+ */
+
+#include "arch/x86_64/reverse-map.hpp"
+#include "arch/x86_64/pagetable-walk.hpp"
+#include "arch/x86_64/xensyms.hpp"
+
+#include "abstract/xensyms.hpp"
+#include "exceptions.hpp"
+#include "util/log.hpp"
+
+#include <new>
+#include <algorithm>
+
+using namespace Abstract::xensyms;
+using namespace x86_64::xensyms;
+
+/// Start of Xen's half of the address space.
+static const vaddr_t XEN_VIRT_LOW = 0xffff800000000000ULL;
+/// Start of Xen's linear pagetable slots.
+static const vaddr_t LINEAR_PT_START = 0xffff810000000000ULL;
+/// End of Xen's linear pagetable slots.
+static const vaddr_t LINEAR_PT_END = 0xffff820000000000ULL;
+/// Default direct map start, if the symbol table doesn't say.
+static const vaddr_t DEFAULT_DIRECTMAP_START = 0xffff830000000000ULL;
+/// Default direct map end, if the symbol table doesn't say.
+static const vaddr_t DEFAULT_DIRECTMAP_END = 0xffff880000000000ULL;
+/// End of Xen's slots.  Above is the PV guest kernel range.
+static const vaddr_t XEN_VIRT_HIGH = 0xffff880000000000ULL;
+
+namespace x86_64
+{
+
+    ReverseMap::ReverseMap(): entries(), built(false) {}
+
+    void ReverseMap::add_range(const maddr_t & cr3, const vaddr_t & start,
+                               const vaddr_t & end)
+    {
+        AddressSpace64 as(cr3, start, end);
+        Mapping64 mapping;
+
+        while ( as.next(mapping) )
+        {
+            if ( mapping.vaddr < start || mapping.vaddr > end )
+                continue;
+
+            const unsigned size = (mapping.page_shift - 12) / 9;
+
+            if ( size >= NR_SIZES )
+                continue;
+
+            Entry e = { mapping.maddr, mapping.vaddr };
+            this->entries[size].push_back(e);
+        }
+
+        if ( as.nr_bad_tables() )
+            LOG_DEBUG("  %zu unreadable pagetables in 0x%016"PRIx64"-0x%016"PRIx64"\n",
+                      as.nr_bad_tables(), start, end);
+    }
+
+    bool ReverseMap::build(const Abstract::PageTable & xenpt)
+    {
+        vaddr_t dm_start = DEFAULT_DIRECTMAP_START, dm_end = DEFAULT_DIRECTMAP_END;
+        maddr_t cr3;
+
+        this->built = true;
+
+        if ( HAVE_CORE_XENSYMS(virt) )
+        {
+            dm_start = VIRT_DIRECTMAP_START;
+            dm_end = VIRT_DIRECTMAP_END;
+        }
+
+        /* The idle pagetables, rather than whichever context a PCPU was
+         * in, so the index doesn't depend on the PCPU order. */
+        if ( ! REQ_x86_64_XENSYMS(x86_64_idle_pt) )
+            return false;
+
+        try
+        {
+            xenpt.walk(idle_pg_table, cr3);
+
+            this->add_range(cr3, XEN_VIRT_LOW, LINEAR_PT_START - 1);
+            this->add_range(cr3, LINEAR_PT_END, std::min(dm_start, XEN_VIRT_HIGH) - 1);
+            if ( dm_end < XEN_VIRT_HIGH )
+                this->add_range(cr3, dm_end, XEN_VIRT_HIGH - 1);
+
+            for ( unsigned x = 0; x < NR_SIZES; ++x )
+                std::sort(this->entries[x].begin(), this->entries[x].end());
+
+            LOG_DEBUG("  Xen reverse map: %zu 4K, %zu 2M and %zu 1G mappings\n",
+                      this->entries[0].size(), this->entries[1].size(),
+                      this->entries[2].size());
+            return true;
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad Alloc exception.  Out of memory for the Xen reverse map\n");
+        }
+        catch ( const CommonError & e )
+        {
+            e.log();
+        }
+
+        for ( unsigned x = 0; x < NR_SIZES; ++x )
+            std::vector<Entry>().swap(this->entries[x]);
+        return false;
+    }
+
+    size_t ReverseMap::lookup(const maddr_t & maddr, vaddr_t * vaddrs, size_t max) const
+    {
+        size_t found = 0;
+
+        for ( unsigned x = 0; x < NR_SIZES; ++x )
+        {
+            const uint64_t mask = (1ULL << (12 + 9 * x)) - 1;
+            const Entry key = { maddr & ~mask, 0 };
+
+            for ( std::vector<Entry>::const_iterator it =
+                      std::lower_bound(this->entries[x].begin(), this->entries[x].end(), key);
+                  it != this->entries[x].end() && it->maddr == key.maddr; ++it, ++found )
+                if ( found < max )
+                    vaddrs[found] = it->vaddr | (maddr & mask);
+        }
+
+        return found;
+    }
+
+    size_t ReverseMap::size() const
+    {
+        size_t n = 0;
+
+        for ( unsigned x = 0; x < NR_SIZES; ++x )
+            n += this->entries[x].size();
+        return n;
+    }
+
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -26,6 +26,7 @@
 #include "arch/x86_64/vcpu.hpp"
 #include "arch/x86_64/pagetable.hpp"
 #include "arch/x86_64/xensyms.hpp"
+#include "system.hpp"
 
 #include <cstring>
 #include <new>
@@ -39,6 +40,11 @@
 #include "util/macros.hpp"
 #include "util/stdio-wrapper.hpp"
 
+/// CR0.PG: paging enabled.
+#define X86_CR0_PG (1ULL << 31)
+/// EFER.LMA: long mode active.
+#define X86_EFER_LMA (1ULL << 10)
+
 using namespace Abstract::xensyms;
 using namespace x86_64::xensyms;
 
@@ -46,7 +52,8 @@ namespace x86_64
 {
 
     VCPU::VCPU(Abstract::VCPU::VCPURunstate rst):
-        Abstract::VCPU(rst), regs()
+        Abstract::VCPU(rst), regs(), basic_is_32bit(0), basic_paging_mode(0),
+        p2m_root(0), p2m_ept(false), guest_cr3(0), guest_paging(false)
     {
         memset(&this->regs, 0, sizeof this->regs);
     }
@@ -64,43 +71,17 @@ namespace x86_64
         try
         {
             host.validate_xen_vaddr(addr);
-            this->vcpu_ptr = addr;
-
-            memory.read64_vaddr(xenpt, this->vcpu_ptr + VCPU_domain,
-                                this->domain_ptr);
-
-            host.validate_xen_vaddr(this->domain_ptr);
-
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_vcpu_id,
-                                this->vcpu_id);
 
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_processor,
-                                this->processor);
+            ReadBatch batch;
 
-            memory.read16_vaddr(xenpt, this->domain_ptr + DOMAIN_id,
-                                this->domid);
+            this->queue_basic(addr, batch);
+            memory.read_batch_vaddr(xenpt, batch);
 
-            uint8_t is_32bit;
-            memory.read8_vaddr(xenpt, this->domain_ptr + DOMAIN_is_32bit_pv,
-                               is_32bit);
-            this->flags |= is_32bit ? CPU_PV_COMPAT : 0;
+            batch.requests.clear();
+            this->queue_basic_domain(batch);
+            memory.read_batch_vaddr(xenpt, batch);
 
-            uint32_t paging_mode;
-            memory.read32_vaddr(xenpt, this->domain_ptr + DOMAIN_paging_mode, paging_mode);
-            if ( paging_mode == 0 )
-                this->paging_support = VCPU::PAGING_NONE;
-            else if ( paging_mode & (1U<<20) )
-                this->paging_support = VCPU::PAGING_SHADOW;
-            else if ( paging_mode & (1U<<21) )
-                this->paging_support = VCPU::PAGING_HAP;
-
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_pause_flags,
-                                this->pause_flags);
-            memory.read32_vaddr(xenpt, this->vcpu_ptr + VCPU_pause_count,
-                                this->pause_count);
-
-            memory.read64_vaddr(xenpt, this->vcpu_ptr + VCPU_cr3,
-                                this->regs.cr3);
+            this->finish_basic();
 
             return true;
         }
@@ -112,6 +93,39 @@ namespace x86_64
         return false;
     }
 
+    void VCPU::queue_basic(const vaddr_t & addr, ReadBatch & batch)
+    {
+        this->vcpu_ptr = addr;
+
+        batch.add(this->vcpu_ptr + VCPU_domain, this->domain_ptr);
+        batch.add(this->vcpu_ptr + VCPU_vcpu_id, this->vcpu_id);
+        batch.add(this->vcpu_ptr + VCPU_processor, this->processor);
+        batch.add(this->vcpu_ptr + VCPU_pause_flags, this->pause_flags);
+        batch.add(this->vcpu_ptr + VCPU_pause_count, this->pause_count);
+        batch.add(this->vcpu_ptr + VCPU_cr3, this->regs.cr3);
+    }
+
+    void VCPU::queue_basic_domain(ReadBatch & batch)
+    {
+        host.validate_xen_vaddr(this->domain_ptr);
+
+        batch.add(this->domain_ptr + DOMAIN_id, this->domid);
+        batch.add(this->domain_ptr + DOMAIN_is_32bit_pv, this->basic_is_32bit);
+        batch.add(this->domain_ptr + DOMAIN_paging_mode, this->basic_paging_mode);
+    }
+
+    void VCPU::finish_basic()
+    {
+        this->flags |= this->basic_is_32bit ? CPU_PV_COMPAT : 0;
+
+        if ( this->basic_paging_mode == 0 )
+            this->paging_support = VCPU::PAGING_NONE;
+        else if ( this->basic_paging_mode & (1U<<20) )
+            this->paging_support = VCPU::PAGING_SHADOW;
+        else if ( this->basic_paging_mode & (1U<<21) )
+            this->paging_support = VCPU::PAGING_HAP;
+    }
+
     bool VCPU::parse_extended(const Abstract::PageTable & xenpt,
                               const vaddr_t * cpuinfo)
     {
@@ -158,6 +172,9 @@ namespace x86_64
                 return false;
             }
 
+            if ( this->paging_support == VCPU::PAGING_HAP )
+                this->parse_hap(xenpt);
+
             return true;
         }
         catch ( const std::bad_alloc & )
@@ -258,6 +275,76 @@ namespace x86_64
         return false;
     }
 
+    bool VCPU::parse_hap(const Abstract::PageTable & xenpt)
+    {
+        if ( ! HAVE_x86_64_XENSYMS(x86_64_hap) )
+        {
+            LOG_DEBUG("Missing xensyms for HAP.  Can't translate guest addresses "
+                      "for d%"PRId16"v%"PRId32"\n", this->domid, this->vcpu_id);
+            return false;
+        }
+
+        if ( cpu_vendor == VENDOR_UNKNOWN )
+        {
+            LOG_WARN("Unknown cpu vendor.  Can't translate guest addresses for "
+                     "d%"PRId16"v%"PRId32"\n", this->domid, this->vcpu_id);
+            return false;
+        }
+
+        try
+        {
+            ReadBatch batch;
+            uint64_t guest_cr[5], guest_efer, root_pfn;
+            vaddr_t p2m_ptr;
+
+            // guest_cr[] is an array of unsigned longs
+            batch.add(this->vcpu_ptr + VCPU_hvm_guest_cr2 - 16, guest_cr, sizeof guest_cr);
+            batch.add(this->vcpu_ptr + VCPU_hvm_guest_efer, guest_efer);
+            batch.add(this->domain_ptr + DOMAIN_p2m, p2m_ptr);
+            memory.read_batch_vaddr(xenpt, batch);
+
+            host.validate_xen_vaddr(p2m_ptr);
+            // phys_table is a pagetable_t, holding the pfn of the root
+            memory.read64_vaddr(xenpt, p2m_ptr + P2M_phys_table, root_pfn);
+
+            const bool paging = guest_cr[0] & X86_CR0_PG;
+
+            if ( paging && ! (guest_efer & X86_EFER_LMA) )
+            {
+                LOG_INFO("d%"PRId16"v%"PRId32" is not in long mode.  Only 64bit HAP "
+                         "guests can be translated\n", this->domid, this->vcpu_id);
+                return false;
+            }
+
+            this->p2m_root = root_pfn << 12;
+            this->p2m_ept = cpu_vendor == VENDOR_INTEL;
+            this->guest_cr3 = guest_cr[3];
+            this->guest_paging = paging;
+
+            Abstract::PageTable * pt = new x86_64::HAP64(
+                this->p2m_root, this->p2m_ept, this->guest_cr3, this->guest_paging);
+            SAFE_DELETE(this->dompt);
+            this->dompt = pt;
+            this->flags |= CPU_HAP_PT;
+
+            LOG_DEBUG("d%"PRId16"v%"PRId32" HAP: %s root 0x%016"PRIx64", guest cr3 "
+                      "0x%016"PRIx64"%s\n", this->domid, this->vcpu_id,
+                      this->p2m_ept ? "EPT" : "NPT", this->p2m_root, this->guest_cr3,
+                      paging ? "" : " (paging disabled)");
+            return true;
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad alloc - out of memory\n");
+        }
+        catch ( const CommonError & e )
+        {
+            e.log();
+        }
+
+        return false;
+    }
+
     bool VCPU::copy_from_active(const Abstract::VCPU* active)
     {
         // Dangerous, but safe.  We will only actually be handed a 64bit vcpu;
@@ -271,7 +358,16 @@ namespace x86_64
                 return false;
             }
 
-            if ( this->flags & CPU_PV_COMPAT )
+            if ( vcpu->flags & CPU_HAP_PT )
+            {
+                this->p2m_root = vcpu->p2m_root;
+                this->p2m_ept = vcpu->p2m_ept;
+                this->guest_cr3 = vcpu->guest_cr3;
+                this->guest_paging = vcpu->guest_paging;
+                this->dompt = new x86_64::HAP64(this->p2m_root, this->p2m_ept,
+                                                this->guest_cr3, this->guest_paging);
+            }
+            else if ( this->flags & CPU_PV_COMPAT )
                 this->dompt = new x86_64::PT64Compat(vcpu->regs.cr3);
             else
                 this->dompt = new x86_64::PT64(vcpu->regs.cr3);
@@ -378,7 +474,8 @@ namespace x86_64
         if ( this->flags & CPU_GP_REGS &&
              this->flags & CPU_CR_REGS &&
              ( this->paging_support == VCPU::PAGING_NONE ||
-               this->paging_support == VCPU::PAGING_SHADOW )
+               this->paging_support == VCPU::PAGING_SHADOW ||
+               this->flags & CPU_HAP_PT )
             )
         {
             len += FPRINTF(o, "\tStack at %16"PRIx64":", this->regs.rsp);
@@ -38,6 +38,16 @@ namespace xensyms
 
     vaddr_t DOMAIN_paging_mode, DOMAIN_is_32bit_pv;
 
+    vaddr_t VCPU_hvm_guest_cr2, VCPU_hvm_guest_efer, DOMAIN_p2m, P2M_phys_table;
+
+    vaddr_t max_page;
+
+    vaddr_t pfn_pdx_hole_shift, ma_va_bottom_mask, ma_top_mask;
+
+    vaddr_t idle_pg_table;
+
+    vaddr_t DOMAIN_shared_info, SHARED_max_pfn, SHARED_frame_list_list;
+
     vaddr_t per_cpu__curr_vcpu, __per_cpu_offset;
 
     /// @cond EXCLUDE
@@ -46,6 +56,11 @@ namespace xensyms
     DEFINE_XENSYM_GROUP(x86_64_vcpu);
     DEFINE_XENSYM_GROUP(x86_64_domain);
     DEFINE_XENSYM_GROUP(x86_64_per_cpu);
+    DEFINE_XENSYM_GROUP(x86_64_hap);
+    DEFINE_XENSYM_GROUP(x86_64_m2p);
+    DEFINE_XENSYM_GROUP(x86_64_pdx);
+    DEFINE_XENSYM_GROUP(x86_64_idle_pt);
+    DEFINE_XENSYM_GROUP(x86_64_pv_p2m);
     /// @endcond
 
     const struct xensym xensyms [] =
@@ -64,6 +79,23 @@ namespace xensyms
         XENSYM(x86_64_domain, DOMAIN_paging_mode),
         XENSYM(x86_64_domain, DOMAIN_is_32bit_pv),
 
+        XENSYM(x86_64_hap, VCPU_hvm_guest_cr2),
+        XENSYM(x86_64_hap, VCPU_hvm_guest_efer),
+        XENSYM(x86_64_hap, DOMAIN_p2m),
+        XENSYM(x86_64_hap, P2M_phys_table),
+
+        XENSYM(x86_64_m2p, max_page),
+
+        XENSYM(x86_64_pdx, pfn_pdx_hole_shift),
+        XENSYM(x86_64_pdx, ma_va_bottom_mask),
+        XENSYM(x86_64_pdx, ma_top_mask),
+
+        XENSYM(x86_64_idle_pt, idle_pg_table),
+
+        XENSYM(x86_64_pv_p2m, DOMAIN_shared_info),
+        XENSYM(x86_64_pv_p2m, SHARED_max_pfn),
+        XENSYM(x86_64_pv_p2m, SHARED_frame_list_list),
+
         XENSYM(x86_64_per_cpu, per_cpu__curr_vcpu),
         XENSYM(x86_64_per_cpu, __per_cpu_offset),
 
@@ -0,0 +1,254 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/core-copy.cpp
+ * @author Andrew Cooper
+ */
+
+#include "core-copy.hpp"
+#include "util/log.hpp"
+#include "util/macros.hpp"
+
+#ifndef _LARGEFILE64_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+#include <new>
+#include <algorithm>
+
+/// Size of each sequential read of the source.
+static const size_t CHUNK_SIZE = 1 << 20;
+/// Granularity at which zeros are detected.
+static const size_t ZERO_BLOCK = 4096;
+
+/**
+ * Is a block entirely zero?
+ * @param buf Block, 8 byte aligned.
+ * @param n Size, a multiple of 8.
+ * @returns boolean.
+ */
+static bool is_zero(const char * buf, size_t n)
+{
+    const uint64_t * p = (const uint64_t *)buf;
+
+    for ( size_t x = 0; x < n / sizeof *p; ++x )
+        if ( p[x] )
+            return false;
+    return true;
+}
+
+/**
+ * Write n bytes at offset, retrying short writes.
+ * @param fd File descriptor.
+ * @param buf Buffer.
+ * @param n Number of bytes.
+ * @param offset File offset.
+ * @returns boolean indicating success or failure.
+ */
+static bool write_all(int fd, const char * buf, size_t n, uint64_t offset)
+{
+    while ( n )
+    {
+        ssize_t r = pwrite64(fd, buf, n, offset);
+
+        if ( r == -1 && errno == EINTR )
+            continue;
+        if ( r <= 0 )
+            return false;
+
+        buf += r; n -= r; offset += r;
+    }
+    return true;
+}
+
+CoreCopy::CoreCopy():
+    src(-1), dst(-1), sparse(false), running(false), complete(false),
+    thread(), copied(0), skipped(0)
+{}
+
+CoreCopy::~CoreCopy()
+{
+    this->finish();
+
+    if ( this->dst >= 0 && close(this->dst) == -1 )
+        LOG_ERROR("Failed to close saved core: %s\n", strerror(errno));
+    this->dst = -1;
+}
+
+bool CoreCopy::start(int src, const char * path, bool sparse)
+{
+    if ( (this->dst = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) == -1 )
+    {
+        LOG_ERROR("Failed to open '%s' to save the core: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    this->src = src;
+    this->sparse = sparse;
+
+    int err = pthread_create(&this->thread, NULL, CoreCopy::thread_main, this);
+    if ( err )
+    {
+        LOG_ERROR("Failed to start thread to save the core: %s\n", strerror(err));
+        close(this->dst);
+        this->dst = -1;
+        return false;
+    }
+
+    this->running = true;
+    LOG_INFO("Saving core to '%s'%s\n", path, sparse ? " (sparse)" : "");
+    return true;
+}
+
+bool CoreCopy::finish()
+{
+    if ( ! this->running )
+        return this->complete;
+
+    LOG_DEBUG("Waiting for the core to be saved\n");
+    pthread_join(this->thread, NULL);
+    this->running = false;
+
+    if ( fsync(this->dst) == -1 )
+    {
+        LOG_ERROR("Failed to sync saved core: %s\n", strerror(errno));
+        this->complete = false;
+    }
+
+    if ( this->complete )
+        LOG_INFO("Saved core: %"PRIu64" MB, of which %"PRIu64" MB of zeros left as holes\n",
+                 this->copied >> 20, this->skipped >> 20);
+    else
+        LOG_ERROR("Saved core is incomplete.  Only %"PRIu64" MB copied\n",
+                  this->copied >> 20);
+
+    return this->complete;
+}
+
+void * CoreCopy::thread_main(void * self)
+{
+    static_cast<CoreCopy *>(self)->run();
+    return NULL;
+}
+
+void CoreCopy::run()
+{
+    uint64_t * storage = NULL;
+
+    try
+    {
+        storage = new uint64_t[CHUNK_SIZE / sizeof *storage];
+    }
+    catch ( const std::bad_alloc & )
+    {
+        LOG_ERROR("Bad Alloc exception.  Unable to save core\n");
+        return;
+    }
+
+    char * buf = (char *)storage;
+    uint64_t offset = 0;
+
+    while ( true )
+    {
+        ssize_t r = pread64(this->src, buf, CHUNK_SIZE, offset);
+
+        if ( r == -1 && errno == EINTR )
+            continue;
+        if ( r == -1 )
+        {
+            LOG_ERROR("Failed to read core at offset 0x%"PRIx64" to save it: %s\n",
+                      offset, strerror(errno));
+            break;
+        }
+        if ( r == 0 )
+        {
+            this->complete = true;
+            break;
+        }
+
+        bool ok = true;
+
+        if ( ! this->sparse )
+            ok = write_all(this->dst, buf, r, offset);
+        else
+        {
+            // Write runs of non-zero blocks, leaving holes for the rest
+            size_t x = 0;
+
+            while ( ok && x < (size_t)r )
+            {
+                size_t n = std::min(ZERO_BLOCK, (size_t)r - x);
+
+                if ( n == ZERO_BLOCK && is_zero(buf + x, n) )
+                {
+                    this->skipped += n;
+                    x += n;
+                    continue;
+                }
+
+                size_t end = x + n;
+                while ( end < (size_t)r )
+                {
+                    n = std::min(ZERO_BLOCK, (size_t)r - end);
+                    if ( n == ZERO_BLOCK && is_zero(buf + end, n) )
+                        break;
+                    end += n;
+                }
+
+                ok = write_all(this->dst, buf + x, end - x, offset + x);
+                x = end;
+            }
+
+            /* Extend the file over trailing holes, so reads of them from the
+             * copy aren't short. */
+            if ( ok && ftruncate64(this->dst, offset + r) == -1 )
+                ok = false;
+        }
+
+        if ( ! ok )
+        {
+            LOG_ERROR("Failed to write saved core at offset 0x%"PRIx64": %s\n",
+                      offset, strerror(errno));
+            break;
+        }
+
+        offset += r;
+        // Publish only once the data is in the copy
+        __atomic_store_n(&this->copied, offset, __ATOMIC_RELEASE);
+    }
+
+    SAFE_DELETE_ARRAY(storage);
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
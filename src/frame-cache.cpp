@@ -0,0 +1,245 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/frame-cache.cpp
+ * @author Andrew Cooper
+ */
+
+#include "frame-cache.hpp"
+#include "util/log.hpp"
+#include "util/macros.hpp"
+
+#include <new>
+#include <cstring>
+
+FrameCache::FrameCache():
+    hits(0), misses(0), evictions(0),
+    nr_frames(0), nr_buckets(0), max_protected(0),
+    slots(NULL), buckets(NULL), data(NULL)
+{
+    for ( int l = 0; l < NR_LISTS; ++l )
+    {
+        this->list_len[l] = 0;
+        this->list_head[l] = this->list_tail[l] = -1;
+    }
+}
+
+FrameCache::~FrameCache()
+{
+    SAFE_DELETE_ARRAY(this->slots);
+    SAFE_DELETE_ARRAY(this->buckets);
+    SAFE_DELETE_ARRAY(this->data);
+}
+
+bool FrameCache::resize(size_t nr)
+{
+    SAFE_DELETE_ARRAY(this->slots);
+    SAFE_DELETE_ARRAY(this->buckets);
+    SAFE_DELETE_ARRAY(this->data);
+    this->nr_frames = this->nr_buckets = this->max_protected = 0;
+
+    for ( int l = 0; l < NR_LISTS; ++l )
+    {
+        this->list_len[l] = 0;
+        this->list_head[l] = this->list_tail[l] = -1;
+    }
+
+    if ( nr == 0 )
+        return true;
+
+    size_t nr_buckets = 1;
+    while ( nr_buckets < nr )
+        nr_buckets <<= 1;
+
+    try
+    {
+        this->slots = new Slot[nr];
+        this->buckets = new long[nr_buckets];
+        this->data = new char[nr * FRAME_SIZE];
+    }
+    catch ( const std::bad_alloc & )
+    {
+        LOG_WARN("Bad alloc for %zu frame cache.  Disabling frame cache\n", nr);
+        SAFE_DELETE_ARRAY(this->slots);
+        SAFE_DELETE_ARRAY(this->buckets);
+        SAFE_DELETE_ARRAY(this->data);
+        return false;
+    }
+
+    this->nr_frames = nr;
+    this->nr_buckets = nr_buckets;
+    /* Keep some of the cache probationary so new frames get a chance to
+     * prove their worth. */
+    this->max_protected = nr - nr / 4;
+    if ( this->max_protected == nr )
+        this->max_protected = nr - 1;
+
+    for ( size_t b = 0; b < nr_buckets; ++b )
+        this->buckets[b] = -1;
+
+    for ( size_t s = 0; s < nr; ++s )
+    {
+        this->slots[s].frame = -1ULL;
+        this->slots[s].hash_next = -1;
+        this->slots[s].prev = this->slots[s].next = -1;
+        this->push(s, LIST_FREE);
+    }
+
+    return true;
+}
+
+const char * FrameCache::lookup(const maddr_t & frame)
+{
+    long s = this->find(frame);
+
+    if ( s < 0 )
+    {
+        ++this->misses;
+        return NULL;
+    }
+
+    ++this->hits;
+
+    // A second hit promotes the frame to the protected list
+    this->unlink(s);
+    this->push(s, LIST_PROTECTED);
+
+    /* Demote the least recently used protected frame to the head of the
+     * probationary list, so it gets a final chance before eviction. */
+    if ( this->list_len[LIST_PROTECTED] > this->max_protected )
+    {
+        long demote = this->list_tail[LIST_PROTECTED];
+        this->unlink(demote);
+        this->push(demote, LIST_PROBATION);
+    }
+
+    return &this->data[s * FRAME_SIZE];
+}
+
+void FrameCache::insert(const maddr_t & frame, const char * contents)
+{
+    long s;
+
+    if ( this->find(frame) >= 0 )
+        return;
+
+    if ( this->list_len[LIST_FREE] )
+        s = this->list_tail[LIST_FREE];
+    else
+    {
+        s = this->list_tail[LIST_PROBATION];
+        this->unhash(s);
+        ++this->evictions;
+    }
+
+    this->unlink(s);
+
+    size_t b = this->hash(frame);
+    this->slots[s].frame = frame;
+    this->slots[s].hash_next = this->buckets[b];
+    this->buckets[b] = s;
+
+    this->push(s, LIST_PROBATION);
+
+    std::memcpy(&this->data[s * FRAME_SIZE], contents, FRAME_SIZE);
+}
+
+size_t FrameCache::hash(const maddr_t & frame) const
+{
+    uint64_t h = (frame >> 12) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32) & (this->nr_buckets - 1);
+}
+
+long FrameCache::find(const maddr_t & frame) const
+{
+    if ( ! this->nr_frames )
+        return -1;
+
+    for ( long s = this->buckets[this->hash(frame)]; s >= 0;
+          s = this->slots[s].hash_next )
+        if ( this->slots[s].frame == frame )
+            return s;
+
+    return -1;
+}
+
+void FrameCache::unlink(long s)
+{
+    Slot & slot = this->slots[s];
+
+    if ( slot.prev >= 0 )
+        this->slots[slot.prev].next = slot.next;
+    else
+        this->list_head[slot.list] = slot.next;
+
+    if ( slot.next >= 0 )
+        this->slots[slot.next].prev = slot.prev;
+    else
+        this->list_tail[slot.list] = slot.prev;
+
+    slot.prev = slot.next = -1;
+    --this->list_len[slot.list];
+}
+
+void FrameCache::push(long s, int list)
+{
+    Slot & slot = this->slots[s];
+
+    slot.list = list;
+    slot.prev = -1;
+    slot.next = this->list_head[list];
+
+    if ( slot.next >= 0 )
+        this->slots[slot.next].prev = s;
+    else
+        this->list_tail[list] = s;
+
+    this->list_head[list] = s;
+    ++this->list_len[list];
+}
+
+void FrameCache::unhash(long s)
+{
+    long * link = &this->buckets[this->hash(this->slots[s].frame)];
+
+    while ( *link >= 0 )
+    {
+        if ( *link == s )
+        {
+            *link = this->slots[s].hash_next;
+            break;
+        }
+        link = &this->slots[*link].hash_next;
+    }
+
+    this->slots[s].frame = -1ULL;
+    this->slots[s].hash_next = -1;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -29,6 +29,7 @@
 
 #include "abstract/xensyms.hpp"
 
+#include "arch/x86_64/pagetable.hpp"
 #include "arch/x86_64/pagetable-walk.hpp"
 #include "arch/x86_64/pcpu.hpp"
 #include "arch/x86_64/domain.hpp"
@@ -61,7 +62,8 @@ Host::Host():
     xen_major(0), xen_minor(0), xen_extra(NULL),
     xen_changeset(NULL), xen_compiler(NULL),
     xen_compile_date(NULL), debug_build(false),
-    can_validate_xen_vaddr(false), xen_vmcoreinfo(), dom0_vmcoreinfo()
+    can_validate_xen_vaddr(false), xen_vmcoreinfo(), dom0_vmcoreinfo(),
+    m2p(), xen_rmap()
 {}
 
 Host::~Host()
@@ -225,15 +227,23 @@ bool Host::decode_xen()
         if ( this->debug_build )
             LOG_DEBUG("Xen is a debug build.  Will adjust for poisoned registers.\n");
 
+        if ( this->arch == Abstract::Elf::ELF_64 )
+            x86_64::XenPT::setup_direct_map(xenpt);
+
+        // Get the disk busy while the PCPUs are decoded
+        this->plan_readahead();
+
         if ( this->arch == Abstract::Elf::ELF_64 )
         {
             LOG_DEBUG("  Reading idle vcpus\n");
+            ReadBatch batch;
             for ( int x = 0; x < this->nr_pcpus; ++x )
             {
                 vaddr_t idle = idle_vcpu + (x * sizeof(uint64_t) );
                 host.validate_xen_vaddr(idle);
-                memory.read64_vaddr(xenpt, idle, this->idle_vcpus[x]);
+                batch.add(idle, this->idle_vcpus[x]);
             }
+            memory.read_batch_vaddr(xenpt, batch);
         }
         else
         {
@@ -276,6 +286,12 @@ bool Host::decode_xen()
                 }
             }
 
+        if ( this->arch == Abstract::Elf::ELF_64 && x86_64::FrameMap::enabled )
+        {
+            LOG_DEBUG("  Loading M2P\n");
+            this->m2p.load_m2p(xenpt);
+        }
+
         return true;
     }
     catch ( const std::bad_alloc & )
@@ -496,6 +512,11 @@ int Host::print_domains(bool dump_structures)
             dom_ptr = dom->next_domain_ptr;
             LOG_INFO("  Found domain %"PRIu16"\n", dom->domain_id);
 
+            // Read the next domain in the background while decoding this one
+            if ( dom_ptr && this->validate_xen_vaddr(dom_ptr, false) )
+                memory.prefetch_vaddr(xenpt, dom_ptr,
+                                      DOMAIN_sizeof ? DOMAIN_sizeof : PAGE_SIZE);
+
             snprintf(fname, sizeof fname, "dom%d.log", dom->domain_id);
             if ( ! (fd = fopen_in_outdir(fname, "w")) )
             {
@@ -510,6 +531,9 @@ int Host::print_domains(bool dump_structures)
              */
             set_additional_log(fd);
 
+            if ( x86_64::FrameMap::enabled )
+                dom->parse_p2m();
+
             if ( ! dom->parse_vcpus_basic() )
             {
                 LOG_ERROR("    Failed to parse basic cpu information for domain %d\n",
@@ -644,6 +668,34 @@ const Abstract::PageTable & Host::get_xenpt() const
     throw validate(0, "No suitable PCPU Xen pagetables.");
 }
 
+void Host::plan_readahead() const
+{
+    try
+    {
+        const Abstract::PageTable & xenpt = this->get_xenpt();
+
+        if ( HAVE_CORE_XENSYMS(virt) && VIRT_XEN_END > VIRT_XEN_START )
+            memory.prefetch_vaddr(xenpt, VIRT_XEN_START, VIRT_XEN_END - VIRT_XEN_START);
+
+        for ( int x = 0; x < this->nr_pcpus; ++x )
+            this->pcpus[x]->prefetch_stack();
+
+        if ( HAVE_CORE_XENSYMS(console) )
+        {
+            uint64_t conring_ptr;
+            uint32_t length;
+
+            memory.read64_vaddr(xenpt, conring, conring_ptr);
+            memory.read32_vaddr(xenpt, conring_size, length);
+            memory.prefetch_vaddr(xenpt, conring_ptr, length);
+        }
+    }
+    catch ( const CommonError & e )
+    {
+        LOG_DEBUG("Readahead planning stopped early: %s\n", e.what());
+    }
+}
+
 bool Host::parse_vmcoreinfo(const ElfNote& note)
 {
     /* N.B. Both Xen and dom0 vmcoreinfo ELF notes use the same
@@ -0,0 +1,304 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/io-uring.cpp
+ * @author Andrew Cooper
+ */
+
+#include "io-uring.hpp"
+#include "util/log.hpp"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#ifdef HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**
+ * io_uring_setup() system call.
+ * @param entries Queue depth.
+ * @param p Ring parameters.
+ * @returns Ring file descriptor, or -1.
+ */
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params * p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+/**
+ * io_uring_enter() system call.
+ * @param fd Ring file descriptor.
+ * @param to_submit Number of submissions.
+ * @param min_complete Number of completions to wait for.
+ * @param flags Flags.
+ * @returns Number of submissions consumed, or -1.
+ */
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+/// Consecutive EAGAIN/EBUSY failures of io_uring_enter() before giving up.
+static const unsigned MAX_ENTER_RETRIES = 8;
+#endif
+
+IoUring::IoUring():
+    ring_fd(-1), fd(-1), sq_entries(0),
+    ring(NULL), ring_size(0), cq_ring(NULL), cq_ring_size(0),
+    sqes(NULL), sqes_size(0),
+    sq_head(NULL), sq_tail(NULL), sq_mask(0), sq_array(NULL),
+    cq_head(NULL), cq_tail(NULL), cq_mask(0), cqes(NULL)
+{}
+
+IoUring::~IoUring()
+{
+    this->teardown();
+}
+
+void IoUring::teardown()
+{
+    if ( this->sqes )
+        munmap(this->sqes, this->sqes_size);
+    if ( this->cq_ring )
+        munmap(this->cq_ring, this->cq_ring_size);
+    if ( this->ring )
+        munmap(this->ring, this->ring_size);
+    if ( this->ring_fd >= 0 )
+        close(this->ring_fd);
+
+    this->sqes = this->cq_ring = this->ring = NULL;
+    this->ring_fd = -1;
+}
+
+#ifdef HAVE_IO_URING
+
+bool IoUring::setup(int fd, unsigned entries)
+{
+    struct io_uring_params p;
+    std::memset(&p, 0, sizeof p);
+
+    this->teardown();
+
+    if ( (this->ring_fd = sys_io_uring_setup(entries, &p)) < 0 )
+    {
+        LOG_DEBUG("io_uring_setup() failed: %s\n", strerror(errno));
+        this->ring_fd = -1;
+        return false;
+    }
+
+    this->fd = fd;
+    this->sq_entries = p.sq_entries;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if ( p.features & IORING_FEAT_SINGLE_MMAP )
+        sq_size = cq_size = std::max(sq_size, cq_size);
+
+    this->ring_size = sq_size;
+    this->ring = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+    if ( this->ring == MAP_FAILED )
+    {
+        this->ring = NULL;
+        goto fail;
+    }
+
+    if ( p.features & IORING_FEAT_SINGLE_MMAP )
+        this->cq_ring = NULL;
+    else
+    {
+        this->cq_ring_size = cq_size;
+        this->cq_ring = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_CQ_RING);
+        if ( this->cq_ring == MAP_FAILED )
+        {
+            this->cq_ring = NULL;
+            goto fail;
+        }
+    }
+
+    this->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    this->sqes = mmap(NULL, this->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES);
+    if ( this->sqes == MAP_FAILED )
+    {
+        this->sqes = NULL;
+        goto fail;
+    }
+
+    {
+        char * sq = (char*)this->ring;
+        char * cq = this->cq_ring ? (char*)this->cq_ring : sq;
+
+        this->sq_head = (unsigned*)(sq + p.sq_off.head);
+        this->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        this->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+        this->sq_array = (unsigned*)(sq + p.sq_off.array);
+        this->cq_head = (unsigned*)(cq + p.cq_off.head);
+        this->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        this->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+        this->cqes = cq + p.cq_off.cqes;
+    }
+
+    LOG_DEBUG("io_uring set up with %u entries\n", this->sq_entries);
+    return true;
+
+ fail:
+    LOG_DEBUG("Failed to mmap() io_uring: %s\n", strerror(errno));
+    this->teardown();
+    return false;
+}
+
+bool IoUring::read_many(Read * reads, size_t nr)
+{
+    if ( ! this->enabled() )
+        return false;
+
+    std::vector<struct iovec> iovs(nr);
+    struct io_uring_sqe * sqes = (struct io_uring_sqe *)this->sqes;
+    size_t queued = 0, completed = 0;
+    unsigned inflight = 0, unsubmitted = 0, retries = 0;
+
+    while ( completed < nr )
+    {
+        // Fill the submission queue
+        unsigned tail = *this->sq_tail;
+        while ( queued < nr && inflight < this->sq_entries )
+        {
+            unsigned idx = tail & this->sq_mask;
+            struct io_uring_sqe * sqe = &sqes[idx];
+
+            iovs[queued].iov_base = reads[queued].dst;
+            iovs[queued].iov_len = reads[queued].len;
+
+            std::memset(sqe, 0, sizeof *sqe);
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = this->fd;
+            sqe->off = reads[queued].offset;
+            sqe->addr = (uint64_t)(unsigned long)&iovs[queued];
+            sqe->len = 1;
+            sqe->user_data = queued;
+
+            this->sq_array[idx] = idx;
+            ++tail; ++queued; ++inflight; ++unsubmitted;
+        }
+        __atomic_store_n(this->sq_tail, tail, __ATOMIC_RELEASE);
+
+        int r = sys_io_uring_enter(this->ring_fd, unsubmitted, 1,
+                                   IORING_ENTER_GETEVENTS);
+        if ( r < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            // Transient resource shortage; back off and try again, a few times
+            if ( ( errno == EAGAIN || errno == EBUSY ) &&
+                 retries < MAX_ENTER_RETRIES )
+            {
+                usleep(1U << retries++);
+                continue;
+            }
+
+            LOG_WARN("io_uring_enter() failed: %s.  Falling back to pread()\n",
+                     strerror(errno));
+
+            /* Submitted reads still write into the callers buffers, so
+             * must complete before they are handed back. */
+            while ( completed < queued - unsubmitted )
+            {
+                unsigned n = this->reap(reads);
+
+                if ( ! n )
+                    usleep(100);
+                completed += n;
+            }
+
+            this->teardown();
+            return false;
+        }
+        unsubmitted -= r;
+        retries = 0;
+
+        unsigned n = this->reap(reads);
+        completed += n;
+        inflight -= n;
+    }
+
+    return true;
+}
+
+unsigned IoUring::reap(Read * reads)
+{
+    struct io_uring_cqe * cqes = (struct io_uring_cqe *)this->cqes;
+    unsigned head = *this->cq_head, n = 0;
+    unsigned ctail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+
+    while ( head != ctail )
+    {
+        struct io_uring_cqe * cqe = &cqes[head & this->cq_mask];
+
+        reads[cqe->user_data].result = cqe->res;
+        ++head; ++n;
+    }
+    __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+#else /* HAVE_IO_URING */
+
+bool IoUring::setup(int, unsigned)
+{
+    LOG_DEBUG("io_uring support not compiled in\n");
+    return false;
+}
+
+bool IoUring::read_many(Read *, size_t)
+{
+    return false;
+}
+
+unsigned IoUring::reap(Read *)
+{
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,390 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/kdump.cpp
+ * @author Andrew Cooper
+ */
+
+#include "kdump.hpp"
+#include "exceptions.hpp"
+#include "util/log.hpp"
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+#include <new>
+#include <algorithm>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZO
+#include <lzo/lzo1x.h>
+#endif
+#ifdef HAVE_SNAPPY
+#include <snappy-c.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/// Frames per rank index entry.  Must be a multiple of 64.
+static const uint64_t RANK_GROUP = 512;
+
+/// Number of page descriptor blocks to cache.
+static const size_t NR_DESC_BLOCKS = 64;
+
+/// Default number of decompressed pages to cache.
+static const size_t DEFAULT_CACHED_PAGES = 256;
+
+Kdump::Kdump():
+    fd(-1), layout(), bitmap(), ranks(),
+    pages(), descs(), lock(), nr_decompressed(0)
+{
+    std::memset(&this->layout, 0, sizeof this->layout);
+}
+
+Kdump::~Kdump()
+{}
+
+bool Kdump::setup(int fd, const KdumpLayout & layout)
+{
+    this->fd = fd;
+    this->layout = layout;
+
+    if ( layout.block_size != FrameCache::FRAME_SIZE )
+    {
+        LOG_ERROR("Unsupported kdump block size %"PRIu64"\n", layout.block_size);
+        return false;
+    }
+
+    uint64_t nr_words = (layout.max_mapnr + 63) / 64;
+
+    if ( nr_words * 8 > layout.bitmap_size )
+    {
+        LOG_ERROR("kdump bitmap of %"PRIu64" bytes too small for %"PRIu64" frames\n",
+                  layout.bitmap_size, layout.max_mapnr);
+        return false;
+    }
+
+    try
+    {
+        // Round up to a whole rank group, so rank() never runs off the end
+        uint64_t group_words = RANK_GROUP / 64;
+        this->bitmap.resize((nr_words + group_words - 1) / group_words * group_words);
+        this->ranks.resize(this->bitmap.size() / group_words);
+    }
+    catch ( const std::bad_alloc & )
+    {
+        LOG_ERROR("Bad alloc for kdump bitmap of %"PRIu64" frames\n", layout.max_mapnr);
+        return false;
+    }
+
+    try
+    {
+        if ( nr_words )
+            this->read_file(layout.bitmap_offset, (char*)&this->bitmap[0], nr_words * 8, 0);
+    }
+    catch ( const memread & e )
+    {
+        LOG_ERROR("Failed to read kdump bitmap: %s\n", strerror(e.error));
+        return false;
+    }
+
+    // Clear bits beyond max_mapnr
+    if ( layout.max_mapnr & 63 )
+        this->bitmap[nr_words - 1] &= (1ULL << (layout.max_mapnr & 63)) - 1;
+
+    uint64_t total = 0;
+    for ( size_t g = 0; g < this->ranks.size(); ++g )
+    {
+        this->ranks[g] = total;
+        for ( uint64_t w = 0; w < RANK_GROUP / 64; ++w )
+            total += __builtin_popcountll(this->bitmap[g * (RANK_GROUP / 64) + w]);
+    }
+
+    LOG_DEBUG("kdump core: %"PRIu64" of %"PRIu64" frames dumped.  Index uses %zu kB\n",
+              total, layout.max_mapnr,
+              (this->bitmap.size() + this->ranks.size()) * sizeof (uint64_t) / 1024);
+
+    if ( ! this->descs.resize(NR_DESC_BLOCKS) )
+        return false;
+
+    return this->resize_cache(DEFAULT_CACHED_PAGES);
+}
+
+bool Kdump::resize_cache(size_t nr_pages)
+{
+    ScopedLock lock(this->lock);
+
+    return this->pages.resize(nr_pages);
+}
+
+void Kdump::read(const maddr_t & addr, char * dst, size_t n) const
+{
+    const uint64_t bs = this->layout.block_size;
+    maddr_t cur = addr;
+
+    while ( n )
+    {
+        uint64_t pfn = cur / bs, offset = cur % bs;
+        size_t nr = std::min(n, (size_t)(bs - offset));
+
+        {
+            ScopedLock lock(this->lock);
+            const char * src = this->pages.lookup(pfn * bs);
+
+            if ( src )
+            {
+                std::memcpy(dst, src + offset, nr);
+                dst += nr; cur += nr; n -= nr;
+                continue;
+            }
+        }
+
+        char page[FrameCache::FRAME_SIZE];
+        this->read_page(pfn, page);
+
+        {
+            ScopedLock lock(this->lock);
+            if ( this->pages.enabled() )
+                this->pages.insert(pfn * bs, page);
+        }
+
+        std::memcpy(dst, page + offset, nr);
+        dst += nr; cur += nr; n -= nr;
+    }
+}
+
+void Kdump::log_statistics() const
+{
+    LOG_DEBUG("kdump: %"PRIu64" pages decompressed.  Page cache %"PRIu64" hits, "
+              "%"PRIu64" misses\n", this->nr_decompressed,
+              this->pages.hits, this->pages.misses);
+}
+
+bool Kdump::contains(const maddr_t & addr, size_t n) const
+{
+    const uint64_t bs = this->layout.block_size;
+
+    if ( ! n )
+        return true;
+
+    for ( uint64_t pfn = addr / bs; pfn <= (addr + n - 1) / bs; ++pfn )
+        if ( ! this->present(pfn) )
+            return false;
+    return true;
+}
+
+bool Kdump::present(uint64_t pfn) const
+{
+    if ( pfn >= this->layout.max_mapnr )
+        return false;
+
+    return this->bitmap[pfn / 64] & (1ULL << (pfn % 64));
+}
+
+uint64_t Kdump::rank(uint64_t pfn) const
+{
+    uint64_t group = pfn / RANK_GROUP;
+    uint64_t r = this->ranks[group];
+
+    for ( uint64_t w = group * (RANK_GROUP / 64); w < pfn / 64; ++w )
+        r += __builtin_popcountll(this->bitmap[w]);
+
+    return r + __builtin_popcountll(this->bitmap[pfn / 64] & ((1ULL << (pfn % 64)) - 1));
+}
+
+void Kdump::read_desc(uint64_t pfn, PageDesc & desc) const
+{
+    const uint64_t bs = this->layout.block_size;
+    uint64_t foffset = this->layout.pd_offset + this->rank(pfn) * sizeof desc;
+    char * dst = (char*)&desc;
+    size_t n = sizeof desc;
+
+    // Descriptors don't divide evenly into blocks, so may straddle two
+    while ( n )
+    {
+        uint64_t block = foffset - (foffset % bs), offset = foffset % bs;
+        size_t nr = std::min(n, (size_t)(bs - offset));
+        char buf[FrameCache::FRAME_SIZE];
+
+        {
+            ScopedLock lock(this->lock);
+            const char * src = this->descs.lookup(block);
+
+            if ( src )
+            {
+                std::memcpy(dst, src + offset, nr);
+                dst += nr; foffset += nr; n -= nr;
+                continue;
+            }
+        }
+
+        /* The final block of descriptors may be short if the page data
+         * doesn't follow; only insist on the bytes needed. */
+        ssize_t r = pread64(this->fd, buf, bs, block);
+        if ( r < (ssize_t)(offset + nr) )
+            throw memread(pfn * bs, r, offset + nr, r == -1 ? errno : EIO);
+
+        if ( r == (ssize_t)bs )
+        {
+            ScopedLock lock(this->lock);
+            this->descs.insert(block, buf);
+        }
+
+        std::memcpy(dst, buf + offset, nr);
+        dst += nr; foffset += nr; n -= nr;
+    }
+}
+
+void Kdump::read_page(uint64_t pfn, char * dst) const
+{
+    const uint64_t bs = this->layout.block_size;
+    const maddr_t addr = pfn * bs;
+    PageDesc desc;
+
+    if ( ! this->present(pfn) )
+    {
+        LOG_WARN("Frame for 0x%016"PRIx64" not present in kdump core\n", addr);
+        throw memseek(addr, 0);
+    }
+
+    this->read_desc(pfn, desc);
+
+    if ( desc.flags & DUMP_DH_EXCLUDED )
+    {
+        LOG_WARN("Frame for 0x%016"PRIx64" excluded from kdump core\n", addr);
+        throw memseek(addr, 0);
+    }
+
+    if ( desc.size > bs || desc.offset < 0 )
+    {
+        LOG_WARN("Bad kdump page descriptor for 0x%016"PRIx64": offset 0x%"PRIx64
+                 ", size %"PRIu32"\n", addr, desc.offset, desc.size);
+        throw memread(addr, -1, bs, EINVAL);
+    }
+
+    __atomic_add_fetch(&this->nr_decompressed, 1, __ATOMIC_RELAXED);
+
+    const uint32_t compressed = desc.flags & ( DUMP_DH_COMPRESSED_ZLIB |
+                                               DUMP_DH_COMPRESSED_LZO |
+                                               DUMP_DH_COMPRESSED_SNAPPY |
+                                               DUMP_DH_COMPRESSED_ZSTD );
+    if ( ! compressed )
+    {
+        if ( desc.size != bs )
+            throw memread(addr, desc.size, bs, EINVAL);
+        this->read_file(desc.offset, dst, bs, addr);
+        return;
+    }
+
+    char src[FrameCache::FRAME_SIZE];
+    this->read_file(desc.offset, src, desc.size, addr);
+
+    bool ok = false;
+    const char * method = "unknown";
+
+    switch ( compressed )
+    {
+    case DUMP_DH_COMPRESSED_ZLIB:
+    {
+        method = "zlib";
+#ifdef HAVE_ZLIB
+        uLongf len = bs;
+        ok = uncompress((Bytef*)dst, &len, (const Bytef*)src, desc.size) == Z_OK &&
+            len == bs;
+#endif
+        break;
+    }
+
+    case DUMP_DH_COMPRESSED_LZO:
+    {
+        method = "lzo";
+#ifdef HAVE_LZO
+        static bool lzo_initialised = lzo_init() == LZO_E_OK;
+        lzo_uint len = bs;
+        ok = lzo_initialised &&
+            lzo1x_decompress_safe((const unsigned char*)src, desc.size,
+                                  (unsigned char*)dst, &len, NULL) == LZO_E_OK &&
+            len == bs;
+#endif
+        break;
+    }
+
+    case DUMP_DH_COMPRESSED_SNAPPY:
+    {
+        method = "snappy";
+#ifdef HAVE_SNAPPY
+        size_t len = bs;
+        ok = snappy_uncompress(src, desc.size, dst, &len) == SNAPPY_OK && len == bs;
+#endif
+        break;
+    }
+
+    case DUMP_DH_COMPRESSED_ZSTD:
+    {
+        method = "zstd";
+#ifdef HAVE_ZSTD
+        ok = ZSTD_decompress(dst, bs, src, desc.size) == bs;
+#endif
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    if ( ! ok )
+    {
+        LOG_WARN("Failed to decompress %s page for 0x%016"PRIx64" (flags %#"PRIx32
+                 ").  Is %s support compiled in?\n", method, addr, desc.flags, method);
+        throw memread(addr, -1, bs, EIO);
+    }
+}
+
+void Kdump::read_file(uint64_t foffset, char * dst, size_t n, const maddr_t & addr) const
+{
+    size_t total = 0;
+
+    while ( total < n )
+    {
+        ssize_t r = pread64(this->fd, dst + total, n - total, foffset + total);
+
+        if ( r == -1 && errno == EINTR )
+            continue;
+        if ( r <= 0 )
+            throw memread(addr, total ? (ssize_t)total : r, n, r == 0 ? EIO : errno);
+
+        total += r;
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
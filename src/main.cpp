@@ -22,6 +22,9 @@
 #include "util/macros.hpp"
 #include "host.hpp"
 #include "memory.hpp"
+#include "tlb.hpp"
+#include "pte-cache.hpp"
+#include "arch/x86_64/pagetable.hpp"
 #include "system.hpp"
 #include "abstract/elf.hpp"
 #include "abstract/xensyms.hpp"
@@ -78,6 +81,14 @@ const static struct option long_options[] =
 
     // Additional debugging options
     { "dump-structures", no_argument, NULL, 0x101 },
+    { "no-mmap", no_argument, NULL, 0x102 },
+    { "frame-cache", required_argument, NULL, 0x103 },
+    { "no-io-uring", no_argument, NULL, 0x104 },
+    { "save-core", required_argument, NULL, 0x105 },
+    { "save-sparse", no_argument, NULL, 0x106 },
+    { "verify-directmap", no_argument, NULL, 0x107 },
+    { "p2m", no_argument, NULL, 0x108 },
+    { "symtab-cache", required_argument, NULL, 0x109 },
 
     // EoL
     { NULL, 0, NULL, 0 }
@@ -102,6 +113,16 @@ static int workdirfd = 0;
 static FILE * logfd = stderr;
 /// Should we dump the Xen structures ?
 static bool dump_structures = false;
+/// Should we try to mmap() the core file ?
+static bool use_mmap = true;
+/// Size of the frame cache, in kB.
+static unsigned long frame_cache_kb = 4096;
+/// Should we try to use io_uring for batched reads ?
+static bool use_io_uring = true;
+/// Path to save the core file to while analysing it, if any.
+static const char * save_core_path = NULL;
+/// Should zero pages be left as holes in the saved core file ?
+static bool save_sparse = false;
 
 /**
  * Convert a severity value to string
@@ -281,12 +302,17 @@ static void usage(char * argv0, FILE * stream = stdout)
 
     fputs("Files:\n", stream);
     LS_OPT("core", 'c', "Core crash file.  Defaults to /proc/vmcore.");
+    L_OPT("save-core=PATH", "Save the core crash file to PATH while analysing it, "
+          "reading it only once.");
+    L_OPT("save-sparse", "Leave holes for zero pages in the saved core crash file.");
     LS_REQ("xen-symtab", 'x', "Xen Symbol Table file.");
     LS_REQ("dom0-symtab", 'd', "Dom0 Symbol Table file.");
     putc('\n', stream);
 
     fputs("Directories:\n", stream);
     LS_REQ("outdir", 'o', "Directory for output files.");
+    L_OPT("symtab-cache=DIR", "Cache parsed symbol tables in DIR, to load them faster "
+          "next time.");
     putc('\n', stream);
 
     fputs("General:\n", stream);
@@ -298,6 +324,13 @@ static void usage(char * argv0, FILE * stream = stdout)
 
     fputs("Debugging:\n", stream);
     L_OPT("dump-structures", "Hex dump key structures.");
+    L_OPT("no-mmap", "Read the core file with read() rather than mmap().");
+    L_OPT("frame-cache=kB", "Size of the cache for frames not read with mmap().  "
+          "Defaults to 4096.  0 disables.");
+    L_OPT("no-io-uring", "Don't use io_uring for batched reads of the core file.");
+    L_OPT("verify-directmap", "Check Xen direct map translations against the pagetables.");
+    L_OPT("p2m", "Load the M2P and PV P2M tables, to cross check them.  Needs "
+          "4 bytes of memory per frame, and is skipped if memory is short.");
     putc('\n', stream);
 
 #undef L_REQ
@@ -378,6 +411,47 @@ static bool parse_commandline(int argc, char ** argv)
             dump_structures = true;
             break;
 
+        case 0x102: // Don't mmap() the core file
+            use_mmap = false;
+            break;
+
+        case 0x103: // Frame cache size
+        {
+            char * end;
+            errno = 0;
+            frame_cache_kb = strtoul(optarg, &end, 0);
+            if ( errno || end == optarg || *end )
+            {
+                printf("Bad value '%s' for --frame-cache\n", optarg);
+                return false;
+            }
+            break;
+        }
+
+        case 0x104: // Don't use io_uring
+            use_io_uring = false;
+            break;
+
+        case 0x105: // Save the core file
+            save_core_path = optarg;
+            break;
+
+        case 0x106: // Save the core file sparsely
+            save_sparse = true;
+            break;
+
+        case 0x107: // Verify direct map translations
+            x86_64::XenPT::verify_directmap = true;
+            break;
+
+        case 0x108: // Load the M2P and PV P2M tables
+            x86_64::FrameMap::enabled = true;
+            break;
+
+        case 0x109: // Symbol table cache directory
+            SymbolTable::cache_dir = optarg;
+            break;
+
         case 'h': // Help
         default: // Unrecognised
             usage(argv[0]);
@@ -405,6 +479,12 @@ static bool parse_commandline(int argc, char ** argv)
         return false;
     }
 
+    if ( save_sparse && ! save_core_path )
+    {
+        printf("Parameter --save-sparse requires --save-core\n");
+        return false;
+    }
+
     return true;
 }
 
@@ -418,6 +498,7 @@ int main(int argc, char ** argv)
 {
     char * path_buff = NULL;
     Abstract::Elf * elf = NULL;
+    bool save_ok = true;
 
     // Low memory environment - chances of getting std::bad_alloc are high
     try
@@ -579,14 +660,26 @@ int main(int argc, char ** argv)
             return EX_IOERR;
         }
 
-        // Populate the memory regions
-        if ( ! memory.setup(core_path, elf) )
+        /* Populate the memory regions.  Reading through a mapping would
+         * bypass the saved copy, so don't map when saving. */
+        if ( ! memory.setup(core_path, elf, use_mmap && ! save_core_path) )
         {
             LOG_ERROR("Failed to set up memory regions from crash file\n");
             SAFE_DELETE(elf);
             return EX_SOFTWARE;
         }
 
+        // Start saving the core as early as possible
+        if ( save_core_path && ! memory.save_core(save_core_path, save_sparse) )
+            save_ok = false;
+
+        // Size the frame cache.  Failure is not fatal; reads are just slower.
+        memory.set_frame_cache(frame_cache_kb * 1024 / FrameCache::FRAME_SIZE);
+
+        // Likewise io_uring; batched reads fall back to pread()
+        if ( use_io_uring )
+            memory.enable_io_uring(64);
+
         // Set up the host structures
         if ( ! host.setup(elf) )
         {
@@ -609,6 +702,14 @@ int main(int argc, char ** argv)
             int s = host.print_domains(dump_structures);
             LOG_DEBUG("Successfully printed %d domains\n", s);
         }
+
+        memory.log_statistics();
+        TLB::log_statistics();
+        pte_cache.log_statistics();
+        x86_64::FrameMap::log_statistics();
+
+        if ( save_core_path && ! memory.finish_save_core() )
+            save_ok = false;
     }
     catch ( const std::bad_alloc & )
     {
@@ -624,7 +725,7 @@ int main(int argc, char ** argv)
 
     LOG_INFO("COMPLETE\n");
     SAFE_FCLOSE(logfd);
-    return EX_OK;
+    return save_ok ? EX_OK : EX_IOERR;
 }
 
 /*
@@ -19,7 +19,9 @@
  */
 
 #include "memory.hpp"
+#include "kdump.hpp"
 #include "util/log.hpp"
+#include "util/macros.hpp"
 
 #ifndef _LARGEFILE64_SOURCE
 #define _LARGEFILE64_SOURCE
@@ -27,11 +29,16 @@
 
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include <cstring>
 #include <algorithm>
+#include <new>
 
 /**
  * @file src/memory.cpp
@@ -41,33 +48,113 @@
 /// Buffer size for intermediate operations on larger blocks
 static const ssize_t BUFFER_SIZE = 8192;
 
+/// Smallest block for which a kernel-side copy to the output file is tried.
+static const ssize_t ZERO_COPY_MIN = 16384;
+
+/// Largest gap between two reads in a batch which will be read through.
+static const uint64_t BATCH_MAX_GAP = 4096;
+/// Largest single read a batch will be coalesced into.
+static const uint64_t BATCH_MAX_RUN = 65536;
+
+/// Piece of a batched read, within a single memory region.
+struct BatchPiece
+{
+    /// Machine address.
+    maddr_t addr;
+    /// Destination buffer.
+    char * dst;
+    /// Number of bytes.
+    size_t len;
+    /// Memory region containing the piece.
+    const MemRegion * region;
+};
+
+/// Coalesced run of batch pieces, read with a single read.
+struct BatchRun
+{
+    /// Index of the first piece.
+    size_t first;
+    /// Index after the last piece.
+    size_t last;
+    /// Machine address of the start of the run.
+    maddr_t start;
+    /// Machine address of the end of the run (exclusive).
+    maddr_t end;
+    /// Whether the run is a single frame to insert into the frame cache.
+    bool cache;
+    /// Offset of the run in the scratch buffer, if used.
+    size_t scratch;
+    /// Destination of the read.
+    char * dst;
+};
+
+/**
+ * Order batch pieces by their offset in the CORE file.
+ * @param lhs Left hand side.
+ * @param rhs Right hand side.
+ * @returns boolean.
+ */
+static bool piece_offset_cmp(const BatchPiece & lhs, const BatchPiece & rhs)
+{
+    return ( lhs.addr - lhs.region->start + lhs.region->offset ) <
+        ( rhs.addr - rhs.region->start + rhs.region->offset );
+}
+
+void ReadBatch::add(const uint64_t & addr, void * dst, size_t len)
+{
+    Request r = { addr, (char*)dst, len };
+    this->requests.push_back(r);
+}
+
 MemRegion::MemRegion():
-    start(0), length(0), offset(0)
+    start(0), length(0), offset(0), map(NULL)
 {}
 
 MemRegion::MemRegion(const ElfProgHdr & hdr):
-    start(hdr.phys), length(hdr.size), offset(hdr.offset)
+    start(hdr.phys), length(hdr.size), offset(hdr.offset), map(NULL)
 {}
 
 MemRegion::MemRegion(const MemRegion & rhs):
-    start(rhs.start), length(rhs.length), offset(rhs.offset)
+    start(rhs.start), length(rhs.length), offset(rhs.offset), map(rhs.map)
 {}
 
 bool MemRegion::operator < (const MemRegion & rhs) const
 {
-    return this->start < rhs.start;
+    // Longest first for the same start, so it wins any overlap
+    return this->start < rhs.start ||
+        ( this->start == rhs.start && this->length > rhs.length );
 }
 
 
 
 Memory::Memory():
-    regions(), finalised(false), fd(-1)
+    regions(), finalised(false), fd(-1), cache(), cache_lock(),
+    last_hit(0), last_hole(0), ring(), ring_lock(),
+    nr_batched_reads(0), nr_ring_reads(0), nr_prefetched(0), copy_method(COPY_FILE_RANGE),
+    kdump(NULL), copy()
 {}
 
 Memory::~Memory()
 {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    // The copy thread reads from this->fd, so must finish first
+    this->copy.finish();
+
+    for ( std::vector<MemRegion>::const_iterator it = this->regions.begin();
+          it != this->regions.end(); ++it )
+        if ( it->map )
+        {
+            // Undo the alignment performed in map_region()
+            uint64_t delta = it->offset & (page_size - 1);
+            if ( -1 == munmap((void*)(it->map - delta), it->length + delta) )
+                LOG_ERROR("munmap() failed: %s\n", strerror(errno));
+        }
+
     this -> regions . clear ( ) ;
 
+    SAFE_DELETE(this->kdump);
+
     if ( this -> fd >= 0 )
     {
         if ( -1 == close( this -> fd ) )
@@ -76,14 +163,34 @@ Memory::~Memory()
     }
 }
 
-bool Memory::setup(const char * path, const Abstract::Elf * elf)
+bool Memory::setup(const char * path, const Abstract::Elf * elf, bool use_mmap)
 {
+    struct stat st;
+    int nr_mapped = 0;
+
     if ( (this->fd = open(path, O_RDONLY, NULL)) == -1)
     {
         LOG_ERROR("open() failed: %s\n", strerror(errno));
         return false;
     }
 
+    // kdump-compressed cores have no regions; all reads are decompressed
+    const KdumpLayout * layout = elf->kdump_layout();
+    if ( layout )
+    {
+        try
+        {
+            this->kdump = new Kdump();
+        }
+        catch ( const std::bad_alloc & )
+        {
+            LOG_ERROR("Bad Alloc exception.  Out of memory\n");
+            return false;
+        }
+
+        return this->kdump->setup(this->fd, *layout);
+    }
+
     this->regions.reserve(elf->nr_phdrs-1);
 
     for ( int x = 0; x < elf->nr_phdrs; ++x )
@@ -91,22 +198,139 @@ bool Memory::setup(const char * path, const Abstract::Elf * elf)
             this->regions.push_back(elf->phdrs[x]);
 
     std::sort(this->regions.begin(), this->regions.end());
+    this->coalesce_regions();
+
+    if ( ! use_mmap )
+        return true;
+
+    /* Only a regular file (which /proc/vmcore claims to be) of known size can
+     * be safely mapped.  Accessing a mapping beyond the end of the file raises
+     * SIGBUS rather than a read error. */
+    if ( -1 == fstat(this->fd, &st) )
+    {
+        LOG_WARN("fstat() failed: %s.  Not mapping core file\n", strerror(errno));
+        return true;
+    }
+
+    if ( ! S_ISREG(st.st_mode) )
+    {
+        LOG_DEBUG("Core file is not a regular file.  Not mapping\n");
+        return true;
+    }
+
+    for ( std::vector<MemRegion>::iterator it = this->regions.begin();
+          it != this->regions.end(); ++it )
+        if ( this->map_region(*it, st.st_size) )
+            ++nr_mapped;
+
+    LOG_DEBUG("Mapped %d of %zu memory regions from the core file\n",
+              nr_mapped, this->regions.size());
 
     return true;
 }
 
+void Memory::coalesce_regions()
+{
+    std::vector<MemRegion> merged;
+    merged.reserve(this->regions.size());
+
+    for ( std::vector<MemRegion>::const_iterator it = this->regions.begin();
+          it != this->regions.end(); ++it )
+    {
+        MemRegion region(*it);
+
+        if ( region.length == 0 )
+            continue;
+
+        if ( merged.size() )
+        {
+            MemRegion & prev = merged.back();
+            const maddr_t prev_end = prev.start + prev.length;
+
+            /* Lookups rely on the regions being disjoint.  Where regions
+             * overlap, the one starting first keeps the overlap, and the
+             * rest of the later one is kept, if there is any. */
+            if ( region.start < prev_end )
+            {
+                LOG_WARN("Memory region 0x%016"PRIx64"-0x%016"PRIx64" overlaps "
+                         "0x%016"PRIx64"-0x%016"PRIx64"\n",
+                         region.start, region.start + region.length,
+                         prev.start, prev_end);
+
+                if ( region.start + region.length <= prev_end )
+                    continue;
+
+                const uint64_t overlap = prev_end - region.start;
+
+                region.start += overlap;
+                region.offset += overlap;
+                region.length -= overlap;
+            }
+
+            // Contiguous in both machine memory and the file
+            if ( region.start == prev_end &&
+                 region.offset == prev.offset + prev.length )
+            {
+                prev.length += region.length;
+                continue;
+            }
+        }
+
+        merged.push_back(region);
+    }
+
+    LOG_DEBUG("Coalesced %zu memory regions into %zu\n",
+              this->regions.size(), merged.size());
+
+    this->regions.swap(merged);
+    this->last_hit = this->last_hole = 0;
+}
+
+bool Memory::map_region(MemRegion & region, uint64_t file_size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    void * ptr;
+
+    if ( region.length == 0 || region.offset + region.length > file_size )
+        return false;
+
+    // mmap() requires a page aligned file offset
+    uint64_t delta = region.offset & (page_size - 1);
+
+    if ( region.length + delta > (size_t)-1 )
+        return false;
+
+    ptr = mmap(NULL, region.length + delta, PROT_READ, MAP_PRIVATE,
+               this->fd, region.offset - delta);
+
+    if ( ptr == MAP_FAILED )
+    {
+        LOG_DEBUG("Failed to mmap() region 0x%016"PRIx64"-0x%016"PRIx64": %s\n",
+                  region.start, region.start + region.length, strerror(errno));
+        return false;
+    }
+
+    region.map = (const char *)ptr + delta;
+    return true;
+}
+
+const char * Memory::map_view(const maddr_t & addr, size_t n) const
+{
+    const MemRegion * region = this->lookup_region(addr);
+
+    if ( region && region->map && n <= region->length - (addr - region->start) )
+        return region->map + (addr - region->start);
+    return NULL;
+}
+
 ssize_t Memory::read_str(const maddr_t & addr, char * dst, ssize_t n) const
 {
     if ( ! n )
         return 0;
     dst[0] = 0;
 
-    this->seek(addr);
-
-    ssize_t num_read = read(this->fd, dst, n-1);
+    this->read_raw(addr, dst, n-1);
     dst[n] = 0;
-    if ( num_read == -1 || num_read != n-1)
-        throw memread(addr, num_read, n-1, errno);
     return strlen(dst);
 }
 
@@ -117,34 +341,15 @@ ssize_t Memory::read_str_vaddr(const PageTable & pt, const vaddr_t & vaddr, char
     pt.walk(vaddr, maddr, &end);
     if ( vaddr + n - 1 <= end )
         return this->read_str(maddr, dst, n);
-    else
-    {
-        LOG_DEBUG("Correcting for passing page boundary (vaddr %016"PRIx64", maddr %016"PRIx64
-                  ", end %016"PRIx64", n %zd)\n", vaddr, maddr, end, n);
-        vaddr_t addr = vaddr;
-        ssize_t index = 0;
-        do
-        {
-            ssize_t nr = std::min(n, (ssize_t)(end-addr+1));
-            LOG_DEBUG("Subread (vaddr %016"PRIx64", maddr %016"PRIx64", end %016"PRIx64
-                      ", index %zd, nr %zd, n %zd)\n", addr, maddr, end, index, nr, n);
-            this->read_block(maddr, &dst[index], nr);
-            index += nr;
-            addr = end+1;
-            pt.walk(addr, maddr, &end);
-            n -= nr;
-        } while ( n );
-        dst[index] = 0;
-        return strlen(dst);
-    }
+
+    this->read_block_vaddr(pt, vaddr, dst, n);
+    dst[n] = 0;
+    return strlen(dst);
 }
 
 void Memory::read8(const maddr_t & addr, uint8_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 1);
-    if ( r == -1 || 1 != r )
-        throw memread(addr, r, 1, errno);
+    this->read_raw(addr, (char*)&dst, 1);
 }
 
 void Memory::read8_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint8_t & dst) const
@@ -157,10 +362,7 @@ void Memory::read8_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint8_t &
 
 void Memory::read16(const maddr_t & addr, uint16_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 2);
-    if ( r == -1 || 2 != r )
-        throw memread(addr, r, 2, errno);
+    this->read_raw(addr, (char*)&dst, 2);
 }
 
 void Memory::read16_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint16_t & dst) const
@@ -170,10 +372,7 @@ void Memory::read16_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint16_t
 
 void Memory::read32(const maddr_t & addr, uint32_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 4);
-    if ( r == -1 || 4 != r )
-        throw memread(addr, r, 4, errno);
+    this->read_raw(addr, (char*)&dst, 4);
 }
 
 void Memory::read32_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint32_t & dst) const
@@ -183,10 +382,7 @@ void Memory::read32_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint32_t
 
 void Memory::read64(const maddr_t & addr, uint64_t & dst) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, &dst, 8);
-    if ( r == -1 || 8 != r )
-        throw memread(addr, r, 8, errno);
+    this->read_raw(addr, (char*)&dst, 8);
 }
 
 void Memory::read64_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint64_t & dst) const
@@ -196,10 +392,7 @@ void Memory::read64_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint64_t
 
 void Memory::read_block(const maddr_t & addr, char * dst, ssize_t n) const
 {
-    this->seek(addr);
-    ssize_t r = read(this->fd, dst, n);
-    if ( r == -1 || r != n )
-        throw memread(addr, r, n, errno);
+    this->read_raw(addr, dst, n);
 }
 
 void Memory::read_block_vaddr(const PageTable & pt, const vaddr_t & vaddr, char * dst, ssize_t n) const
@@ -208,25 +401,352 @@ void Memory::read_block_vaddr(const PageTable & pt, const vaddr_t & vaddr, char
     vaddr_t end;
     pt.walk(vaddr, maddr, &end);
     if ( vaddr + n - 1 <= end )
+    {
         this->read_block(maddr, dst, n);
-    else
-    {
-        LOG_DEBUG("Correcting for passing page boundary (vaddr %016"PRIx64", maddr %016"PRIx64
-                  ", end %016"PRIx64", n %zd)\n", vaddr, maddr, end, n);
-        vaddr_t addr = vaddr;
-        ssize_t index = 0;
-        do
-        {
-            ssize_t nr = std::min(n, (ssize_t)(end-addr+1));
-            LOG_DEBUG("Subread (vaddr %016"PRIx64", maddr %016"PRIx64", end %016"PRIx64
-                      ", index %zd, nr %zd, n %zd)\n", addr, maddr, end, index, nr, n);
-            this->read_block(maddr, &dst[index], nr);
-            index += nr;
-            addr = end+1;
-            pt.walk(addr, maddr, &end);
-            n -= nr;
-        } while ( n );
+        return;
+    }
+
+    std::vector<PhysExtent> extents;
+    pt.translate(vaddr, n, extents);
+
+    for ( std::vector<PhysExtent>::const_iterator it = extents.begin();
+          it != extents.end(); ++it )
+    {
+        char * edst = dst + (it->vaddr - vaddr);
+        maddr_t addr = it->maddr;
+        size_t len = it->len;
+
+        LOG_DEBUG("Subread (vaddr %016"PRIx64", maddr %016"PRIx64", len %zu)\n",
+                  it->vaddr, it->maddr, it->len);
+
+        while ( len )
+        {
+            size_t nr = this->region_span(addr, len);
+            this->read_block(addr, edst, nr);
+            edst += nr; addr += nr; len -= nr;
+        }
+    }
+}
+
+bool Memory::try_read_block(const maddr_t & addr, char * dst, ssize_t n,
+                            ReadFault * fault) const
+{
+    if ( fault )
+    {
+        fault->seek = true;
+        fault->count = 0;
+        fault->error = 0;
+    }
+
+    // Rule out the common failures without an exception
+    if ( this->kdump ? ! this->kdump->contains(addr, n) : ! this->lookup_region(addr) )
+        return false;
+
+    try
+    {
+        this->read_raw(addr, dst, n);
+        return true;
+    }
+    catch ( const memread & e )
+    {
+        if ( fault )
+        {
+            fault->seek = false;
+            fault->count = e.count;
+            fault->error = e.error;
+        }
+        return false;
+    }
+    catch ( const CommonError & )
+    {
+        return false;
+    }
+}
+
+bool Memory::try_read64(const maddr_t & addr, uint64_t & dst, ReadFault * fault) const
+{
+    return this->try_read_block(addr, (char*)&dst, 8, fault);
+}
+
+bool Memory::try_read_block_vaddr(const PageTable & pt, const vaddr_t & vaddr, char * dst, ssize_t n) const
+{
+    vaddr_t addr = vaddr, end;
+    maddr_t maddr;
+
+    while ( n > 0 )
+    {
+        if ( ! pt.try_walk(addr, maddr, &end) )
+            return false;
+
+        ssize_t nr = (end - addr) < (vaddr_t)n ? (ssize_t)(end - addr + 1) : n;
+
+        while ( nr )
+        {
+            ssize_t span = this->region_span(maddr, nr);
+
+            if ( ! this->try_read_block(maddr, dst, span) )
+                return false;
+            dst += span; maddr += span; addr += span;
+            nr -= span; n -= span;
+        }
+    }
+    return true;
+}
+
+bool Memory::try_read8_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint8_t & dst) const
+{
+    return this->try_read_block_vaddr(pt, vaddr, (char*)&dst, 1);
+}
+
+bool Memory::try_read16_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint16_t & dst) const
+{
+    return this->try_read_block_vaddr(pt, vaddr, (char*)&dst, 2);
+}
+
+bool Memory::try_read32_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint32_t & dst) const
+{
+    return this->try_read_block_vaddr(pt, vaddr, (char*)&dst, 4);
+}
+
+bool Memory::try_read64_vaddr(const PageTable & pt, const vaddr_t & vaddr, uint64_t & dst) const
+{
+    return this->try_read_block_vaddr(pt, vaddr, (char*)&dst, 8);
+}
+
+void Memory::read_batch(const ReadBatch & batch) const
+{
+    if ( this->kdump )
+    {
+        for ( std::vector<ReadBatch::Request>::const_iterator it = batch.requests.begin();
+              it != batch.requests.end(); ++it )
+            this->kdump->read(it->addr, it->dst, it->len);
+        return;
+    }
+
+    std::vector<BatchPiece> pieces;
+    pieces.reserve(batch.requests.size());
+
+    for ( std::vector<ReadBatch::Request>::const_iterator it = batch.requests.begin();
+          it != batch.requests.end(); ++it )
+    {
+        if ( ! it->len )
+            continue;
+
+        const MemRegion & region = this->find_region(it->addr);
+
+        /* Reads running off the end of their region read on contiguously
+         * from the file, which can't be coalesced sensibly. */
+        if ( it->len > region.length - (it->addr - region.start) )
+        {
+            this->read_raw(it->addr, it->dst, it->len);
+            continue;
+        }
+
+        BatchPiece p = { it->addr, it->dst, it->len, &region };
+        pieces.push_back(p);
+    }
+
+    std::sort(pieces.begin(), pieces.end(), piece_offset_cmp);
+
+    static const maddr_t mask = ~(maddr_t)(FrameCache::FRAME_SIZE - 1);
+    std::vector<BatchRun> runs;
+    size_t scratch_size = 0, first = 0;
+
+    while ( first < pieces.size() )
+    {
+        const MemRegion * region = pieces[first].region;
+        BatchRun run = { first, first + 1, pieces[first].addr,
+                         pieces[first].addr + pieces[first].len, false, 0, NULL };
+
+        // Extend the run while the next piece is close and in the same region
+        while ( run.last < pieces.size() && pieces[run.last].region == region &&
+                pieces[run.last].addr <= run.end + BATCH_MAX_GAP &&
+                std::max(run.end, pieces[run.last].addr + pieces[run.last].len)
+                - run.start <= BATCH_MAX_RUN )
+        {
+            run.end = std::max(run.end, pieces[run.last].addr + pieces[run.last].len);
+            ++run.last;
+        }
+        first = run.last;
+
+        if ( region->map )
+        {
+            for ( size_t x = run.first; x < run.last; ++x )
+                std::memcpy(pieces[x].dst, region->map + (pieces[x].addr - region->start),
+                            pieces[x].len);
+            continue;
+        }
+
+        /* Runs inside a single cacheable frame are served from the frame
+         * cache, or read as a whole frame and inserted afterwards. */
+        maddr_t frame = run.start & mask;
+        if ( this->cache.enabled() && ((run.end - 1) & mask) == frame &&
+             frame >= region->start &&
+             frame + FrameCache::FRAME_SIZE <= region->start + region->length )
+        {
+            ScopedLock lock(this->cache_lock);
+            const char * src = this->cache.lookup(frame);
+
+            if ( src )
+            {
+                for ( size_t x = run.first; x < run.last; ++x )
+                    std::memcpy(pieces[x].dst, src + (pieces[x].addr - frame),
+                                pieces[x].len);
+                continue;
+            }
+
+            run.start = frame;
+            run.end = frame + FrameCache::FRAME_SIZE;
+            run.cache = true;
+        }
+
+        if ( run.cache || run.last - run.first > 1 )
+        {
+            run.scratch = scratch_size;
+            scratch_size += run.end - run.start;
+        }
+        else
+            run.dst = pieces[run.first].dst;
+
+        runs.push_back(run);
+    }
+
+    if ( runs.empty() )
+        return;
+
+    std::vector<char> scratch(scratch_size);
+    std::vector<IoUring::Read> reads(runs.size());
+
+    for ( size_t r = 0; r < runs.size(); ++r )
+    {
+        if ( ! runs[r].dst )
+            runs[r].dst = &scratch[runs[r].scratch];
+
+        reads[r].offset = this->file_offset(runs[r].start);
+        reads[r].dst = runs[r].dst;
+        reads[r].len = runs[r].end - runs[r].start;
+        reads[r].result = 0;
+        reads[r].addr = runs[r].start;
+    }
+
+    this->read_many(&reads[0], reads.size());
+
+    for ( size_t r = 0; r < runs.size(); ++r )
+    {
+        const BatchRun & run = runs[r];
+
+        if ( run.cache )
+        {
+            ScopedLock lock(this->cache_lock);
+            this->cache.insert(run.start, run.dst);
+        }
+
+        if ( run.dst != pieces[run.first].dst )
+            for ( size_t x = run.first; x < run.last; ++x )
+                std::memcpy(pieces[x].dst, run.dst + (pieces[x].addr - run.start),
+                            pieces[x].len);
+    }
+}
+
+void Memory::read_many(IoUring::Read * reads, size_t nr) const
+{
+    __atomic_add_fetch(&this->nr_batched_reads, nr, __ATOMIC_RELAXED);
+
+    for ( size_t x = 0; x < nr; ++x )
+        reads[x].result = 0;
+
+    if ( nr > 1 && this->ring.enabled() )
+    {
+        /* Reads of the part of the core already saved are served from the
+         * copy by read_at(); only those ahead of it go through the ring. */
+        std::vector<IoUring::Read> ahead;
+        std::vector<size_t> index;
+
+        for ( size_t x = 0; x < nr; ++x )
+            if ( this->copy.fd_for(reads[x].offset, reads[x].len) < 0 )
+            {
+                ahead.push_back(reads[x]);
+                index.push_back(x);
+            }
+
+        bool used_ring = false;
+        if ( ahead.size() > 1 )
+        {
+            ScopedLock lock(this->ring_lock);
+            used_ring = this->ring.read_many(&ahead[0], ahead.size());
+        }
+
+        if ( used_ring )
+        {
+            __atomic_add_fetch(&this->nr_ring_reads, ahead.size(), __ATOMIC_RELAXED);
+
+            // Failures are retried synchronously to get a sensible errno
+            for ( size_t x = 0; x < ahead.size(); ++x )
+                reads[index[x]].result = std::max(ahead[x].result, (ssize_t)0);
+        }
+    }
+
+    for ( size_t x = 0; x < nr; ++x )
+    {
+        IoUring::Read & rd = reads[x];
+
+        // Complete short (or not yet performed) reads synchronously
+        if ( (size_t)rd.result < rd.len )
+        {
+            ssize_t r = this->read_at(rd.offset + rd.result, rd.dst + rd.result,
+                                      rd.len - rd.result);
+            if ( r != (ssize_t)(rd.len - rd.result) )
+                throw memread(rd.addr + rd.result, r, rd.len - rd.result, errno);
+        }
+    }
+}
+
+bool Memory::save_core(const char * path, bool sparse)
+{
+    return this->copy.start(this->fd, path, sparse);
+}
+
+bool Memory::finish_save_core()
+{
+    return this->copy.finish();
+}
+
+bool Memory::enable_io_uring(unsigned depth)
+{
+    ScopedLock lock(this->ring_lock);
+
+    return this->ring.setup(this->fd, depth);
+}
+
+void Memory::read_batch_vaddr(const PageTable & pt, const ReadBatch & batch) const
+{
+    ReadBatch mbatch;
+    std::vector<PhysExtent> extents;
+    mbatch.requests.reserve(batch.requests.size());
+
+    for ( std::vector<ReadBatch::Request>::const_iterator it = batch.requests.begin();
+          it != batch.requests.end(); ++it )
+    {
+        pt.translate(it->addr, it->len, extents);
+
+        // Split requests where they are discontiguous in the CORE file
+        for ( std::vector<PhysExtent>::const_iterator e = extents.begin();
+              e != extents.end(); ++e )
+        {
+            char * dst = it->dst + (e->vaddr - it->addr);
+            maddr_t addr = e->maddr;
+            size_t len = e->len;
+
+            while ( len )
+            {
+                size_t nr = this->region_span(addr, len);
+                mbatch.add(addr, dst, nr);
+                dst += nr; addr += nr; len -= nr;
+            }
+        }
     }
+
+    this->read_batch(mbatch);
 }
 
 ssize_t Memory::write_block_to_file(const maddr_t & addr, FILE * file, ssize_t n) const
@@ -236,95 +756,521 @@ ssize_t Memory::write_block_to_file(const maddr_t & addr, FILE * file, ssize_t n
     if ( ! n )
         return 0;
 
-    this->seek(addr);
-
-    char * tmp = new char[BUFFER_SIZE];
+    maddr_t cur = addr;
+    char tmp[BUFFER_SIZE];
 
-    while ( n > BUFFER_SIZE )
+    // Compressed pages can only be written out after decompressing
+    if ( this->kdump )
     {
-        num_read = read(this->fd, tmp, BUFFER_SIZE);
-        if ( num_read == -1 || num_read != BUFFER_SIZE )
+        while ( n )
         {
-            delete [] tmp;
-            throw memread(addr, num_read, BUFFER_SIZE, errno);
+            ssize_t chunk = std::min(n, BUFFER_SIZE);
+
+            this->kdump->read(cur, tmp, chunk);
+
+            num_wrote = fwrite(tmp, 1, chunk, file);
+            n -= num_wrote; total_written += num_wrote; cur += num_wrote;
+
+            if ( num_wrote != chunk )
+                break;
         }
+        return total_written;
+    }
+
+    // Large blocks are copied by the kernel where possible
+    if ( n >= ZERO_COPY_MIN )
+    {
+        total_written = this->copy_to_file(addr, file, n);
+        if ( total_written == n )
+            return total_written;
+        n -= total_written;
+    }
+
+    cur += total_written;
+
+    // If the block is mapped, write it straight out of the mapping
+    const char * src = this->map_view(cur, n);
+    if ( src )
+        return total_written + fwrite(src, 1, n, file);
+
+    off64_t foffset = this->file_offset(cur);
+
+    while ( n )
+    {
+        ssize_t chunk = std::min(n, BUFFER_SIZE);
+
+        num_read = this->read_at(foffset, tmp, chunk);
+        if ( num_read != chunk )
+            throw memread(cur, num_read, chunk, errno);
 
         num_wrote = fwrite(tmp, 1, num_read, file);
         n -= num_wrote; total_written += num_wrote;
+        foffset += num_wrote; cur += num_wrote;
+
+        if ( num_wrote != num_read )
+            break;
+    }
+
+    return total_written;
+}
 
-        if ( num_read != BUFFER_SIZE || num_wrote != num_read )
+ssize_t Memory::copy_to_file(const maddr_t & addr, FILE * file, ssize_t n) const
+{
+    const MemRegion & region = this->find_region(addr);
+    int method = __atomic_load_n(&this->copy_method, __ATOMIC_RELAXED);
+    ssize_t done = 0;
+
+    // Only copy from within a single region of the core file
+    if ( method == COPY_NONE || (uint64_t)n > region.length - (addr - region.start) )
+        return 0;
+
+    // Anything buffered in the stream must reach the file first
+    if ( fflush(file) )
+        return 0;
+
+    int out = fileno(file);
+    off64_t in_off = this->file_offset(addr);
+
+    // Copy from the saved core if it has got this far
+    int in = this->copy.fd_for(in_off, n);
+    if ( in < 0 )
+        in = this->fd;
+
+    while ( done < n && method != COPY_NONE )
+    {
+        ssize_t r;
+
+        if ( method == COPY_FILE_RANGE )
         {
-            delete [] tmp;
-            return total_written;
+#ifdef __NR_copy_file_range
+            loff_t off = in_off;
+            r = syscall(__NR_copy_file_range, in, &off, out, NULL,
+                        (size_t)(n - done), 0);
+#else
+            r = -1; errno = ENOSYS;
+#endif
         }
+        else
+        {
+            off_t off = in_off;
+            r = sendfile(out, in, &off, n - done);
+        }
+
+        if ( r > 0 )
+        {
+            done += r;
+            in_off += r;
+            continue;
+        }
+
+        if ( r == -1 && errno == EINTR )
+            continue;
+
+        /* This method isn't supported between these files.  Try the next,
+         * and don't bother with this one again. */
+        if ( r == -1 && ( errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                          errno == EOPNOTSUPP || errno == ENOTSUP ) )
+        {
+            LOG_DEBUG("%s unusable for core file: %s\n",
+                      method == COPY_FILE_RANGE ? "copy_file_range()" : "sendfile()",
+                      strerror(errno));
+            __atomic_store_n(&this->copy_method, ++method, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // Other errors or EOF; let the caller fall back for the remainder
+        break;
     }
 
-    num_read = read(this->fd, tmp, n);
-    if ( num_read == -1 || num_read != n )
+    /* The stream caches its file position, which is now stale.  Resync it
+     * with an absolute seek. */
+    if ( done )
     {
-        delete [] tmp;
-        throw memread(addr, num_read, n, errno);
+        off64_t pos = lseek64(out, 0, SEEK_CUR);
+        if ( pos == (off64_t)-1 || fseeko64(file, pos, SEEK_SET) )
+            LOG_WARN("Failed to resync output stream position: %s\n", strerror(errno));
     }
 
-    num_wrote = fwrite(tmp, 1, num_read, file);
-    n -= num_wrote; total_written += num_wrote;
-
-    delete [] tmp;
-    return total_written;
+    return done;
 }
 
 ssize_t Memory::write_block_vaddr_to_file(const PageTable & pt, const vaddr_t & vaddr, FILE * file, ssize_t n) const
 {
-    maddr_t maddr;
-    vaddr_t end;
-    pt.walk(vaddr, maddr, &end);
-    if ( vaddr + n - 1 <= end )
-        return this->write_block_to_file(maddr, file, n);
-    else
-    {
-        LOG_DEBUG("Correcting for passing page boundary (vaddr %016"PRIx64", maddr %016"PRIx64
-                  ", end %016"PRIx64", n %zd)\n", vaddr, maddr, end, n);
-        vaddr_t addr = vaddr;
-        ssize_t index = 0;
-        do
-        {
-            ssize_t nr = std::min(n, (ssize_t)(end-addr+1));
-            LOG_DEBUG("Subwrite (vaddr %016"PRIx64", maddr %016"PRIx64", end %016"PRIx64
-                      ", index %zd, nr %zd, n %zd)\n", addr, maddr, end, index, nr, n);
-            ssize_t w = this->write_block_to_file(maddr, file, nr);
+    std::vector<PhysExtent> extents;
+
+    try
+    {
+        pt.translate(vaddr, n, extents);
+    }
+    catch ( const CommonError & )
+    {
+        // Write out everything up to the fault, then report it
+        this->write_extents_to_file(extents, file);
+        throw;
+    }
+
+    return this->write_extents_to_file(extents, file);
+}
+
+ssize_t Memory::write_extents_to_file(const std::vector<PhysExtent> & extents, FILE * file) const
+{
+    ssize_t index = 0;
+
+    for ( std::vector<PhysExtent>::const_iterator it = extents.begin();
+          it != extents.end(); ++it )
+    {
+        maddr_t addr = it->maddr;
+        size_t len = it->len;
+
+        LOG_DEBUG("Subwrite (vaddr %016"PRIx64", maddr %016"PRIx64", len %zu)\n",
+                  it->vaddr, it->maddr, it->len);
+
+        while ( len )
+        {
+            ssize_t nr = this->region_span(addr, len);
+            ssize_t w = this->write_block_to_file(addr, file, nr);
+
             index += w;
             if ( w != nr )
-                return index + w;
-            addr = end+1;
+                return index;
+            addr += nr; len -= nr;
+        }
+    }
+
+    return index;
+}
+
+bool Memory::set_frame_cache(size_t nr_frames)
+{
+    // Cache decompressed pages instead, which are far more costly to read
+    if ( this->kdump )
+    {
+        LOG_DEBUG("kdump page cache of %zu frames (%zu kB)\n", nr_frames,
+                  nr_frames * FrameCache::FRAME_SIZE / 1024);
+        return this->kdump->resize_cache(nr_frames);
+    }
+
+    ScopedLock lock(this->cache_lock);
+
+    if ( ! this->cache.resize(nr_frames) )
+        return false;
+
+    LOG_DEBUG("Frame cache of %zu frames (%zu kB)\n", nr_frames,
+              nr_frames * FrameCache::FRAME_SIZE / 1024);
+    return true;
+}
+
+void Memory::log_statistics() const
+{
+    if ( this->nr_batched_reads )
+        LOG_DEBUG("Batched reads: %"PRIu64", of which %"PRIu64" through io_uring\n",
+                  this->nr_batched_reads, this->nr_ring_reads);
+    if ( this->nr_prefetched )
+        LOG_DEBUG("Readahead hints: %"PRIu64" kB\n", this->nr_prefetched >> 10);
+    if ( this->cache.enabled() )
+        LOG_DEBUG("Frame cache: %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" evictions\n",
+                  this->cache.hits, this->cache.misses, this->cache.evictions);
+    if ( this->kdump )
+        this->kdump->log_statistics();
+}
+
+void Memory::prefetch(const maddr_t & addr, size_t n) const
+{
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    const maddr_t end = addr + n;
+    maddr_t cur = addr;
+
+    // Pages of a kdump-compressed core can't be located without reading
+    if ( this->kdump || ! n )
+        return;
+
+    while ( cur < end )
+    {
+        // Find the region containing cur, or the next one above it
+        size_t idx = std::upper_bound(this->regions.begin(), this->regions.end(),
+                                      cur, region_start_cmp) - this->regions.begin();
+        if ( idx == 0 || cur - this->regions[idx - 1].start >= this->regions[idx - 1].length )
+        {
+            if ( idx == this->regions.size() || this->regions[idx].start >= end )
+                return;
+            cur = this->regions[idx].start;
+        }
+        else
+            --idx;
+
+        const MemRegion & region = this->regions[idx];
+        uint64_t len = std::min(end, region.start + region.length) - cur;
+
+        if ( region.map )
+        {
+            uintptr_t start = (uintptr_t)(region.map + (cur - region.start));
+            uintptr_t delta = start & (page_size - 1);
+
+            madvise((void*)(start - delta), len + delta, MADV_WILLNEED);
+        }
+        else
+        {
+            off64_t offset = this->file_offset(cur);
+
+            // Already in the saved copy, so not worth reading the source for
+            if ( this->copy.fd_for(offset, len) < 0 )
+                posix_fadvise64(this->fd, offset, len, POSIX_FADV_WILLNEED);
+        }
+
+        __atomic_add_fetch(&this->nr_prefetched, len, __ATOMIC_RELAXED);
+        cur += len;
+    }
+}
+
+void Memory::prefetch_vaddr(const PageTable & pt, const vaddr_t & vaddr, size_t n) const
+{
+    const vaddr_t last = vaddr + n - 1;
+    vaddr_t addr = vaddr;
+    maddr_t run_start = 0;
+    size_t run_len = 0;
+
+    if ( ! n || this->kdump )
+        return;
+
+    // Coalesce machine-contiguous pages, so hints are as large as possible
+    while ( true )
+    {
+        maddr_t maddr = 0;
+        vaddr_t end;
+        bool mapped = false;
+
+        try
+        {
             pt.walk(addr, maddr, &end);
-            n -= nr;
-        } while ( n );
-        return index;
+            mapped = true;
+        }
+        catch ( const pagefault & e )
+        {
+            if ( e.reason == pagefault::FAULT_INVALID || e.level < 1 || e.level > 4 )
+                break;
+
+            // Skip the whole of whatever the missing entry would have mapped
+            vaddr_t size = 1ULL << (12 + 9 * (e.level - 1));
+            end = addr | (size - 1);
+        }
+        catch ( const CommonError & )
+        {
+            // Pagetable frame missing from the core
+            end = addr | 0xfff;
+        }
+
+        if ( end > last || end < addr )
+            end = last;
+        size_t len = end - addr + 1;
+
+        if ( run_len && ( ! mapped || maddr != run_start + run_len ) )
+        {
+            this->prefetch(run_start, run_len);
+            run_len = 0;
+        }
+
+        if ( mapped )
+        {
+            if ( ! run_len )
+                run_start = maddr;
+            run_len += len;
+        }
+
+        if ( end == last )
+            break;
+        addr = end + 1;
     }
+
+    if ( run_len )
+        this->prefetch(run_start, run_len);
 }
 
-void Memory::seek(const maddr_t & addr) const
+void Memory::read_raw(const maddr_t & addr, char * dst, ssize_t n) const
 {
-    for ( std::vector<MemRegion>::const_iterator it = this->regions.begin();
-          it != this->regions.end(); ++it)
+    if ( this->kdump )
+    {
+        this->kdump->read(addr, dst, n);
+        return;
+    }
+
+    const MemRegion & region = this->find_region(addr);
+
+    /* Reads which run off the end of a mapped region fall back to read(), to
+     * retain the previous behaviour of reading contiguously from the file. */
+    if ( region.map && (uint64_t)n <= region.length - (addr - region.start) )
     {
-        if ( it->start <= addr && addr < (it->start + it->length) )
+        std::memcpy(dst, region.map + (addr - region.start), n);
+        return;
+    }
+
+    if ( this->cache.enabled() && this->read_cached(region, addr, dst, n) )
+        return;
+
+    ssize_t r = this->read_at(this->file_offset(addr), dst, n);
+    if ( r != n )
+        throw memread(addr, r, n, errno);
+}
+
+bool Memory::read_cached(const MemRegion & region, const maddr_t & addr,
+                         char * dst, ssize_t n) const
+{
+    static const maddr_t mask = ~(maddr_t)(FrameCache::FRAME_SIZE - 1);
+
+    if ( n <= 0 || n > (ssize_t)FrameCache::FRAME_SIZE )
+        return false;
+
+    maddr_t first = addr & mask, last = (addr + n - 1) & mask;
+
+    if ( first < region.start ||
+         last + FrameCache::FRAME_SIZE > region.start + region.length )
+        return false;
+
+    for ( maddr_t frame = first; frame <= last; frame += FrameCache::FRAME_SIZE )
+    {
+        maddr_t from = std::max(addr, frame);
+        maddr_t to = std::min(addr + n, frame + FrameCache::FRAME_SIZE);
+
         {
-            int64_t foffset = addr - it->start + it->offset;
-            if ( (-(off64_t)1) == lseek64(this->fd, foffset, SEEK_SET) )
+            ScopedLock lock(this->cache_lock);
+            const char * src = this->cache.lookup(frame);
+
+            if ( src )
             {
-                LOG_WARN("Failure to seek: maddr 0x%016"PRIx64", foffset 0x"PRIx64": %s\n",
-                         addr, foffset, strerror(errno));
-                throw memseek(addr, foffset);
+                std::memcpy(dst + (from - addr), src + (from - frame), to - from);
+                continue;
             }
-            return;
         }
+
+        /* Read the frame without holding the lock.  Should another thread
+         * race and insert the same frame, insert() keeps the first copy. */
+        char buf[FrameCache::FRAME_SIZE];
+        ssize_t r = this->read_at(this->file_offset(frame), buf,
+                                  FrameCache::FRAME_SIZE);
+        if ( r != (ssize_t)FrameCache::FRAME_SIZE )
+            throw memread(frame, r, FrameCache::FRAME_SIZE, errno);
+
+        {
+            ScopedLock lock(this->cache_lock);
+            this->cache.insert(frame, buf);
+        }
+
+        std::memcpy(dst + (from - addr), buf + (from - frame), to - from);
+    }
+
+    return true;
+}
+
+ssize_t Memory::read_at(off64_t foffset, char * dst, ssize_t n) const
+{
+    ssize_t total = 0;
+
+    // Prefer the saved core, if it has got this far
+    int fd = this->copy.fd_for(foffset, n);
+    if ( fd < 0 )
+        fd = this->fd;
+
+    while ( total < n )
+    {
+        ssize_t r = pread64(fd, dst + total, n - total, foffset + total);
+
+        if ( r == -1 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return total ? total : -1;
+        }
+        if ( r == 0 )
+            break;
+
+        total += r;
+    }
+
+    return total;
+}
+
+const MemRegion * Memory::lookup_region(const maddr_t & addr) const
+{
+    const size_t nr = this->regions.size();
+
+    if ( ! nr )
+        return NULL;
+
+    /* Fast paths: consecutive reads overwhelmingly hit the same region, or
+     * miss in the same hole.  The hints are only ever indices into the
+     * (immutable after setup) region vector, so relaxed atomics suffice for
+     * concurrent readers. */
+    size_t hint = __atomic_load_n(&this->last_hit, __ATOMIC_RELAXED);
+    if ( hint < nr && this->regions[hint].start <= addr &&
+         addr - this->regions[hint].start < this->regions[hint].length )
+        return &this->regions[hint];
+
+    hint = __atomic_load_n(&this->last_hole, __ATOMIC_RELAXED);
+    if ( hint <= nr && this->in_hole(hint, addr) )
+        return NULL;
+
+    // Index of the first region starting above addr
+    size_t idx = std::upper_bound(this->regions.begin(), this->regions.end(),
+                                  addr, region_start_cmp) - this->regions.begin();
+
+    if ( idx && addr - this->regions[idx-1].start < this->regions[idx-1].length )
+    {
+        __atomic_store_n(&this->last_hit, idx-1, __ATOMIC_RELAXED);
+        return &this->regions[idx-1];
     }
 
+    // addr falls in the hole below regions[idx]
+    __atomic_store_n(&this->last_hole, idx, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+size_t Memory::region_span(const maddr_t & addr, size_t n) const
+{
+    if ( this->kdump )
+        return n;
+
+    const MemRegion * region = this->lookup_region(addr);
+
+    if ( ! region )
+        return n;
+    return std::min(n, (size_t)(region->start + region->length - addr));
+}
+
+bool Memory::in_hole(size_t hole, const maddr_t & addr) const
+{
+    const size_t nr = this->regions.size();
+
+    if ( hole > 0 && addr < this->regions[hole-1].start + this->regions[hole-1].length )
+        return false;
+
+    if ( hole < nr && addr >= this->regions[hole].start )
+        return false;
+
+    return true;
+}
+
+bool Memory::region_start_cmp(const maddr_t & addr, const MemRegion & region)
+{
+    return addr < region.start;
+}
+
+const MemRegion & Memory::find_region(const maddr_t & addr) const
+{
+    const MemRegion * region = this->lookup_region(addr);
+
+    if ( region )
+        return *region;
+
     LOG_WARN("Memory region for 0x%016"PRIx64" not found\n", addr);
     throw memseek(addr, 0);
 }
 
+off64_t Memory::file_offset(const maddr_t & addr) const
+{
+    const MemRegion & region = this->find_region(addr);
+
+    return addr - region.start + region.offset;
+}
+
 /// Memory
 Memory memory;
 
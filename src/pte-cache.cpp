@@ -0,0 +1,88 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/pte-cache.cpp
+ * @author Andrew Cooper
+ */
+
+#include "pte-cache.hpp"
+#include "memory.hpp"
+#include "util/log.hpp"
+
+PTECache::PTECache():
+    locks(), hits(0), misses(0)
+{
+    for ( size_t x = 0; x < NR_ENTRIES; ++x )
+    {
+        this->entries[x].addr = ~(maddr_t)0;
+        this->entries[x].value = 0;
+    }
+}
+
+bool PTECache::read(const maddr_t & entry, uint64_t & value, ReadFault * fault)
+{
+    size_t idx = (entry / sizeof (uint64_t)) & (NR_ENTRIES - 1);
+    Mutex & lock = this->locks[idx & (NR_LOCKS - 1)];
+
+    {
+        ScopedLock l(lock);
+        const Entry & e = this->entries[idx];
+
+        if ( e.addr == entry )
+        {
+            value = e.value;
+            __atomic_add_fetch(&this->hits, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+
+    __atomic_add_fetch(&this->misses, 1, __ATOMIC_RELAXED);
+    if ( ! memory.try_read64(entry, value, fault) )
+        return false;
+
+    {
+        ScopedLock l(lock);
+        Entry & e = this->entries[idx];
+
+        e.addr = entry;
+        e.value = value;
+    }
+    return true;
+}
+
+void PTECache::log_statistics() const
+{
+    if ( this->hits + this->misses )
+        LOG_DEBUG("Pagetable entry cache: %"PRIu64" hits, %"PRIu64" misses\n",
+                  this->hits, this->misses);
+}
+
+PTECache pte_cache;
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
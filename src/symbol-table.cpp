@@ -30,6 +30,14 @@
 #include <cstring>
 #include <cstdio>
 #include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "util/xensym-common.hpp"
 #include "abstract/xensyms.hpp"
@@ -107,100 +115,674 @@ static const char * hypercall_name(const unsigned int nr)
     return "out of range";
 }
 
+/**
+ * Seconds elapsed since a point in time.
+ * @param start Start time, from CLOCK_MONOTONIC.
+ * @returns seconds.
+ */
+static double elapsed(const struct timespec & start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/// Symbol files smaller than this are parsed on a single thread.
+static const size_t PARALLEL_PARSE_MIN = 1 << 20;
+/// Smallest piece of a symbol file worth a thread of its own.
+static const size_t PARSE_CHUNK_MIN = 512 << 10;
+/// Most threads used to parse a symbol file.
+static const long MAX_PARSE_THREADS = 8;
+
+/// A symbol as tokenised, before its name is copied into the arena.
+struct ParsedSymbol
+{
+    /// Symbol, with the offset of its name in the file.
+    Symbol sym;
+    /// Length of the name, so the merge needn't find it again.
+    uint32_t length;
+    /// Hash of the name, taken while scanning it.
+    uint32_t hash;
+};
+
+/// Symbols parsed from one piece of a symbol file.
+struct ParseChunk
+{
+    /// Constructor.  The piece starts empty.
+    ParseChunk(): file(NULL), begin(NULL), end(NULL), symbols(), name_bytes(0),
+                  bad_line(NULL), thread(), threaded(false) {}
+
+    /// Start of the whole file.
+    const char * file;
+    /// Start of the piece, at the start of a line.
+    const char * begin;
+    /// End of the piece, just after a newline or at the end of the file.
+    const char * end;
+    /**
+     * Symbols, with the offsets of their names in the file.  Names are
+     * only copied out of the file once all pieces are parsed, when the
+     * size of the string arena is known.  One vector rather than one per
+     * field, as each push_back() is a call at -Os.
+     */
+    std::vector<ParsedSymbol> symbols;
+    /// Space needed for the names of the symbols.
+    size_t name_bytes;
+    /// First malformed line, or NULL.
+    const char * bad_line;
+    /// Thread parsing the piece.
+    pthread_t thread;
+    /// Whether thread is running.
+    bool threaded;
+
+private:
+    // @cond EXCLUDE
+    ParseChunk(const ParseChunk &);
+    ParseChunk & operator= (const ParseChunk &);
+    // @endcond
+};
+
+/// FNV-1a offset basis, for symbol name hashes.
+static const uint32_t FNV_BASIS = 2166136261U;
+/// FNV-1a prime, for symbol name hashes.
+static const uint32_t FNV_PRIME = 16777619U;
+
+/**
+ * Is a character a field separator on a line of a symbol file.
+ * @param c Character.
+ * @returns boolean.
+ */
+static inline __attribute__((always_inline)) bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * Does a character end a symbol name: a field separator or a newline.
+ * Every character of a name is above ' ', so names only pay for one
+ * comparison per character.
+ * @param c Character.
+ * @returns boolean.
+ */
+static inline __attribute__((always_inline)) bool ends_name(char c)
+{
+    static const uint64_t separators =
+        1ULL << ' ' | 1ULL << '\t' | 1ULL << '\r' | 1ULL << '\n';
+
+    return (unsigned char)c <= ' ' && ((separators >> c) & 1);
+}
+
+/**
+ * Value of each character as a hex digit, or -1.  Addresses are random
+ * mixes of digits and letters, so a table avoids a mispredicted branch on
+ * most characters.
+ */
+static const signed char hex_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/**
+ * Value of a hex digit.
+ * @param c Character.
+ * @returns value, or -1 if c is not a hex digit.
+ */
+static inline __attribute__((always_inline)) int hex_digit(char c)
+{
+    return hex_values[(unsigned char)c];
+}
+
+/**
+ * Tokenise one line of a symbol file: a hex address, a type character and
+ * a name, separated by blanks.  Anything further on the line, such as a
+ * module name, is ignored.
+ * @param p Start of the line.
+ * @param end End of the buffer.
+ * @param addr Address result.
+ * @param type Type result.
+ * @param name Name result.  Not NUL terminated.
+ * @param len Length of the name.
+ * @param hash Hash of the name, as SymbolTable::hash().
+ * @returns Start of the next line, or NULL if the line is malformed.
+ */
+static const char * scan_line(const char * p, const char * end, vaddr_t & addr,
+                              char & type, const char *& name, size_t & len,
+                              uint32_t & hash)
+{
+    unsigned digits = 0;
+    int d;
+
+    if ( end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' )
+        p += 2;
+
+    for ( addr = 0; p < end && (d = hex_digit(*p)) >= 0; ++p, ++digits )
+        addr = (addr << 4) | d;
+
+    if ( digits == 0 || digits > 16 || p == end || ! is_blank(*p) )
+        return NULL;
+
+    while ( p < end && is_blank(*p) )
+        ++p;
+    if ( p == end || *p == '\n' )
+        return NULL;
+    type = *p++;
+
+    if ( p == end || ! is_blank(*p) )
+        return NULL;
+    while ( p < end && is_blank(*p) )
+        ++p;
+
+    // Hash the name as it is scanned, rather than in a second pass
+    for ( name = p, hash = FNV_BASIS; p < end && ! ends_name(*p); ++p )
+        hash = (hash ^ (unsigned char)*p) * FNV_PRIME;
+    if ( (len = p - name) == 0 )
+        return NULL;
+
+    while ( p < end && *p++ != '\n' )
+        ;
+    return p;
+}
+
+/**
+ * Parse a piece of a symbol file, stopping at the first malformed line.
+ * @param chunk Piece to parse.
+ */
+static void parse_chunk(ParseChunk & chunk)
+{
+    const char * p = chunk.begin, * const end = chunk.end;
+    vaddr_t addr;
+    char type;
+    const char * name;
+    size_t len;
+    uint32_t hash;
+
+    // Most lines of a System.map are around 40 characters
+    chunk.symbols.reserve((end - p) / 32);
+
+    while ( p < end )
+    {
+        if ( is_blank(*p) || *p == '\n' )
+        {
+            ++p;
+            continue;
+        }
+
+        const char * line = p;
+
+        if ( NULL == (p = scan_line(line, end, addr, type, name, len, hash)) )
+        {
+            chunk.bad_line = line;
+            return;
+        }
+
+        const ParsedSymbol parsed = { Symbol(addr, type, name - chunk.file), (uint32_t)len, hash };
+
+        chunk.symbols.push_back(parsed);
+        chunk.name_bytes += len + 1;
+    }
+}
+
+/**
+ * Thread entry point for parse_chunk().
+ * @param chunk ParseChunk to parse.
+ * @returns NULL.
+ */
+static void * parse_chunk_thread(void * chunk)
+{
+    parse_chunk(*static_cast<ParseChunk*>(chunk));
+    return NULL;
+}
+
+/**
+ * Split a symbol file at line boundaries and parse the pieces, on several
+ * threads if the file is large.
+ * @param data File contents.
+ * @param size Size of the file.
+ * @param chunks Array of MAX_PARSE_THREADS pieces, filled in file order.
+ * @returns Number of pieces.
+ */
+static long parse_chunks(const char * data, size_t size, ParseChunk * chunks)
+{
+    long nr = 1;
+
+    if ( size >= PARALLEL_PARSE_MIN )
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        nr = std::min(std::min(cpus, MAX_PARSE_THREADS), (long)(size / PARSE_CHUNK_MIN));
+        nr = std::max(nr, 1L);
+    }
+
+    const char * p = data, * const end = data + size;
+
+    for ( long x = 0; x < nr; ++x )
+    {
+        const char * split = ( x == nr - 1 ) ? end : data + size / nr * (x + 1);
+
+        if ( split < p )
+            split = p;
+        while ( split > data && split < end && split[-1] != '\n' )
+            ++split;
+
+        chunks[x].file = data;
+        chunks[x].begin = p;
+        chunks[x].end = p = split;
+    }
+
+    // Parse the first piece on this thread while the others run
+    for ( long x = 1; x < nr; ++x )
+    {
+        int err = pthread_create(&chunks[x].thread, NULL, parse_chunk_thread, &chunks[x]);
+
+        if ( err )
+            LOG_DEBUG("Failed to start symbol parsing thread: %s\n", strerror(err));
+        else
+            chunks[x].threaded = true;
+    }
+
+    parse_chunk(chunks[0]);
+
+    for ( long x = 1; x < nr; ++x )
+    {
+        if ( chunks[x].threaded )
+            pthread_join(chunks[x].thread, NULL);
+        else
+            parse_chunk(chunks[x]);
+    }
+
+    return nr;
+}
+
+/// Magic number at the start of a symbol table cache file.
+static const char CACHE_MAGIC[8] = { 'X', 'C', 'A', 'S', 'Y', 'M', 'T', 'B' };
+/// Version of the cache file layout.
+static const uint64_t CACHE_VERSION = 4;
+
+/// Location of one table in a cache file.
+struct CacheSection
+{
+    /// Offset of the table from the start of the file.  8 byte aligned.
+    uint64_t offset;
+    /// Number of entries in the table.
+    uint64_t count;
+};
+
+/// Header of a symbol table cache file.  The tables follow.
+struct CacheHeader
+{
+    /// CACHE_MAGIC.
+    char magic[8];
+    /// CACHE_VERSION.
+    uint64_t version;
+    /// Sizes of the records in the tables, to reject caches from other builds.
+    uint64_t record_sizes;
+    /// Content hash of the symbol file.
+    uint64_t source_hash;
+    /// Size of the symbol file.
+    uint64_t source_size;
+    /// Whether offset symbols were checked for, and xensyms recorded.
+    uint64_t offsets;
+    /// Hash of the names of the xensyms looked for, from xensyms_hash().
+    uint64_t xensyms_hash;
+    /// Special symbol values.
+    vaddr_t text_start, text_end, init_start, init_end, hypercall_page;
+    /// Tables.
+    CacheSection records, arena, name_index, code_symbols, code_addresses,
+        xensyms, xensym_names;
+};
+
+/**
+ * Start of a vector's storage.
+ * @param v Vector.
+ * @returns Pointer to the first element, or NULL if v is empty.
+ */
+template <typename T>
+static const T * data_of(const std::vector<T> & v)
+{
+    return v.empty() ? NULL : &v[0];
+}
+
+/**
+ * Lay out a table in a cache file.
+ * @param section Section to fill in.
+ * @param end End of the previous table, updated to the end of this one.
+ * @param count Number of entries.
+ * @param size Size of an entry.
+ */
+static void place_section(CacheSection & section, uint64_t & end, uint64_t count,
+                          size_t size)
+{
+    section.offset = end;
+    section.count = count;
+    end = (end + count * size + 7) & ~7ULL;
+}
+
+/**
+ * Check that a table lies within a mapped cache file.
+ * @param section Section to check.
+ * @param size Size of an entry.
+ * @param image_size Size of the cache file.
+ * @returns boolean.
+ */
+static bool check_section(const CacheSection & section, size_t size, size_t image_size)
+{
+    return section.offset % 8 == 0 && section.offset <= image_size &&
+        section.count <= (image_size - section.offset) / size;
+}
+
+/**
+ * Hash of the names in both xensym lists.  A cache only records the
+ * xensyms which the build that wrote it looked for, so is stale once a
+ * build looks for a different set.  The lists are initialised at run
+ * time, so this is too.
+ * @returns 64bit FNV-1a hash.
+ */
+static uint64_t xensyms_hash()
+{
+    static const xensym_t * const lists[] = {
+        Abstract::xensyms::xensyms, x86_64::xensyms::xensyms
+    };
+    uint64_t h = 14695981039346656037ULL;
+
+    for ( size_t x = 0; x < sizeof lists / sizeof lists[0]; ++x )
+    {
+        // Hash each terminator, so names can't run together
+        for ( const xensym_t * sym = lists[x]; sym->name; ++sym )
+            for ( const char * c = sym->name; ; ++c )
+            {
+                h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+                if ( ! *c )
+                    break;
+            }
+        h = (h ^ 0xff) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * Write a whole buffer to a file.
+ * @param fd File descriptor.
+ * @param buf Buffer.
+ * @param len Length of the buffer.
+ * @returns boolean indicating success.
+ */
+static bool write_all(int fd, const void * buf, size_t len)
+{
+    const char * p = static_cast<const char *>(buf);
+
+    while ( len )
+    {
+        ssize_t nr = write(fd, p, len);
+
+        if ( nr == -1 && errno == EINTR )
+            continue;
+        if ( nr <= 0 )
+            return false;
+        p += nr;
+        len -= nr;
+    }
+    return true;
+}
+
+/**
+ * Write a table to a cache file, padding up to its offset.
+ * @param fd File descriptor.
+ * @param pos Current position in the file, updated.
+ * @param section Section describing the table.
+ * @param data Table.
+ * @param size Size of an entry.
+ * @returns boolean indicating success.
+ */
+static bool write_section(int fd, uint64_t & pos, const CacheSection & section,
+                          const void * data, size_t size)
+{
+    static const char zeros[8] = { 0 };
+
+    if ( ! write_all(fd, zeros, section.offset - pos) ||
+         ! write_all(fd, data, section.count * size) )
+        return false;
+
+    pos = section.offset + section.count * size;
+    return true;
+}
+
+const char * SymbolTable::cache_dir = NULL;
+
 SymbolTable::SymbolTable():
     can_print(false), has_hypercall(false), text_start(0), text_end(0), init_start(0),
-    init_end(0), hypercall_page(0), names(&SymbolTable::strcmp), symbols()
+    init_end(0), hypercall_page(0), records(NULL), nr_records(0), arena(NULL),
+    arena_size(0), name_index(NULL), name_index_size(0), code_symbols(NULL),
+    code_addresses(NULL), nr_code(0), image(NULL), image_size(0), all(), strings(),
+    hashes(), names(), symbols(), addresses(), xensyms(), xensym_names()
 {}
 
 SymbolTable::~SymbolTable()
 {
-    for ( name_iter itt = this->names.begin();
-          itt != this->names.end(); ++itt)
-        delete itt->second;
-    this->names.clear();
-    this->symbols.clear();
+    if ( this->image )
+        munmap(this->image, this->image_size);
 }
 
-void SymbolTable::insert(Symbol * sym)
+void SymbolTable::insert(const Symbol & sym)
 {
-    if ( ! std::strcmp(sym->name, "_stext") )
-        this->text_start = sym->address;
-    else if ( ! std::strcmp(sym->name, "_etext") )
-        this->text_end = sym->address;
-    else if ( ! std::strcmp(sym->name, "_sinittext") )
-        this->init_start = sym->address;
-    else if ( ! std::strcmp(sym->name, "_einittext") )
-        this->init_end = sym->address;
-    else if ( ! std::strcmp(sym->name, "hypercall_page") )
-        this->hypercall_page = sym->address;
+    const char * name = &this->strings[sym.name];
 
-    if ( sym->type == 'T' ||
-         sym->type == 't' ||
-         sym->type == 'W' ||
-         sym->type == 'w' )
-        this->symbols.push_back(sym);
+    // Few names are special, and the rest differ in the first character
+    if ( name[0] != '_' && name[0] != 'h' )
+        ;
+    else if ( ! std::strcmp(name, "_stext") )
+        this->text_start = sym.address;
+    else if ( ! std::strcmp(name, "_etext") )
+        this->text_end = sym.address;
+    else if ( ! std::strcmp(name, "_sinittext") )
+        this->init_start = sym.address;
+    else if ( ! std::strcmp(name, "_einittext") )
+        this->init_end = sym.address;
+    else if ( ! std::strcmp(name, "hypercall_page") )
+        this->hypercall_page = sym.address;
 
-    this->names.insert(name_pair(sym->name, sym));
+    this->all.push_back(sym);
 }
 
-const Symbol * SymbolTable::find(const char * name) const
+uint32_t SymbolTable::hash(const char * name)
 {
-    // If we are asked for a symbol by name and more than one of said symbol
-    // is present, give up.
-    if ( this->names.count(name) > 1 )
+    uint32_t h = FNV_BASIS;
+
+    for ( ; *name; ++name )
+        h = (h ^ (unsigned char)*name) * FNV_PRIME;
+    return h;
+}
+
+void SymbolTable::index_names()
+{
+    size_t size = 16;
+
+    while ( size < this->all.size() * 2 )
+        size <<= 1;
+
+    const NameSlot empty = { NAME_EMPTY, 0 };
+    this->names.assign(size, empty);
+
+    // Tokenising hashes the names as it goes.  Otherwise, hash them now.
+    if ( this->hashes.size() != this->all.size() )
+    {
+        this->hashes.resize(this->all.size());
+        for ( size_t x = 0; x < this->all.size(); ++x )
+            this->hashes[x] = SymbolTable::hash(&this->strings[this->all[x].name]);
+    }
+
+    /* The slots are scattered over a table larger than the caches, so
+     * fetch each one a few symbols ahead of its insertion. */
+    static const size_t PREFETCH_AHEAD = 8;
+
+    for ( size_t x = 0; x < this->all.size(); ++x )
     {
-        LOG_INFO("Found more than one symbol with name '%s'\n", name);
+        const char * name = &this->strings[this->all[x].name];
+        const uint32_t h = this->hashes[x];
+
+        if ( x + PREFETCH_AHEAD < this->all.size() )
+            __builtin_prefetch(&this->names[this->hashes[x + PREFETCH_AHEAD] & (size - 1)], 1);
+
+        for ( size_t i = h & (size - 1); ; i = (i + 1) & (size - 1) )
+        {
+            NameSlot & slot = this->names[i];
+
+            if ( slot.idx == NAME_EMPTY )
+            {
+                slot.idx = x;
+                slot.hash = h;
+                break;
+            }
+
+            if ( slot.hash == h &&
+                 ! std::strcmp(&this->strings[this->all[slot.idx & ~NAME_DUP].name], name) )
+            {
+                slot.idx |= NAME_DUP;
+                break;
+            }
+        }
+    }
+
+    std::vector<uint32_t>().swap(this->hashes);
+}
+
+const Symbol * SymbolTable::find(const char * name) const
+{
+    const size_t size = this->name_index_size;
+
+    if ( ! size )
         return NULL;
+
+    const uint32_t h = SymbolTable::hash(name);
+
+    for ( size_t i = h & (size - 1); this->name_index[i].idx != NAME_EMPTY;
+          i = (i + 1) & (size - 1) )
+    {
+        const NameSlot & slot = this->name_index[i];
+        const Symbol * sym = &this->records[slot.idx & ~NAME_DUP];
+
+        if ( slot.hash != h || std::strcmp(this->name_of(*sym), name) )
+            continue;
+
+        // If we are asked for a symbol by name and more than one of said symbol
+        // is present, give up.
+        if ( slot.idx & NAME_DUP )
+        {
+            LOG_INFO("Found more than one symbol with name '%s'\n", name);
+            return NULL;
+        }
+        return sym;
     }
-    name_iter f = this->names.find(name);
-    return f == this->names.end() ? NULL : f->second;
+
+    return NULL;
 }
 
 bool SymbolTable::parse(const char * file, bool offsets)
 {
-    FILE * fd = NULL;
-    vaddr_t addr;
-    char type;
-    char name[128];
-    int nr_read;
+    struct timespec start;
+    struct stat st;
+    int fd;
+    const char * data = NULL;
+    size_t size = 0;
+    std::vector<char> buffer;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    if ( NULL == (fd = fopen(file, "r")) )
+    if ( (fd = open(file, O_RDONLY)) == -1 )
         return false;
 
-    while ( true )
+    if ( fstat(fd, &st) == 0 && st.st_size > 0 )
     {
-        nr_read = fscanf(fd, "%" SCNx64 " %c %127s", &addr, &type, name);
+        void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-        if ( nr_read != 3 )
+        if ( map != MAP_FAILED )
         {
-            if ( feof(fd) )
-                break;
-            SAFE_FCLOSE(fd);
-            return false;
+            data = (const char *)map;
+            size = st.st_size;
         }
+    }
+
+    // Not a regular file, or not mappable.  Read it instead.
+    if ( ! data )
+    {
+        char block[65536];
+        ssize_t nr;
 
-        if ( name[0] == '+' )
+        while ( (nr = read(fd, block, sizeof block)) > 0 ||
+                ( nr == -1 && errno == EINTR ) )
+            if ( nr > 0 )
+                buffer.insert(buffer.end(), block, block + nr);
+
+        if ( nr == -1 )
         {
-            if ( offsets )
-            {
-                insert_xensym(Abstract::xensyms::xensyms, &name[1], addr);
-                insert_xensym(x86_64::xensyms::xensyms, &name[1], addr);
-            }
+            LOG_ERROR("Failed to read symbol file '%s': %s\n", file, strerror(errno));
+            close(fd);
+            return false;
         }
-        else
+
+        data = buffer.empty() ? NULL : &buffer[0];
+        size = buffer.size();
+    }
+
+    close(fd);
+
+    // Symbols refer to their names by 32bit offsets, first into the file
+    if ( size > UINT32_MAX )
+    {
+        LOG_ERROR("Symbol file '%s' is too large\n", file);
+        if ( buffer.empty() )
+            munmap((void *)data, size);
+        return false;
+    }
+
+    char cache_path[PATH_MAX] = "";
+    uint64_t key = 0;
+    bool ok, cached = false;
+
+    if ( SymbolTable::cache_dir )
+    {
+        key = SymbolTable::content_hash(data, size);
+
+        // Offsets change the xensyms recorded, so are part of the key
+        if ( snprintf(cache_path, sizeof cache_path, "%s/%016"PRIx64"%s.symtab",
+                      SymbolTable::cache_dir, key, offsets ? "-xen" : "")
+             >= (int)sizeof cache_path )
         {
-            if ( offsets )
-            {
-                insert_xensym(Abstract::xensyms::xensyms, name, addr);
-                insert_xensym(x86_64::xensyms::xensyms, name, addr);
-            }
-            this->insert( new Symbol(addr, type, name) );
+            LOG_WARN("Symbol table cache directory path too long\n");
+            cache_path[0] = '\0';
         }
+        else
+            cached = this->load_cache(cache_path, key, size, offsets);
     }
 
-    SAFE_FCLOSE(fd);
+    ok = cached || this->build(file, data, size, offsets);
 
-    this->symbols.sort(&SymbolTable::addrcmp);
+    if ( data && buffer.empty() )
+        munmap((void *)data, size);
+
+    if ( ! ok )
+        return false;
+
+    if ( ! cached )
+        this->use_vectors();
+
+    this->log_statistics(elapsed(start));
+
+    if ( ! cached && cache_path[0] )
+        this->save_cache(cache_path, key, size, offsets);
 
     if ( this->text_start == 0 ||
          this->text_end == 0 ||
@@ -231,6 +813,376 @@ bool SymbolTable::parse(const char * file, bool offsets)
     return true;
 }
 
+bool SymbolTable::build(const char * file, const char * data, size_t size, bool offsets)
+{
+    if ( ! this->tokenise(file, data, size, offsets) )
+        return false;
+
+    this->index_names();
+    this->index_addresses();
+    return true;
+}
+
+bool SymbolTable::tokenise(const char * file, const char * data, size_t size, bool offsets)
+{
+    ParseChunk chunks[MAX_PARSE_THREADS];
+    const long nr_chunks = parse_chunks(data, size, chunks);
+
+    size_t nr_symbols = 0, nr_bytes = 0;
+    bool ok = true;
+
+    for ( long x = 0; x < nr_chunks; ++x )
+    {
+        if ( chunks[x].bad_line )
+        {
+            LOG_ERROR("Malformed line %zu of symbol file '%s'\n",
+                      (size_t)std::count(data, chunks[x].bad_line, '\n') + 1, file);
+            ok = false;
+        }
+
+        nr_symbols += chunks[x].symbols.size();
+        nr_bytes += chunks[x].name_bytes;
+    }
+
+    if ( ! ok )
+        return false;
+
+    size_t used = 0;
+
+    this->all.reserve(nr_symbols);
+    this->hashes.reserve(nr_symbols);
+    this->strings.resize(nr_bytes);
+
+    // Merge the pieces in file order, copying the names into the arena
+    for ( long x = 0; x < nr_chunks; ++x )
+    {
+        for ( size_t y = 0; y < chunks[x].symbols.size(); ++y )
+        {
+            const ParsedSymbol & parsed = chunks[x].symbols[y];
+            Symbol sym = parsed.sym;
+            const char * name = data + sym.name;
+            const size_t len = parsed.length;
+
+            sym.name = used;
+            std::memcpy(&this->strings[used], name, len);
+            this->strings[used + len] = '\0';
+
+            // Names starting with '+' are offsets for xensyms only
+            const bool offset_only = name[0] == '+';
+
+            if ( offsets )
+            {
+                const char * xname = &this->strings[sym.name] + offset_only;
+                vaddr_t addr = sym.address;
+                bool found = insert_xensym(Abstract::xensyms::xensyms, xname, addr);
+
+                found = insert_xensym(x86_64::xensyms::xensyms, xname, addr) || found;
+
+                // Remember the xensyms, to replay from a cache
+                if ( found && SymbolTable::cache_dir )
+                {
+                    const XensymRecord rec = { sym.address, this->xensym_names.size() };
+
+                    this->xensyms.push_back(rec);
+                    this->xensym_names.insert(this->xensym_names.end(), xname,
+                                              xname + std::strlen(xname) + 1);
+                }
+            }
+
+            if ( ! offset_only )
+            {
+                used += len + 1;
+                this->insert(sym);
+                this->hashes.push_back(parsed.hash);
+            }
+        }
+
+        std::vector<ParsedSymbol>().swap(chunks[x].symbols);
+    }
+
+    this->strings.resize(used);
+
+    // Trim the space reserved for offset symbols, if any
+    if ( this->all.capacity() != this->all.size() )
+        std::vector<Symbol>(this->all).swap(this->all);
+    if ( this->strings.capacity() != this->strings.size() )
+        std::vector<char>(this->strings).swap(this->strings);
+
+    return true;
+}
+
+void SymbolTable::index_addresses()
+{
+    /* Sort the code symbols by address.  Pairing each address with its
+     * index keeps symbols at the same address in file order. */
+    std::vector<std::pair<vaddr_t, uint32_t> > code;
+
+    code.reserve(this->all.size());
+    for ( size_t x = 0; x < this->all.size(); ++x )
+    {
+        const char t = this->all[x].type;
+
+        if ( t == 'T' || t == 't' || t == 'W' || t == 'w' )
+            code.push_back(std::make_pair(this->all[x].address, (uint32_t)x));
+    }
+
+    // System.map is already in address order, so only sort if it isn't
+    for ( size_t x = 1; x < code.size(); ++x )
+        if ( code[x] < code[x - 1] )
+        {
+            std::sort(code.begin(), code.end());
+            break;
+        }
+
+    this->symbols.resize(code.size());
+    this->addresses.resize(code.size());
+    for ( size_t x = 0; x < code.size(); ++x )
+    {
+        this->addresses[x] = code[x].first;
+        this->symbols[x] = code[x].second;
+    }
+}
+
+void SymbolTable::use_vectors()
+{
+    this->records = data_of(this->all);
+    this->nr_records = this->all.size();
+    this->arena = data_of(this->strings);
+    this->arena_size = this->strings.size();
+    this->name_index = data_of(this->names);
+    this->name_index_size = this->names.size();
+    this->code_symbols = data_of(this->symbols);
+    this->code_addresses = data_of(this->addresses);
+    this->nr_code = this->addresses.size();
+}
+
+uint64_t SymbolTable::content_hash(const char * data, size_t size)
+{
+    uint64_t h = 14695981039346656037ULL, w;
+    size_t x = 0;
+
+    /* Multiplication only carries upwards, so fold the high bits back down
+     * each step, or a change to the top of a word would only reach the top
+     * of the hash. */
+    for ( ; x + sizeof w <= size; x += sizeof w )
+    {
+        std::memcpy(&w, data + x, sizeof w);
+        h = (h ^ w) * 1099511628211ULL;
+        h ^= h >> 32;
+    }
+
+    for ( ; x < size; ++x )
+        h = (h ^ (unsigned char)data[x]) * 1099511628211ULL;
+
+    return (h ^ size) * 1099511628211ULL;
+}
+
+bool SymbolTable::load_cache(const char * path, uint64_t key, size_t size, bool offsets)
+{
+    struct stat st;
+    int fd;
+
+    if ( (fd = open(path, O_RDONLY)) == -1 )
+    {
+        if ( errno != ENOENT )
+            LOG_WARN("Failed to open symbol table cache '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if ( fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof (CacheHeader) )
+    {
+        LOG_WARN("Ignoring truncated symbol table cache '%s'\n", path);
+        close(fd);
+        return false;
+    }
+
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if ( map == MAP_FAILED )
+    {
+        LOG_WARN("Failed to map symbol table cache '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    const char * base = static_cast<const char *>(map);
+    const CacheHeader & hdr = *static_cast<const CacheHeader *>(map);
+    const size_t image_size = st.st_size;
+    const uint64_t record_sizes = sizeof (Symbol) | sizeof (NameSlot) << 16 |
+        (uint64_t)sizeof (XensymRecord) << 32;
+
+    /* Check the header and that every table is within the file.  The name
+     * index must have more slots than there are records, so a probe can
+     * always end at an empty slot. */
+    if ( std::memcmp(hdr.magic, CACHE_MAGIC, sizeof hdr.magic) ||
+         hdr.version != CACHE_VERSION ||
+         hdr.record_sizes != record_sizes ||
+         hdr.source_hash != key ||
+         hdr.source_size != size ||
+         hdr.offsets != offsets ||
+         hdr.xensyms_hash != xensyms_hash() ||
+         ! check_section(hdr.records, sizeof (Symbol), image_size) ||
+         ! check_section(hdr.arena, 1, image_size) ||
+         ! check_section(hdr.name_index, sizeof (NameSlot), image_size) ||
+         ! check_section(hdr.code_symbols, sizeof (uint32_t), image_size) ||
+         ! check_section(hdr.code_addresses, sizeof (vaddr_t), image_size) ||
+         ! check_section(hdr.xensyms, sizeof (XensymRecord), image_size) ||
+         ! check_section(hdr.xensym_names, 1, image_size) ||
+         hdr.records.count >= NAME_DUP ||
+         hdr.name_index.count <= hdr.records.count ||
+         ( hdr.name_index.count & (hdr.name_index.count - 1) ) ||
+         hdr.code_symbols.count != hdr.code_addresses.count ||
+         ( hdr.arena.count && base[hdr.arena.offset + hdr.arena.count - 1] ) ||
+         ( hdr.xensym_names.count &&
+           base[hdr.xensym_names.offset + hdr.xensym_names.count - 1] ) )
+    {
+        LOG_WARN("Ignoring stale or corrupt symbol table cache '%s'\n", path);
+        munmap(map, image_size);
+        return false;
+    }
+
+    const Symbol * records = reinterpret_cast<const Symbol *>(base + hdr.records.offset);
+    const NameSlot * slots = reinterpret_cast<const NameSlot *>(base + hdr.name_index.offset);
+    const uint32_t * code = reinterpret_cast<const uint32_t *>(base + hdr.code_symbols.offset);
+    bool ok = true, empty = false;
+
+    /* Every index into the records and the arena must be in range, or a
+     * corrupt cache would send lookups outside the mapping.  The checks
+     * are branch free, so cost little more than touching the tables. */
+    for ( size_t x = 0; x < hdr.records.count; ++x )
+        ok &= records[x].name < hdr.arena.count;
+    for ( size_t x = 0; x < hdr.name_index.count; ++x )
+    {
+        const uint32_t idx = slots[x].idx;
+
+        empty |= idx == NAME_EMPTY;
+        ok &= idx == NAME_EMPTY || (idx & ~NAME_DUP) < hdr.records.count;
+    }
+    for ( size_t x = 0; x < hdr.code_symbols.count; ++x )
+        ok &= code[x] < hdr.records.count;
+
+    if ( ! ok || ! empty )
+    {
+        LOG_WARN("Ignoring corrupt symbol table cache '%s'\n", path);
+        munmap(map, image_size);
+        return false;
+    }
+
+    const XensymRecord * recs =
+        reinterpret_cast<const XensymRecord *>(base + hdr.xensyms.offset);
+
+    for ( size_t x = 0; x < hdr.xensyms.count; ++x )
+    {
+        if ( recs[x].name >= hdr.xensym_names.count )
+            continue;
+
+        const char * name = base + hdr.xensym_names.offset + recs[x].name;
+        vaddr_t value = recs[x].value;
+
+        insert_xensym(Abstract::xensyms::xensyms, name, value);
+        insert_xensym(x86_64::xensyms::xensyms, name, value);
+    }
+
+    this->image = map;
+    this->image_size = image_size;
+    this->records = records;
+    this->nr_records = hdr.records.count;
+    this->arena = base + hdr.arena.offset;
+    this->arena_size = hdr.arena.count;
+    this->name_index = slots;
+    this->name_index_size = hdr.name_index.count;
+    this->code_symbols = code;
+    this->code_addresses = reinterpret_cast<const vaddr_t *>(base + hdr.code_addresses.offset);
+    this->nr_code = hdr.code_symbols.count;
+
+    this->text_start = hdr.text_start;
+    this->text_end = hdr.text_end;
+    this->init_start = hdr.init_start;
+    this->init_end = hdr.init_end;
+    this->hypercall_page = hdr.hypercall_page;
+
+    LOG_INFO("  Mapped symbol table cache '%s'\n", path);
+    return true;
+}
+
+void SymbolTable::save_cache(const char * path, uint64_t key, size_t size, bool offsets) const
+{
+    CacheHeader hdr;
+    uint64_t end = sizeof hdr, pos = sizeof hdr;
+    char tmp[PATH_MAX];
+    int fd, err;
+
+    std::memset(&hdr, 0, sizeof hdr);
+    std::memcpy(hdr.magic, CACHE_MAGIC, sizeof hdr.magic);
+    hdr.version = CACHE_VERSION;
+    hdr.record_sizes = sizeof (Symbol) | sizeof (NameSlot) << 16 |
+        (uint64_t)sizeof (XensymRecord) << 32;
+    hdr.source_hash = key;
+    hdr.source_size = size;
+    hdr.offsets = offsets;
+    hdr.xensyms_hash = xensyms_hash();
+    hdr.text_start = this->text_start;
+    hdr.text_end = this->text_end;
+    hdr.init_start = this->init_start;
+    hdr.init_end = this->init_end;
+    hdr.hypercall_page = this->hypercall_page;
+
+    place_section(hdr.records, end, this->nr_records, sizeof (Symbol));
+    place_section(hdr.arena, end, this->arena_size, 1);
+    place_section(hdr.name_index, end, this->name_index_size, sizeof (NameSlot));
+    place_section(hdr.code_symbols, end, this->nr_code, sizeof (uint32_t));
+    place_section(hdr.code_addresses, end, this->nr_code, sizeof (vaddr_t));
+    place_section(hdr.xensyms, end, this->xensyms.size(), sizeof (XensymRecord));
+    place_section(hdr.xensym_names, end, this->xensym_names.size(), 1);
+
+    if ( mkdir(SymbolTable::cache_dir, 0777) == -1 && errno != EEXIST )
+    {
+        LOG_WARN("Failed to create symbol table cache directory '%s': %s\n",
+                 SymbolTable::cache_dir, strerror(errno));
+        return;
+    }
+
+    // Write to a temporary file and rename, so readers never see a partial cache
+    if ( snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid()) >= (int)sizeof tmp )
+        return;
+
+    if ( (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 )
+    {
+        LOG_WARN("Failed to create symbol table cache '%s': %s\n", tmp, strerror(errno));
+        return;
+    }
+
+    bool ok = write_all(fd, &hdr, sizeof hdr) &&
+        write_section(fd, pos, hdr.records, this->records, sizeof (Symbol)) &&
+        write_section(fd, pos, hdr.arena, this->arena, 1) &&
+        write_section(fd, pos, hdr.name_index, this->name_index, sizeof (NameSlot)) &&
+        write_section(fd, pos, hdr.code_symbols, this->code_symbols, sizeof (uint32_t)) &&
+        write_section(fd, pos, hdr.code_addresses, this->code_addresses, sizeof (vaddr_t)) &&
+        write_section(fd, pos, hdr.xensyms, data_of(this->xensyms), sizeof (XensymRecord)) &&
+        write_section(fd, pos, hdr.xensym_names, data_of(this->xensym_names), 1);
+    err = errno;
+
+    if ( close(fd) == -1 && ok )
+    {
+        ok = false;
+        err = errno;
+    }
+
+    if ( ok && rename(tmp, path) == -1 )
+    {
+        ok = false;
+        err = errno;
+    }
+
+    if ( ok )
+        LOG_DEBUG("  Saved symbol table cache '%s'\n", path);
+    else
+    {
+        LOG_WARN("Failed to save symbol table cache '%s': %s\n", path, strerror(err));
+        unlink(tmp);
+    }
+}
+
 int SymbolTable::print_symbol64(FILE * o, const vaddr_t & addr, bool brackets) const
 {
     int len = 0;
@@ -241,39 +1193,29 @@ int SymbolTable::print_symbol64(FILE * o, const vaddr_t & addr, bool brackets) c
     if ( ! this->is_text_symbol(addr) )
         return 0;
 
-    SymbolTable::const_list_iter after
-        = std::upper_bound(this->symbols.begin(), this->symbols.end(), addr, &SymbolTable::symcmp);
+    const Symbol * before, * after;
 
-    if ( after == this->symbols.begin() ||
-         after == this->symbols.end() )
+    if ( ! this->lookup(addr, before, after) )
         return 0;
 
-    SymbolTable::const_list_iter before = after;
-    before--;
-
-    if ( (*before)->address <= addr && (*after)->address > addr )
-    {
-        len += FPUTS("\t ", o);
-        if ( brackets )
-            len += FPRINTF(o, "[%016"PRIx64"]", addr);
-        else
-            len += FPRINTF(o, " %016"PRIx64" ", addr);
-
-        len += FPRINTF(o, " %s+%#"PRIx64"/%#"PRIx64,
-                       (*before)->name,
-                       addr - (*before)->address,
-                       (*after)->address - (*before)->address );
+    len += FPUTS("\t ", o);
+    if ( brackets )
+        len += FPRINTF(o, "[%016"PRIx64"]", addr);
+    else
+        len += FPRINTF(o, " %016"PRIx64" ", addr);
 
-        if ( ! std::strcmp((*before)->name, "hypercall_page") )
-        {
-            unsigned int nr = (unsigned int)((addr - (*before)->address)/32);
-            len += FPRINTF(o, " (%d, %s)", nr, hypercall_name(nr));
-        }
+    len += FPRINTF(o, " %s+%#"PRIx64"/%#"PRIx64,
+                   this->name_of(*before),
+                   addr - before->address,
+                   after->address - before->address );
 
-        len += FPUTS("\n", o);
+    if ( ! std::strcmp(this->name_of(*before), "hypercall_page") )
+    {
+        unsigned int nr = (unsigned int)((addr - before->address)/32);
+        len += FPRINTF(o, " (%d, %s)", nr, hypercall_name(nr));
     }
-    else
-        LOG_WARN("Strange resulting iterators printing symbol 0x%016"PRIx64"\n", addr);
+
+    len += FPUTS("\n", o);
 
     return len;
 }
@@ -287,39 +1229,29 @@ int SymbolTable::print_symbol32(FILE * o, const vaddr_t & addr, bool brackets) c
     if ( ! this->is_text_symbol(addr) )
         return 0;
 
-    SymbolTable::const_list_iter after
-        = std::upper_bound(this->symbols.begin(), this->symbols.end(), addr, &SymbolTable::symcmp);
+    const Symbol * before, * after;
 
-    if ( after == this->symbols.begin() ||
-         after == this->symbols.end() )
+    if ( ! this->lookup(addr, before, after) )
         return 0;
 
-    SymbolTable::const_list_iter before = after;
-    before--;
-
-    if ( (*before)->address <= addr && (*after)->address > addr )
-    {
-        len += FPUTS("\t ", o);
-        if ( brackets )
-            len += FPRINTF(o, "[%08"PRIx64"]", addr);
-        else
-            len += FPRINTF(o, " %08"PRIx64" ", addr);
-
-        len += FPRINTF(o, " %s+%#"PRIx64"/%#"PRIx64,
-                       (*before)->name,
-                       addr - (*before)->address,
-                       (*after)->address - (*before)->address );
+    len += FPUTS("\t ", o);
+    if ( brackets )
+        len += FPRINTF(o, "[%08"PRIx64"]", addr);
+    else
+        len += FPRINTF(o, " %08"PRIx64" ", addr);
 
-        if ( ! std::strcmp((*before)->name, "hypercall_page") )
-        {
-            unsigned int nr = (unsigned int)((addr - (*before)->address)/32);
-            len += FPRINTF(o, " (%d, %s)", nr, hypercall_name(nr));
-        }
+    len += FPRINTF(o, " %s+%#"PRIx64"/%#"PRIx64,
+                   this->name_of(*before),
+                   addr - before->address,
+                   after->address - before->address );
 
-        len += FPUTS("\n", o);
+    if ( ! std::strcmp(this->name_of(*before), "hypercall_page") )
+    {
+        unsigned int nr = (unsigned int)((addr - before->address)/32);
+        len += FPRINTF(o, " (%d, %s)", nr, hypercall_name(nr));
     }
-    else
-        LOG_WARN("Strange resulting iterators printing symbol 0x%016"PRIx64"\n", addr);
+
+    len += FPUTS("\n", o);
 
     return len;
 }
@@ -334,25 +1266,15 @@ int SymbolTable::print_text_symbol(FILE * o, const vaddr_t & addr) const
     if ( ! this->is_text_symbol(addr) )
         return 0;
 
-    SymbolTable::const_list_iter after
-        = std::upper_bound(this->symbols.begin(), this->symbols.end(), addr, &SymbolTable::symcmp);
+    const Symbol * before, * after;
 
-    if ( after == this->symbols.begin() ||
-         after == this->symbols.end() )
+    if ( ! this->lookup(addr, before, after) )
         return 0;
 
-    SymbolTable::const_list_iter before = after;
-    before--;
-
-    if ( (*before)->address <= addr && (*after)->address > addr )
-    {
-        len += FPRINTF(o, "%s+%#"PRIx64"/%#"PRIx64,
-                       (*before)->name,
-                       addr - (*before)->address,
-                       (*after)->address - (*before)->address );
-    }
-    else
-        LOG_WARN("Strange resulting iterators printing symbol 0x%016"PRIx64"\n", addr);
+    len += FPRINTF(o, "%s+%#"PRIx64"/%#"PRIx64,
+                   this->name_of(*before),
+                   addr - before->address,
+                   after->address - before->address );
 
     return len;
 }
@@ -378,19 +1300,48 @@ bool SymbolTable::is_text_symbol(const vaddr_t & addr) const
     return false;
 }
 
-bool SymbolTable::strcmp(const char * lhs, const char * rhs)
+void SymbolTable::log_statistics(double seconds) const
 {
-    return std::strcmp(lhs, rhs) < 0;
-}
+    const size_t records = this->nr_records * sizeof (Symbol),
+        arena = this->arena_size,
+        index = this->name_index_size * sizeof (NameSlot) +
+        this->nr_code * (sizeof (uint32_t) + sizeof (vaddr_t));
 
-bool SymbolTable::addrcmp(const Symbol * lhs, const Symbol * rhs)
-{
-    return lhs->address < rhs->address;
+    LOG_INFO("  %zu symbols in %.3fs: %zu kB %s(records %zu kB, names %zu kB, indices %zu kB)\n",
+             this->nr_records, seconds, (records + arena + index) >> 10,
+             this->image ? "mapped " : "", records >> 10, arena >> 10, index >> 10);
 }
 
-bool SymbolTable::symcmp(const vaddr_t & addr, const Symbol * sym)
+bool SymbolTable::lookup(const vaddr_t & addr, const Symbol *& before,
+                         const Symbol *& after) const
 {
-    return addr < sym->address;
+    const size_t nr = this->nr_code;
+
+    if ( nr < 2 )
+        return false;
+
+    /* Upper bound of addr, halving the range each step.  The comparison
+     * only selects between two bases, which compiles to a conditional move
+     * rather than a hard to predict branch. */
+    const vaddr_t * base = this->code_addresses;
+    size_t n = nr;
+
+    while ( n > 1 )
+    {
+        const size_t half = n / 2;
+
+        base = (base[half] <= addr) ? base + half : base;
+        n -= half;
+    }
+
+    const size_t idx = (base - this->code_addresses) + (*base <= addr);
+
+    if ( idx == 0 || idx == nr )
+        return false;
+
+    before = &this->records[this->code_symbols[idx - 1]];
+    after = &this->records[this->code_symbols[idx]];
+    return true;
 }
 
 /*
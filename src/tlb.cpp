@@ -0,0 +1,155 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file src/tlb.cpp
+ * @author Andrew Cooper
+ */
+
+#include "tlb.hpp"
+#include "util/log.hpp"
+
+/// log2 of each page size.
+static const unsigned page_shifts[] = { 12, 21, 30, 39 };
+/// Number of entries for each page size.  Must be powers of 2.
+static const size_t nr_entries[] = { 128, 32, 8, 2 };
+/// Index of the first entry for each page size.
+static const size_t first_entry[] = { 0, 128, 160, 168 };
+
+/// Empty entry marker.  No virtual page number can be this large.
+static const vaddr_t NO_VPN = ~(vaddr_t)0;
+
+uint64_t TLB::hits[TLB::NR_SIZES];
+uint64_t TLB::misses;
+uint64_t TLB::fault_hits;
+
+TLB::TLB():
+    lock()
+{
+    for ( size_t x = 0; x < NR_ENTRIES; ++x )
+    {
+        this->entries[x].vpn = NO_VPN;
+        this->entries[x].base = 0;
+        this->faults[x] = NO_VPN;
+    }
+}
+
+bool TLB::lookup(const vaddr_t & vaddr, maddr_t & maddr, vaddr_t * page_end,
+                 unsigned * page_shift) const
+{
+    ScopedLock lock(this->lock);
+
+    for ( unsigned s = 0; s < NR_SIZES; ++s )
+    {
+        vaddr_t vpn = vaddr >> page_shifts[s];
+        const Entry & e = this->entries[first_entry[s] + (vpn & (nr_entries[s] - 1))];
+
+        if ( e.vpn == vpn )
+        {
+            vaddr_t mask = (1ULL << page_shifts[s]) - 1;
+
+            maddr = e.base | (vaddr & mask);
+            if ( page_end )
+                *page_end = vaddr | mask;
+            if ( page_shift )
+                *page_shift = page_shifts[s];
+
+            __atomic_add_fetch(&TLB::hits[s], 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+
+    __atomic_add_fetch(&TLB::misses, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+void TLB::insert(const vaddr_t & vaddr, const maddr_t & maddr, unsigned page_shift)
+{
+    for ( unsigned s = 0; s < NR_SIZES; ++s )
+        if ( page_shifts[s] == page_shift )
+        {
+            ScopedLock lock(this->lock);
+            vaddr_t vpn = vaddr >> page_shift;
+            Entry & e = this->entries[first_entry[s] + (vpn & (nr_entries[s] - 1))];
+
+            e.vpn = vpn;
+            e.base = maddr & ~((1ULL << page_shift) - 1);
+            return;
+        }
+}
+
+bool TLB::lookup_fault(const vaddr_t & vaddr, int & level) const
+{
+    ScopedLock lock(this->lock);
+
+    for ( unsigned s = 0; s < NR_SIZES; ++s )
+    {
+        vaddr_t vpn = vaddr >> page_shifts[s];
+
+        if ( this->faults[first_entry[s] + (vpn & (nr_entries[s] - 1))] == vpn )
+        {
+            level = s + 1;
+            __atomic_add_fetch(&TLB::fault_hits, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TLB::insert_fault(const vaddr_t & vaddr, int level)
+{
+    if ( level < 1 || level > (int)NR_SIZES )
+        return;
+
+    const unsigned s = level - 1;
+    vaddr_t vpn = vaddr >> page_shifts[s];
+    ScopedLock lock(this->lock);
+
+    this->faults[first_entry[s] + (vpn & (nr_entries[s] - 1))] = vpn;
+}
+
+void TLB::log_statistics()
+{
+    uint64_t total = TLB::misses;
+
+    for ( unsigned s = 0; s < NR_SIZES; ++s )
+        total += TLB::hits[s];
+
+    if ( ! total )
+        return;
+
+    LOG_DEBUG("Pagetable TLB: %"PRIu64" lookups, %"PRIu64" misses.  Hits by page size: "
+              "4K %"PRIu64", 2M %"PRIu64", 1G %"PRIu64", 512G %"PRIu64"\n",
+              total, TLB::misses, TLB::hits[0], TLB::hits[1], TLB::hits[2], TLB::hits[3]);
+    if ( TLB::fault_hits )
+        LOG_DEBUG("Pagetable TLB: %"PRIu64" not-present faults served without a walk\n",
+                  TLB::fault_hits);
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -32,6 +32,30 @@
 #include "memory.hpp"
 
 #include <limits.h>
+#include <cstring>
+#include <algorithm>
+
+/**
+ * Log why a read of virtual memory failed.  Failures are detected with the
+ * non-throwing API, then the read is repeated with the throwing API just to
+ * recover the details.
+ * @param pt Pagetable to use for vaddr lookup.
+ * @param vaddr Virtual address which failed to read.
+ * @param n Number of bytes which failed to read.
+ */
+static void log_read_failure(const PageTable & pt, const vaddr_t & vaddr, size_t n)
+{
+    char buf[16];
+
+    try
+    {
+        memory.read_block_vaddr(pt, vaddr, buf, std::min(n, sizeof buf));
+    }
+    catch ( const CommonError & e )
+    {
+        e.log();
+    }
+}
 
 int print_64bit_stack(FILE * o, const PageTable & pt, const vaddr_t & rsp,
                       const size_t count)
@@ -62,19 +86,16 @@ int print_64bit_stack(FILE * o, const PageTable & pt, const vaddr_t & rsp,
             len += FPRINTF(o, " %16s", "");
     }
 
-    try
+    for ( ; sp < end; sp += WS )
     {
-        for ( ; sp < end; sp += WS )
+        if ( !(sp & mask) )
+            len += FPRINTF(o, "\n\t  %016"PRIx64":", sp);
+        if ( ! memory.try_read64_vaddr(pt, sp, val) )
         {
-            if ( !(sp & mask) )
-                len += FPRINTF(o, "\n\t  %016"PRIx64":", sp);
-            memory.read64_vaddr(pt, sp, val);
-            len += FPRINTF(o, " %016"PRIx64, val);
+            log_read_failure(pt, sp, WS);
+            break;
         }
-    }
-    catch ( const CommonError & e )
-    {
-        e.log();
+        len += FPRINTF(o, " %016"PRIx64, val);
     }
 
     len += FPUTS("\n", o);
@@ -118,19 +139,16 @@ int print_32bit_stack(FILE * o, const PageTable & pt, const vaddr_t & rsp,
 
     }
 
-    try
+    for ( ; sp < end; sp += WS )
     {
-        for ( ; sp < end; sp += WS )
+        if ( !(sp & mask) )
+            len += FPRINTF(o, "\n\t  %08"PRIx64":", sp);
+        if ( ! memory.try_read32_vaddr(pt, sp, val) )
         {
-            if ( !(sp & mask) )
-                len += FPRINTF(o, "\n\t  %08"PRIx64":", sp);
-            memory.read32_vaddr(pt, sp, val);
-            len += FPRINTF(o, " %08"PRIx32, val);
+            log_read_failure(pt, sp, WS);
+            break;
         }
-    }
-    catch ( const CommonError & e )
-    {
-        e.log();
+        len += FPRINTF(o, " %08"PRIx32, val);
     }
 
     len += FPUTS("\n", o);
@@ -173,25 +191,29 @@ int print_code(FILE * o, const PageTable & pt, const vaddr_t & rip)
  * @param pt Page table to use for vaddr lookup
  * @param idx Index of log record to get
  * @param log_buf vaddr of log buffer
- * @returns vaddr of log record associated with index idx.
+ * @param log_ptr Variable to be filled with the vaddr of the log record
+ * associated with index idx.
+ * @returns boolean indicating success, or failure to read the record.
  */
-static vaddr_t log_from_idx(const PageTable & pt, uint64_t idx, vaddr_t log_buf)
+static bool log_from_idx(const PageTable & pt, uint64_t idx, vaddr_t log_buf,
+                         vaddr_t & log_ptr)
 {
-    vaddr_t log_ptr = log_buf + idx;
-    vaddr_t msglen_addr = log_ptr + 8; // &log.len
+    vaddr_t msglen_addr = log_buf + idx + 8; // &log.len
     uint16_t msglen;
 
-    memory.read16_vaddr(pt, msglen_addr, msglen);
+    if ( ! memory.try_read16_vaddr(pt, msglen_addr, msglen) )
+    {
+        log_read_failure(pt, msglen_addr, sizeof msglen);
+        return false;
+    }
 
     /*
      * A length == 0 record is the end of buffer marker.
      * Wrap around and return the message at the start of
      * the buffer.
      */
-    if ( !msglen )
-        log_ptr = log_buf;
-
-    return log_ptr;
+    log_ptr = msglen ? log_buf + idx : log_buf;
+    return true;
 }
 
 /**
@@ -201,15 +223,21 @@ static vaddr_t log_from_idx(const PageTable & pt, uint64_t idx, vaddr_t log_buf)
  * @param pt Page table to use for vaddr lookup.
  * @param idx Index of current log record.
  * @param log_buf vaddr of log buffer.
- * @returns Index of next log record.
+ * @param next Variable to be filled with the index of the next log record.
+ * @returns boolean indicating success, or failure to read the record.
  */
-static uint64_t log_next(const PageTable & pt, uint64_t idx, vaddr_t log_buf)
+static bool log_next(const PageTable & pt, uint64_t idx, vaddr_t log_buf,
+                     uint64_t & next)
 {
-    vaddr_t log_ptr = log_buf + idx;
-    vaddr_t msglen_addr = log_ptr + 8; // &log.len
+    vaddr_t msglen_addr = log_buf + idx + 8; // &log.len
     uint16_t msglen;
 
-    memory.read16_vaddr(pt, msglen_addr, msglen);
+    if ( ! memory.try_read16_vaddr(pt, msglen_addr, msglen) )
+    {
+        log_read_failure(pt, msglen_addr, sizeof msglen);
+        return false;
+    }
+
     /*
      * A length == 0 record is the end of buffer marker. Wrap around and
      * read the message at the start of the buffer as *this* one, and
@@ -217,11 +245,17 @@ static uint64_t log_next(const PageTable & pt, uint64_t idx, vaddr_t log_buf)
      */
     if ( !msglen ) {
         msglen_addr = log_buf + 8; // &log.len
-        memory.read16_vaddr(pt, msglen_addr, msglen);
-        return msglen;
+        if ( ! memory.try_read16_vaddr(pt, msglen_addr, msglen) )
+        {
+            log_read_failure(pt, msglen_addr, sizeof msglen);
+            return false;
+        }
+        next = msglen;
+        return true;
     }
 
-    return idx + msglen;
+    next = idx + msglen;
+    return true;
 }
 
 /**
@@ -292,18 +326,29 @@ int print_console_ring_3x(FILE * o, const PageTable & pt,
     {
         while ( idx != log_next_idx )
         {
-            vaddr_t logptr = log_from_idx(pt, idx, log_buf);
-            vaddr_t txtlen_addr = logptr + 10; // &log.text_len
+            vaddr_t logptr;
+
+            if ( ! log_from_idx(pt, idx, log_buf, logptr) )
+                break;
+
             vaddr_t text_addr = logptr + 16;
 
-            memory.read64_vaddr(pt, logptr, ts_nsec);
-            memory.read8_vaddr(pt, logptr + 15, flags.flag_int);
+            // The whole struct log, in one read
+            char hdr[16];
+            if ( ! memory.try_read_block_vaddr(pt, logptr, hdr, sizeof hdr) )
+            {
+                log_read_failure(pt, logptr, sizeof hdr);
+                break;
+            }
+
+            std::memcpy(&ts_nsec, &hdr[0], sizeof ts_nsec);
+            std::memcpy(&txtlen, &hdr[10], sizeof txtlen); // log.text_len
+            flags.flag_int = hdr[15];
             ts_sec = ts_nsec / 1000000000;
             ts_frac = (ts_nsec % 1000000000) / 1000; /* microseconds */
             len += FPRINTF(o, "[%7"PRIu64".%.6"PRIu64"] %s: ", ts_sec, ts_frac,
                            log_level_str(flags.flag_struct.level));
 
-            memory.read16_vaddr(pt, txtlen_addr, txtlen);
             text_length = txtlen;
             written = memory.write_block_vaddr_to_file(pt, text_addr, o, text_length);
             len += written;
@@ -313,7 +358,8 @@ int print_console_ring_3x(FILE * o, const PageTable & pt,
                 LOG_INFO("Mismatch writing console ring to file. Written %zu bytes "
                          "of %"PRIu64"\n", written, text_length);
 
-            idx = log_next(pt, idx, log_buf);
+            if ( ! log_next(pt, idx, log_buf, idx) )
+                break;
             if ( idx >= log_buf_len )
             {
                 len += FPRINTF(o, "\tidx of 0x%"PRIx64" bad. >= 0x%"PRIx64".\n",
@@ -435,57 +481,54 @@ int dump_data(FILE * o, size_t ws, const PageTable & pt, const vaddr_t & start,
                              start, length);
 
 
-    for ( vaddr_t addr = start; addr < (start+length); addr += ws * 2 )
+    bool failing = false;
+    vaddr_t fail_start = 0, addr;
+
+    for ( addr = start; addr < (start+length); addr += ws * 2 )
     {
-        try
-        {
-            len += FPRINTF(o, "%04"PRIx64": ", addr - start);
+        union { uint64_t _64[2]; uint32_t _32[4]; unsigned char _8[16]; } data;
 
-            if ( ws == 4 )
+        /* Skip unreadable lines, only logging the first of each run, as a
+         * sparse region would otherwise be dominated by failures.  Each run
+         * gets a single marker line in the dump. */
+        if ( ! memory.try_read_block_vaddr(pt, addr, (char*)data._8, ws * 2) )
+        {
+            if ( ! failing )
             {
-                union { uint32_t _32; unsigned char _8 [sizeof (uint32_t)]; } data[2];
-
-                memory.read32_vaddr(pt, addr, data[0]._32);
-
-                for ( size_t x = 0; x < sizeof data[0]._8; ++x )
-                    len += FPRINTF(o, "%02x ", data[0]._8[x]);
-                len += FPUTS(" ", o);
-
-                memory.read32_vaddr(pt, addr+ws, data[1]._32);
-
-                for ( size_t x = 0; x < sizeof data[1]._8; ++x )
-                    len += FPRINTF(o, "%02x ", data[1]._8[x]);
-                len += FPUTS(" ", o);
-
-                len += FPRINTF(o, "0x%08"PRIx32" 0x%08"PRIx32"\n",
-                               data[0]._32, data[1]._32);
+                log_read_failure(pt, addr, ws * 2);
+                fail_start = addr;
             }
-            else
-            {
-                union { uint64_t _64; unsigned char _8 [sizeof (uint64_t)]; } data[2];
-
-                memory.read64_vaddr(pt, addr, data[0]._64);
+            failing = true;
+            continue;
+        }
 
-                for ( size_t x = 0; x < sizeof data[0]._8; ++x )
-                    len += FPRINTF(o, "%02x ", data[0]._8[x]);
-                len += FPUTS(" ", o);
+        if ( failing )
+            len += FPRINTF(o, "%04"PRIx64": <unreadable to %04"PRIx64">\n",
+                           fail_start - start, addr - start);
+        failing = false;
 
-                memory.read64_vaddr(pt, addr+ws, data[1]._64);
+        len += FPRINTF(o, "%04"PRIx64": ", addr - start);
 
-                for ( size_t x = 0; x < sizeof data[1]._8; ++x )
-                    len += FPRINTF(o, "%02x ", data[1]._8[x]);
-                len += FPUTS(" ", o);
-
-                len += FPRINTF(o, "0x%016"PRIx64" 0x%016"PRIx64"\n",
-                               data[0]._64, data[1]._64);
-            }
-        }
-        catch ( const CommonError & e )
+        for ( size_t x = 0; x < ws * 2; ++x )
         {
-            e.log();
+            len += FPRINTF(o, "%02x ", data._8[x]);
+            if ( x == ws - 1 )
+                len += FPUTS(" ", o);
         }
+        len += FPUTS(" ", o);
+
+        if ( ws == 4 )
+            len += FPRINTF(o, "0x%08"PRIx32" 0x%08"PRIx32"\n",
+                           data._32[0], data._32[1]);
+        else
+            len += FPRINTF(o, "0x%016"PRIx64" 0x%016"PRIx64"\n",
+                           data._64[0], data._64[1]);
     }
 
+    if ( failing )
+        len += FPRINTF(o, "%04"PRIx64": <unreadable to %04"PRIx64">\n",
+                       fail_start - start, addr - start);
+
     return 0;
 }
 
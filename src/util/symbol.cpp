@@ -19,43 +19,15 @@
  */
 
 #include "util/symbol.hpp"
-#include "util/macros.hpp"
-
-#include <cstring>
 
 /**
  * @file src/util/symbol.cpp
  * @author Andrew Cooper
  */
 
-Symbol::Symbol(const vaddr_t a, const char t,  const char* n)
-    :address(a), type(t), name(NULL)
-{
-    size_t nlen = strlen(n);
-    this->name = new char[nlen+1];
-    if ( this -> name )
-    {
-        strncpy(this->name, n, nlen);
-        this -> name[nlen] = 0;
-    }
-}
-
-Symbol::Symbol(const Symbol & rhs)
-    :address(rhs.address), type(rhs.type), name(NULL)
-{
-    size_t nlen = strlen(rhs.name);
-    this->name = new char[nlen+1];
-    if ( this -> name )
-    {
-        strncpy(this->name, rhs.name, nlen);
-        this -> name[nlen] = 0;
-    }
-}
-
-Symbol::~Symbol()
-{
-    SAFE_DELETE_ARRAY(this->name);
-}
+Symbol::Symbol(const vaddr_t a, const char t, const uint32_t n)
+    :address(a), name(n), type(t)
+{}
 
 bool Symbol::operator < (const Symbol & rhs) const
 {
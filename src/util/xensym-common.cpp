@@ -28,7 +28,7 @@
 
 #include <cstring>
 
-void insert_xensym(const xensym_t * xensyms, const char * name, vaddr_t & value)
+bool insert_xensym(const xensym_t * xensyms, const char * name, vaddr_t & value)
 {
     const xensym_t * sym;
 
@@ -40,14 +40,16 @@ void insert_xensym(const xensym_t * xensyms, const char * name, vaddr_t & value)
         if ( ! ((*sym->group) & sym->mask) )
         {
             LOG_INFO("Discarding duplicate symbol %s\n", name);
-            break;
+            return true;
         }
 
         (*sym->value) = value;
         (*sym->group) &= ~sym->mask;
 
-        break;
+        return true;
     }
+
+    return false;
 }
 
 bool _required_xensyms(const xensym_t * xensyms, const uint64_t * group)
@@ -0,0 +1,236 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file tools/bench-regions.cpp
+ * @author Andrew Cooper
+ *
+ * Memory region lookup, against a linear scan of the program headers as
+ * Memory::seek() used to do.  Each core has the given number of 2MB
+ * PT_LOAD regions separated by 1MB holes, so none coalesce.  Two access
+ * patterns are timed: runs of consecutive words from a random region,
+ * as when reading a structure or a page, and uniformly random addresses,
+ * a third of which are in holes.  A final pass checks that overlapping
+ * regions are trimmed, such that every covered address is still found.
+ */
+
+#include "bench.hpp"
+#include "memory.hpp"
+#include "util/log.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+/// Expose the region lookup.
+class RegionMemory : public Memory
+{
+public:
+    /**
+     * Look up the region containing addr.
+     * @param addr Machine address.
+     * @returns File offset of addr, or 0 if not in any region.
+     */
+    uint64_t find(const maddr_t & addr) const
+    {
+        const MemRegion * region = this->lookup_region(addr);
+
+        return region ? region->offset + (addr - region->start) : 0;
+    }
+};
+
+/// @cond EXCLUDE
+static const uint64_t REGION_SIZE = 2ULL << 20;
+static const uint64_t REGION_STRIDE = 3ULL << 20;
+static const uint64_t CORE_BASE = 1ULL << 32;
+static const size_t RUN_LENGTH = 512;
+
+/// Results, so the lookups can't be optimised away.
+static volatile uint64_t sink;
+/// @endcond
+
+/**
+ * The old lookup: a linear scan of the regions in program header order.
+ * @param elf Elf file.
+ * @param addr Machine address.
+ * @returns File offset of addr, or 0 if not in any region.
+ */
+static uint64_t linear_find(const BenchElf & elf, const maddr_t & addr)
+{
+    for ( int x = 0; x < elf.nr_phdrs; ++x )
+    {
+        const ElfProgHdr & ph = elf.phdrs[x];
+
+        if ( ph.phys <= addr && addr < ph.phys + ph.size )
+            return ph.offset + (addr - ph.phys);
+    }
+    return 0;
+}
+
+/**
+ * Generate an address to look up.
+ * @param nr Number of regions.
+ * @param sequential Runs of consecutive words, or uniformly random.
+ * @param n Lookup number.
+ * @returns Machine address.
+ */
+static maddr_t next_addr(int nr, bool sequential, size_t n)
+{
+    static maddr_t run = 0;
+
+    if ( ! sequential )
+        return CORE_BASE + bench_rand() % (nr * REGION_STRIDE);
+
+    if ( n % RUN_LENGTH == 0 )
+        run = CORE_BASE + (bench_rand() % nr) * REGION_STRIDE +
+            (bench_rand() % (REGION_SIZE / 8 - RUN_LENGTH)) * 8;
+
+    return run + (n % RUN_LENGTH) * 8;
+}
+
+/**
+ * Time lookups with both methods, checking that they agree.
+ * @param nr Number of regions.
+ * @param sequential Access pattern.
+ * @returns boolean indicating whether the results agreed.
+ */
+static bool bench(int nr, bool sequential)
+{
+    BenchElf elf(nr);
+    RegionMemory mem;
+    // Few enough lookups that the scan of many regions stays quick
+    const size_t nr_lookups = 1 << 21;
+    const size_t nr_linear = std::max<size_t>(4096, (size_t(1) << 27) / nr);
+    double t0, t1, t2;
+
+    // File offsets descending, so a region is never contiguous with the next
+    for ( int x = 0; x < nr; ++x )
+    {
+        elf.phdrs[x].phys = CORE_BASE + x * REGION_STRIDE;
+        elf.phdrs[x].size = REGION_SIZE;
+        elf.phdrs[x].offset = 4096 + (nr - 1 - x) * REGION_SIZE;
+    }
+
+    if ( ! mem.setup("/dev/null", &elf, false) )
+        return false;
+
+    t0 = bench_now();
+    for ( size_t n = 0; n < nr_lookups; ++n )
+        sink += mem.find(next_addr(nr, sequential, n));
+    t1 = bench_now();
+    for ( size_t n = 0; n < nr_linear; ++n )
+        sink += linear_find(elf, next_addr(nr, sequential, n));
+    t2 = bench_now();
+
+    printf("%7d regions  %-10s  lookup %7.1f ns   linear scan %9.1f ns\n",
+           nr, sequential ? "sequential" : "random",
+           (t1 - t0) * 1e9 / nr_lookups, (t2 - t1) * 1e9 / nr_linear);
+
+    // Check the two agree over the same addresses
+    for ( size_t n = 0; n < nr_linear; ++n )
+    {
+        maddr_t addr = next_addr(nr, sequential, n);
+
+        if ( mem.find(addr) != linear_find(elf, addr) )
+        {
+            printf("Mismatch at 0x%016"PRIx64"\n", addr);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check that lookups over overlapping and duplicate regions find every
+ * covered address, at an offset some region containing it agrees with.
+ * @returns boolean indicating success.
+ */
+static bool check_overlaps()
+{
+    const int nr = 1000;
+    BenchElf elf(nr);
+    RegionMemory mem;
+    int old_verbosity = verbosity;
+
+    for ( int x = 0; x < nr; ++x )
+    {
+        elf.phdrs[x].phys = CORE_BASE + (bench_rand() % 4096) * 4096;
+        elf.phdrs[x].size = (1 + bench_rand() % 64) * 4096;
+        elf.phdrs[x].offset = 4096 + x * (64 * 4096);
+    }
+
+    // Overlaps are expected, so don't warn about every one
+    verbosity = LOG_LEVEL_ERROR;
+    bool ok = mem.setup("/dev/null", &elf, false);
+    verbosity = old_verbosity;
+    if ( ! ok )
+        return false;
+
+    for ( maddr_t addr = CORE_BASE - 4096; addr < CORE_BASE + (4160 << 12); addr += 512 )
+    {
+        uint64_t offset = mem.find(addr);
+        bool covered = false, agreed = false;
+
+        for ( int x = 0; x < nr; ++x )
+        {
+            const ElfProgHdr & ph = elf.phdrs[x];
+
+            if ( ph.phys <= addr && addr < ph.phys + ph.size )
+            {
+                covered = true;
+                if ( offset == ph.offset + (addr - ph.phys) )
+                    agreed = true;
+            }
+        }
+
+        if ( covered != agreed || ( ! covered && offset ) )
+        {
+            printf("Overlapping regions: 0x%016"PRIx64" %s\n", addr,
+                   ! covered ? "found in a hole" :
+                   offset ? "found at the wrong offset" : "not found");
+            return false;
+        }
+    }
+
+    printf("Overlapping regions: all covered addresses found\n");
+    return true;
+}
+
+int main()
+{
+    static const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+
+    for ( size_t x = 0; x < sizeof sizes / sizeof *sizes; ++x )
+        if ( ! bench(sizes[x], true) || ! bench(sizes[x], false) )
+            return 1;
+
+    return check_overlaps() ? 0 : 1;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
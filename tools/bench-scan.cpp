@@ -0,0 +1,152 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file tools/bench-scan.cpp
+ * @author Andrew Cooper
+ *
+ * Scanning a sparse virtual address space a word at a time, as stack and
+ * data dumps do, with the throwing read64_vaddr() against the status
+ * returning try_read64_vaddr().  A synthetic core holds 4-level
+ * pagetables mapping 2MB with every seventh page missing, followed by
+ * 16MB which is not mapped at all.
+ */
+
+#include "bench.hpp"
+#include "memory.hpp"
+#include "exceptions.hpp"
+#include "arch/x86_64/pagetable.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <unistd.h>
+
+/// @cond EXCLUDE
+static const uint64_t PTE_PRESENT_RW = 0x3;
+static const maddr_t L4_TABLE = 0x1000, L3_TABLE = 0x2000,
+    L2_TABLE = 0x3000, L1_TABLE = 0x4000, DATA = 0x100000;
+static const size_t NR_PAGES = 512;
+static const vaddr_t SCAN_BASE = 0xffff830000000000ULL;
+static const uint64_t SCAN_MAPPED = NR_PAGES * 4096, SCAN_UNMAPPED = 16ULL << 20;
+/// @endcond
+
+/**
+ * Write the synthetic core contents.
+ * @param fd File descriptor.
+ * @returns boolean indicating success.
+ */
+static bool write_core(int fd)
+{
+    std::vector<uint64_t> core((DATA + SCAN_MAPPED) / 8, 0);
+
+    core[L4_TABLE / 8 + ((SCAN_BASE >> 39) & 511)] = L3_TABLE | PTE_PRESENT_RW;
+    core[L3_TABLE / 8] = L2_TABLE | PTE_PRESENT_RW;
+    core[L2_TABLE / 8] = L1_TABLE | PTE_PRESENT_RW;
+
+    for ( size_t x = 0; x < NR_PAGES; ++x )
+        if ( x % 7 != 6 )
+            core[L1_TABLE / 8 + x] = (DATA + x * 4096) | PTE_PRESENT_RW;
+
+    for ( size_t x = DATA / 8; x < core.size(); ++x )
+        core[x] = bench_rand();
+
+    size_t len = core.size() * 8;
+    return write(fd, &core[0], len) == (ssize_t)len;
+}
+
+int main()
+{
+    char path[] = "/tmp/bench-scan.XXXXXX";
+    int fd = bench_tmpfile(path);
+    double t0, t1, t2;
+    uint64_t sum = 0, try_sum = 0, nr = 0, try_nr = 0;
+
+    if ( fd == -1 )
+        return 1;
+
+    bool ok = write_core(fd);
+    close(fd);
+
+    BenchElf elf(1);
+    elf.phdrs[0].phys = 0;
+    elf.phdrs[0].size = DATA + SCAN_MAPPED;
+    elf.phdrs[0].offset = 0;
+
+    ok = ok && memory.setup(path, &elf, true);
+    unlink(path);
+    if ( ! ok )
+        return 1;
+
+    x86_64::PT64 pt(L4_TABLE);
+    const vaddr_t end = SCAN_BASE + SCAN_MAPPED + SCAN_UNMAPPED;
+
+    t0 = bench_now();
+    for ( vaddr_t v = SCAN_BASE; v < end; v += 8 )
+    {
+        uint64_t val;
+
+        try
+        {
+            memory.read64_vaddr(pt, v, val);
+            sum += val;
+            ++nr;
+        }
+        catch ( const CommonError & )
+        {
+        }
+    }
+    t1 = bench_now();
+    for ( vaddr_t v = SCAN_BASE; v < end; v += 8 )
+    {
+        uint64_t val;
+
+        if ( memory.try_read64_vaddr(pt, v, val) )
+        {
+            try_sum += val;
+            ++try_nr;
+        }
+    }
+    t2 = bench_now();
+
+    printf("%"PRIu64" of %"PRIu64" words readable\n", try_nr,
+           (end - SCAN_BASE) / 8);
+    printf("read64_vaddr() with exceptions  %7.3fs\n", t1 - t0);
+    printf("try_read64_vaddr()              %7.3fs  (%.1fx)\n",
+           t2 - t1, (t1 - t0) / (t2 - t1));
+
+    if ( sum != try_sum || nr != try_nr )
+    {
+        printf("Results differ\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
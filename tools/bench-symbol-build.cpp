@@ -0,0 +1,268 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file tools/bench-symbol-build.cpp
+ * @author Andrew Cooper
+ *
+ * Memory, allocations and time taken to build a symbol table, against
+ * the old layout of one heap object and one name allocation per symbol,
+ * referenced from a std::multimap by name and a std::list of the code
+ * symbols.  The table is 50000 synthetic symbols, tokenised once, and
+ * both layouts are built from the same tokenised records, so neither
+ * time includes parsing.  Each time is the fastest of several builds,
+ * reported with the memory of that build.
+ */
+
+#include "bench.hpp"
+#include "symbol-table.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <vector>
+
+#include <unistd.h>
+
+/// @cond EXCLUDE
+static const size_t NR_SYMBOLS = 50000;
+static const int NR_BUILDS = 10;
+/// @endcond
+
+/// A symbol as it used to be stored.
+struct OldSymbol
+{
+    /// Virtual address.
+    vaddr_t address;
+    /// Type of symbol.
+    char type;
+    /// Name, in its own allocation.
+    char * name;
+};
+
+/**
+ * Comparator for the old name index.
+ * @param lhs Name.
+ * @param rhs Name.
+ * @returns boolean indicating whether lhs sorts before rhs.
+ */
+static bool name_cmp(const char * lhs, const char * rhs)
+{
+    return std::strcmp(lhs, rhs) < 0;
+}
+
+/**
+ * Comparator for the old address index.
+ * @param lhs Symbol.
+ * @param rhs Symbol.
+ * @returns boolean indicating whether lhs is at a lower address.
+ */
+static bool addr_cmp(const OldSymbol * lhs, const OldSymbol * rhs)
+{
+    return lhs->address < rhs->address;
+}
+
+/// The old name index.
+typedef std::multimap<const char *, OldSymbol *, bool(*)(const char *, const char *)> NameMap;
+
+/// The old indices.
+struct OldTable
+{
+    /// Constructor.
+    OldTable(): names(name_cmp), symbols() {}
+
+    /// Destructor.
+    ~OldTable()
+    {
+        for ( NameMap::iterator it = this->names.begin();
+              it != this->names.end(); ++it )
+        {
+            delete [] it->second->name;
+            delete it->second;
+        }
+    }
+
+    /// All symbols, by name.
+    NameMap names;
+    /// Code symbols, by address.
+    std::list<OldSymbol *> symbols;
+
+private:
+    // @cond EXCLUDE
+    OldTable(const OldTable &);
+    OldTable & operator= (const OldTable &);
+    // @endcond
+};
+
+/// Expose the tokenised records, to build both layouts from.
+class BuildTable : public SymbolTable
+{
+public:
+    /**
+     * Tokenise a symbol file, without indexing it.
+     * @param path Symbol file.
+     * @returns boolean indicating success.
+     */
+    bool tokenise_file(const char * path)
+    {
+        std::vector<char> data;
+        FILE * f = fopen(path, "r");
+        char buf[65536];
+        size_t n;
+
+        if ( ! f )
+            return false;
+        while ( (n = fread(buf, 1, sizeof buf, f)) > 0 )
+            data.insert(data.end(), buf, buf + n);
+        fclose(f);
+
+        return ! data.empty() && this->tokenise(path, &data[0], data.size(), false);
+    }
+
+    /**
+     * Build the current layout from another table's tokenised records,
+     * as SymbolTable::parse() does after tokenising.
+     * @param src Tokenised table.
+     */
+    void build_new(const BuildTable & src)
+    {
+        this->strings = src.strings;
+        this->all.reserve(src.all.size());
+        for ( size_t x = 0; x < src.all.size(); ++x )
+            this->insert(src.all[x]);
+
+        this->index_names();
+        this->index_addresses();
+        this->use_vectors();
+    }
+
+    /**
+     * Build the old layout from this table's tokenised records.
+     * @param old Table to fill.
+     */
+    void build_old(OldTable & old) const
+    {
+        for ( size_t x = 0; x < this->all.size(); ++x )
+        {
+            const Symbol & sym = this->all[x];
+            const char * name = &this->strings[sym.name];
+            OldSymbol * o = new OldSymbol;
+
+            o->address = sym.address;
+            o->type = sym.type;
+            o->name = new char[std::strlen(name) + 1];
+            std::strcpy(o->name, name);
+
+            if ( o->type == 'T' || o->type == 't' || o->type == 'W' || o->type == 'w' )
+                old.symbols.push_back(o);
+            old.names.insert(std::make_pair(o->name, o));
+        }
+
+        old.symbols.sort(addr_cmp);
+    }
+
+    /// Number of symbols.
+    size_t size() const { return this->all.size(); }
+};
+
+/// Cost of one build of a layout.
+struct BuildCost
+{
+    /// Bytes held by the built table.
+    size_t bytes;
+    /// Allocations made while building.
+    size_t allocs;
+    /// Time taken to build.
+    double secs;
+};
+
+/**
+ * Keep the fastest build, along with its memory.
+ * @param best Fastest build so far, whose secs is 0 before the first.
+ * @param bytes Bytes held by this build.
+ * @param allocs Allocations made by this build.
+ * @param secs Time taken by this build.
+ */
+static void keep_fastest(BuildCost & best, size_t bytes, size_t allocs, double secs)
+{
+    if ( best.secs == 0 || secs < best.secs )
+    {
+        best.bytes = bytes;
+        best.allocs = allocs;
+        best.secs = secs;
+    }
+}
+
+int main()
+{
+    char path[] = "/tmp/bench-symbols.XXXXXX";
+    BuildCost now = { 0, 0, 0 }, old = { 0, 0, 0 };
+    BuildTable src;
+
+    if ( ! bench_symbol_file(path, NR_SYMBOLS) )
+        return 1;
+
+    const bool ok = src.tokenise_file(path);
+
+    unlink(path);
+    if ( ! ok )
+        return 1;
+
+    for ( int x = 0; x < NR_BUILDS; ++x )
+    {
+        {
+            BuildTable table;
+            const size_t b0 = bench_allocated(), a0 = bench_allocations();
+            const double t0 = bench_now();
+
+            table.build_new(src);
+            keep_fastest(now, bench_allocated() - b0, bench_allocations() - a0,
+                         bench_now() - t0);
+        }
+
+        {
+            OldTable table;
+            const size_t b0 = bench_allocated(), a0 = bench_allocations();
+            const double t0 = bench_now();
+
+            src.build_old(table);
+            keep_fastest(old, bench_allocated() - b0, bench_allocations() - a0,
+                         bench_now() - t0);
+        }
+    }
+
+    printf("%zu tokenised symbols, fastest of %d builds\n", src.size(), NR_BUILDS);
+    printf("records and arena  %6zu kB  %7zu allocations  %6.1f ms\n",
+           now.bytes >> 10, now.allocs, now.secs * 1000);
+    printf("old layout         %6zu kB  %7zu allocations  %6.1f ms\n",
+           old.bytes >> 10, old.allocs, old.secs * 1000);
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,174 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file tools/bench-symbol-lookup.cpp
+ * @author Andrew Cooper
+ *
+ * Symbol lookups by address, as print_symbol64() and friends make for
+ * every stack word, against std::upper_bound over a std::list of the
+ * code symbols as SymbolTable used to do.  The table is 50000 synthetic
+ * symbols, and the addresses are random over the text range.
+ */
+
+#include "bench.hpp"
+#include "symbol-table.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <list>
+#include <vector>
+
+#include <unistd.h>
+
+/// Expose the address lookup.
+class LookupTable : public SymbolTable
+{
+public:
+    /**
+     * Find the code symbols either side of an address.
+     * @param addr Address to look up.
+     * @param before Symbol containing addr.
+     * @param after Next symbol after before.
+     * @returns boolean indicating whether addr is between two symbols.
+     */
+    bool find_addr(const vaddr_t & addr, const Symbol *& before, const Symbol *& after) const
+    {
+        return this->lookup(addr, before, after);
+    }
+
+    /**
+     * The code symbols, in address order.
+     * @param list List to fill.
+     */
+    void code_list(std::list<const Symbol *> & list) const
+    {
+        for ( size_t x = 0; x < this->nr_code; ++x )
+            list.push_back(&this->records[this->code_symbols[x]]);
+    }
+
+    /// First address of the text section.
+    vaddr_t first() const { return this->text_start; }
+    /// Last address of the text section.
+    vaddr_t last() const { return this->text_end; }
+};
+
+/// @cond EXCLUDE
+static const size_t NR_SYMBOLS = 50000;
+static const size_t NR_LOOKUPS = 1 << 21;
+static const size_t NR_LIST_LOOKUPS = 4096;
+
+/// Results, so the lookups can't be optimised away.
+static volatile uintptr_t sink;
+/// @endcond
+
+/**
+ * Comparator for the old search.
+ * @param addr Address.
+ * @param sym Symbol.
+ * @returns boolean indicating whether addr is below sym.
+ */
+static bool symbol_cmp(const vaddr_t & addr, const Symbol * sym)
+{
+    return addr < sym->address;
+}
+
+/**
+ * The old lookup: upper_bound over a list.
+ * @param list Code symbols, in address order.
+ * @param addr Address to look up.
+ * @param before Symbol containing addr.
+ * @param after Next symbol after before.
+ * @returns boolean indicating whether addr is between two symbols.
+ */
+static bool list_lookup(const std::list<const Symbol *> & list, const vaddr_t & addr,
+                        const Symbol *& before, const Symbol *& after)
+{
+    std::list<const Symbol *>::const_iterator it =
+        std::upper_bound(list.begin(), list.end(), addr, symbol_cmp);
+
+    if ( it == list.begin() || it == list.end() )
+        return false;
+
+    after = *it;
+    before = *--it;
+    return true;
+}
+
+int main()
+{
+    char path[] = "/tmp/bench-symbols.XXXXXX";
+    LookupTable table;
+    std::list<const Symbol *> list;
+    std::vector<vaddr_t> addrs(NR_LOOKUPS);
+    const Symbol * before, * after, * list_before, * list_after;
+    double t0, t1, t2;
+
+    if ( ! bench_symbol_file(path, NR_SYMBOLS) )
+        return 1;
+    bool ok = table.parse(path);
+    unlink(path);
+    if ( ! ok )
+        return 1;
+
+    table.code_list(list);
+
+    // Up to 256 bytes either side of the text section, to include misses
+    for ( size_t x = 0; x < NR_LOOKUPS; ++x )
+        addrs[x] = table.first() - 256 +
+            bench_rand() % (table.last() - table.first() + 512);
+
+    for ( size_t x = 0; x < NR_LIST_LOOKUPS; ++x )
+    {
+        bool found = table.find_addr(addrs[x], before, after);
+
+        if ( found != list_lookup(list, addrs[x], list_before, list_after) ||
+             ( found && ( before != list_before || after != list_after ) ) )
+        {
+            printf("Lookup of 0x%016"PRIx64" differs\n", addrs[x]);
+            return 1;
+        }
+    }
+
+    t0 = bench_now();
+    for ( size_t x = 0; x < NR_LIST_LOOKUPS; ++x )
+        if ( list_lookup(list, addrs[x], before, after) )
+            sink += (uintptr_t)before;
+    t1 = bench_now();
+    for ( size_t x = 0; x < NR_LOOKUPS; ++x )
+        if ( table.find_addr(addrs[x], before, after) )
+            sink += (uintptr_t)before;
+    t2 = bench_now();
+
+    printf("%zu code symbols\n", list.size());
+    printf("std::list upper_bound   %12.0f lookups/s\n", NR_LIST_LOOKUPS / (t1 - t0));
+    printf("sorted array            %12.0f lookups/s\n", NR_LOOKUPS / (t2 - t1));
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,182 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file tools/bench-symbol-names.cpp
+ * @author Andrew Cooper
+ *
+ * Symbol lookups by name, against the std::multimap keyed by strcmp()
+ * which SymbolTable used to use, with its count() then find().  The
+ * table is 50000 synthetic symbols.  One lookup in eight is for a name
+ * which isn't in the table.  The memory taken by each index is also
+ * reported.
+ */
+
+#include "bench.hpp"
+#include "symbol-table.hpp"
+#include "util/log.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/// @cond EXCLUDE
+static const size_t NR_SYMBOLS = 50000;
+static const size_t NR_LOOKUPS = 1 << 20;
+
+/// Results, so the lookups can't be optimised away.
+static volatile uintptr_t sink;
+/// @endcond
+
+/**
+ * Comparator for the old index.
+ * @param lhs Name.
+ * @param rhs Name.
+ * @returns boolean indicating whether lhs sorts before rhs.
+ */
+static bool name_cmp(const char * lhs, const char * rhs)
+{
+    return std::strcmp(lhs, rhs) < 0;
+}
+
+/// The old name index.
+typedef std::multimap<const char *, const Symbol *, bool(*)(const char *, const char *)> NameMap;
+
+/// Expose the records, to build the old index from.
+class NameTable : public SymbolTable
+{
+public:
+    /**
+     * Build the old index.
+     * @param names Index to fill.
+     */
+    void name_map(NameMap & names) const
+    {
+        for ( size_t x = 0; x < this->nr_records; ++x )
+            names.insert(std::make_pair(this->name_of(this->records[x]),
+                                        &this->records[x]));
+    }
+
+    /// Memory used by the name index, in bytes.
+    size_t index_size() const { return this->name_index_size * sizeof (NameSlot); }
+
+    /**
+     * Name of a symbol.
+     * @param x Record number.
+     * @returns Name.
+     */
+    const char * name(size_t x) const { return this->name_of(this->records[x]); }
+
+    /// Number of symbols.
+    size_t size() const { return this->nr_records; }
+};
+
+/**
+ * The old lookup: refuse ambiguous names, then find.
+ * @param names Old index.
+ * @param name Name to look up.
+ * @returns Symbol, or NULL.
+ */
+static const Symbol * map_find(const NameMap & names, const char * name)
+{
+    if ( names.count(name) > 1 )
+        return NULL;
+
+    NameMap::const_iterator it = names.find(name);
+    return it == names.end() ? NULL : it->second;
+}
+
+int main()
+{
+    char path[] = "/tmp/bench-symbols.XXXXXX";
+    NameTable table;
+    NameMap names(name_cmp);
+    std::vector<std::string> queries;
+    size_t before, map_bytes;
+    double t0, t1, t2;
+    int old_verbosity = verbosity;
+
+    if ( ! bench_symbol_file(path, NR_SYMBOLS) )
+        return 1;
+    bool ok = table.parse(path);
+    unlink(path);
+    if ( ! ok )
+        return 1;
+
+    before = bench_allocated();
+    table.name_map(names);
+    map_bytes = bench_allocated() - before;
+
+    // Copies, so neither index can match by pointer
+    queries.reserve(4096);
+    for ( size_t x = 0; x < 4096; ++x )
+    {
+        char missing[32];
+
+        if ( x % 8 )
+            queries.push_back(table.name(bench_rand() % table.size()));
+        else
+        {
+            snprintf(missing, sizeof missing, "bench_missing_%zu", x);
+            queries.push_back(missing);
+        }
+    }
+
+    // Ambiguous names are logged, which would swamp the timings
+    verbosity = -1;
+
+    for ( size_t x = 0; x < queries.size(); ++x )
+        if ( table.find(queries[x].c_str()) != map_find(names, queries[x].c_str()) )
+        {
+            printf("Lookup of '%s' differs\n", queries[x].c_str());
+            return 1;
+        }
+
+    t0 = bench_now();
+    for ( size_t x = 0; x < NR_LOOKUPS; ++x )
+        sink += (uintptr_t)map_find(names, queries[x % queries.size()].c_str());
+    t1 = bench_now();
+    for ( size_t x = 0; x < NR_LOOKUPS; ++x )
+        sink += (uintptr_t)table.find(queries[x % queries.size()].c_str());
+    t2 = bench_now();
+
+    verbosity = old_verbosity;
+
+    printf("%zu symbols\n", table.size());
+    printf("std::multimap  %12.0f lookups/s  %6zu kB\n",
+           NR_LOOKUPS / (t1 - t0), map_bytes >> 10);
+    printf("hash index     %12.0f lookups/s  %6zu kB\n",
+           NR_LOOKUPS / (t2 - t1), table.index_size() >> 10);
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
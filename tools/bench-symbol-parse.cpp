@@ -0,0 +1,183 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file tools/bench-symbol-parse.cpp
+ * @author Andrew Cooper
+ *
+ * Parsing a symbol file the size of a full vmlinux System.map, against
+ * the fscanf() loop which SymbolTable::parse() used to use.  The
+ * tokenising, into the records and string arena, and the building of the
+ * name and address indices are timed separately, as well as the whole
+ * parse.  Each figure is the fastest of several runs, as the slower runs
+ * only measure interference.  The old loop only tokenises, without
+ * building any table.
+ * Files this size are split over up to eight threads, one per online
+ * CPU, so the tokenising figure depends on the CPUs reported.
+ */
+
+#include "bench.hpp"
+#include "symbol-table.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <unistd.h>
+
+/// @cond EXCLUDE
+static const size_t NR_SYMBOLS = 200000;
+static const int NR_PARSES = 10;
+/// @endcond
+
+/// Expose the steps of a parse.
+class ParseTable : public SymbolTable
+{
+public:
+    /**
+     * Tokenise a symbol file, without indexing it.
+     * @param data Contents of the file.
+     * @returns boolean indicating success.
+     */
+    bool tokenise_only(const std::vector<char> & data)
+    {
+        return this->tokenise("bench", &data[0], data.size(), false);
+    }
+
+    /// Build the name and address indices from the tokenised symbols.
+    void index_only()
+    {
+        this->index_names();
+        this->index_addresses();
+    }
+
+    /// Number of symbols tokenised.
+    size_t size() const { return this->all.size(); }
+};
+
+/**
+ * The old tokenising loop.
+ * @param path Symbol file.
+ * @returns Number of symbols read.
+ */
+static size_t fscanf_parse(const char * path)
+{
+    FILE * file = fopen(path, "r");
+    uint64_t addr;
+    char type;
+    char name[128];
+    size_t nr = 0;
+
+    if ( ! file )
+        return 0;
+
+    while ( fscanf(file, "%" SCNx64 " %c %127s", &addr, &type, name) == 3 )
+        ++nr;
+
+    fclose(file);
+    return nr;
+}
+
+/**
+ * Read a whole file.
+ * @param path File.
+ * @param data Contents result.
+ * @returns boolean indicating success.
+ */
+static bool read_file(const char * path, std::vector<char> & data)
+{
+    FILE * file = fopen(path, "r");
+    char block[65536];
+    size_t nr;
+
+    if ( ! file )
+        return false;
+
+    while ( (nr = fread(block, 1, sizeof block, file)) > 0 )
+        data.insert(data.end(), block, block + nr);
+
+    fclose(file);
+    return ! data.empty();
+}
+
+int main()
+{
+    char path[] = "/tmp/bench-symbols.XXXXXX";
+    std::vector<char> data;
+    size_t nr = 0, old_nr = 0;
+    double old_secs = 1e9, tok_secs = 1e9, index_secs = 1e9, parse_secs = 1e9;
+
+    if ( ! bench_symbol_file(path, NR_SYMBOLS) )
+        return 1;
+
+    bool ok = read_file(path, data);
+
+    for ( int x = 0; ok && x < NR_PARSES; ++x )
+    {
+        ParseTable split, whole;
+        double t0, t1, t2, t3, t4;
+
+        t0 = bench_now();
+        old_nr = fscanf_parse(path);
+        t1 = bench_now();
+        ok = split.tokenise_only(data);
+        t2 = bench_now();
+        split.index_only();
+        t3 = bench_now();
+        ok = ok && whole.parse(path);
+        t4 = bench_now();
+
+        old_secs = std::min(old_secs, t1 - t0);
+        tok_secs = std::min(tok_secs, t2 - t1);
+        index_secs = std::min(index_secs, t3 - t2);
+        parse_secs = std::min(parse_secs, t4 - t3);
+        nr = split.size();
+    }
+    unlink(path);
+
+    if ( ! ok )
+        return 1;
+
+    printf("%zu symbols, %.1f MB, %ld online CPUs, fastest of %d parses\n",
+           nr, data.size() / 1048576.0, sysconf(_SC_NPROCESSORS_ONLN), NR_PARSES);
+    printf("fscanf() tokenising          %7.1f ms\n", old_secs * 1000);
+    printf("tokenise()                   %7.1f ms  (%.1fx)\n",
+           tok_secs * 1000, old_secs / tok_secs);
+    printf("index_names(), addresses     %7.1f ms\n", index_secs * 1000);
+    printf("SymbolTable::parse()         %7.1f ms  (%.1fx)\n",
+           parse_secs * 1000, old_secs / parse_secs);
+
+    if ( nr != old_nr )
+    {
+        printf("Symbol counts differ\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,203 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+/**
+ * @file tools/bench.cpp
+ * @author Andrew Cooper
+ */
+
+#include "bench.hpp"
+
+#include "util/log.hpp"
+#include "util/macros.hpp"
+#include "util/file.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <new>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/// Only warnings and errors, so the log doesn't distort the timings.
+int verbosity = LOG_LEVEL_WARN;
+
+/// Additional error file descriptor for logging.
+static FILE * additional_log = NULL;
+void set_additional_log(FILE * fd) { additional_log = fd; }
+
+void __log(int severity, const char *, int, const char *, const char * fmt, ...)
+{
+    va_list vargs;
+
+    if ( severity > verbosity )
+        return;
+
+    va_start(vargs, fmt);
+    vfprintf(stderr, fmt, vargs);
+    va_end(vargs);
+}
+
+FILE * fopen_in_outdir(const char * path, const char * flags)
+{
+    return fopen(path, flags);
+}
+
+void fclose_failure(int err)
+{
+    if ( err )
+        LOG_ERROR("fclose failed: %s\n", strerror(err));
+}
+
+/// @cond EXCLUDE
+/// Room before each allocation to record its size, keeping the alignment.
+static const size_t ALLOC_HEADER = 16;
+static size_t allocated = 0, allocations = 0;
+/// @endcond
+
+void * operator new(size_t size) throw(std::bad_alloc)
+{
+    char * ptr = (char *)malloc(size + ALLOC_HEADER);
+
+    if ( ! ptr )
+        throw std::bad_alloc();
+
+    // Symbol tables are parsed on several threads
+    *(size_t *)ptr = size;
+    __atomic_add_fetch(&allocated, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return ptr + ALLOC_HEADER;
+}
+
+void operator delete(void * ptr) throw()
+{
+    if ( ! ptr )
+        return;
+
+    char * base = (char *)ptr - ALLOC_HEADER;
+
+    __atomic_sub_fetch(&allocated, *(size_t *)base, __ATOMIC_RELAXED);
+    free(base);
+}
+
+size_t bench_allocated()
+{
+    return __atomic_load_n(&allocated, __ATOMIC_RELAXED);
+}
+
+size_t bench_allocations()
+{
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+double bench_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint64_t bench_rand()
+{
+    static uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+int bench_tmpfile(char * path)
+{
+    int fd = mkstemp(path);
+
+    if ( fd == -1 )
+        LOG_ERROR("mkstemp(%s) failed: %s\n", path, strerror(errno));
+
+    return fd;
+}
+
+bool bench_symbol_file(char * path, size_t nr)
+{
+    int fd = bench_tmpfile(path);
+    FILE * file;
+    vaddr_t addr = 0xffffffff81000000ULL;
+
+    if ( fd == -1 )
+        return false;
+
+    if ( ! (file = fdopen(fd, "w")) )
+    {
+        LOG_ERROR("fdopen() failed: %s\n", strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    fprintf(file, "%016"PRIx64" T _stext\n", addr);
+    for ( size_t x = 0; x < nr; ++x )
+    {
+        addr += 16 + bench_rand() % 400;
+        fprintf(file, "%016"PRIx64" %c bench_symbol_%zu\n", addr, x & 1 ? 't' : 'T', x);
+        if ( x % 7 == 0 )
+            fprintf(file, "%016"PRIx64" t bench_alias_%zu\n", addr, x);
+    }
+    fprintf(file, "%016"PRIx64" T _etext\n", addr + 16);
+    fprintf(file, "%016"PRIx64" T _sinittext\n", addr + 32);
+    fprintf(file, "%016"PRIx64" T _einittext\n", addr + 48);
+
+    if ( fclose(file) )
+    {
+        LOG_ERROR("fclose() failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+BenchElf::BenchElf(int nr):
+    Abstract::Elf(open("/dev/null", O_RDONLY))
+{
+    this->arch = Abstract::Elf::ELF_64;
+    this->nr_phdrs = nr;
+    this->phdrs = new ElfProgHdr[nr];
+
+    memset(this->phdrs, 0, nr * sizeof *this->phdrs);
+    for ( int x = 0; x < nr; ++x )
+        this->phdrs[x].type = PT_LOAD;
+}
+
+bool BenchElf::parse()
+{
+    return true;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,121 @@
+/*
+ *  This file is part of the Xen Crashdump Analyser.
+ *
+ *  The Xen Crashdump Analyser is free software: you can redistribute
+ *  it and/or modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  The Xen Crashdump Analyser is distributed in the hope that it will
+ *  be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *  warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Xen Crashdump Analyser.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2013 Citrix Inc.
+ */
+
+#ifndef __BENCH_HPP__
+#define __BENCH_HPP__
+
+/**
+ * @file tools/bench.hpp
+ * @author Andrew Cooper
+ *
+ * Common support for the microbenchmarks.  The benchmarks link against
+ * every object of the program except main.o, so this provides the few
+ * symbols main.o would otherwise, logging to stderr.
+ */
+
+#include "types.hpp"
+#include "abstract/elf.hpp"
+
+#include <stdint.h>
+
+/**
+ * Monotonic time.
+ * @returns Seconds since an arbitrary point.
+ */
+double bench_now();
+
+/**
+ * Pseudo-random number generator (xorshift64*), so results are the same
+ * from run to run and system to system.
+ * @returns 64bit random number.
+ */
+uint64_t bench_rand();
+
+/**
+ * Memory currently allocated with operator new.  The benchmarks replace
+ * the global operator new and delete to keep count.
+ * @returns Number of bytes.
+ */
+size_t bench_allocated();
+
+/**
+ * Number of calls to operator new so far.
+ * @returns Number of allocations.
+ */
+size_t bench_allocations();
+
+/**
+ * Create a temporary file.  The caller is responsible for unlinking it.
+ * @param path Buffer for the path, which must end in "XXXXXX", and is
+ * updated with the path of the file.
+ * @returns file descriptor, or -1 on failure.
+ */
+int bench_tmpfile(char * path);
+
+/**
+ * Write a synthetic nm-format symbol table: _stext, then nr symbols of
+ * alternating global and local text type at increasing addresses, with
+ * an alias for every seventh, then _etext, _sinittext and _einittext.
+ * @param path Buffer for the path, which must end in "XXXXXX", and is
+ * updated with the path of the file.  The caller is responsible for
+ * unlinking it.
+ * @param nr Number of symbols, excluding aliases and markers.
+ * @returns boolean indicating success.
+ */
+bool bench_symbol_file(char * path, size_t nr);
+
+/**
+ * Elf core file whose program headers are supplied by the benchmark,
+ * rather than parsed from a file.
+ */
+class BenchElf : public Abstract::Elf
+{
+public:
+    /**
+     * Constructor.
+     * @param nr Number of PT_LOAD program headers.  They are zeroed, for
+     * the benchmark to fill in.
+     */
+    BenchElf(int nr);
+
+    /**
+     * Nothing to parse.
+     * @returns true.
+     */
+    virtual bool parse();
+
+private:
+    // @cond EXCLUDE
+    BenchElf(const BenchElf &);
+    BenchElf & operator= (const BenchElf &);
+    // @endcond
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */